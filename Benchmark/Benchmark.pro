@@ -0,0 +1,19 @@
+# Per-stage benchmark of the simulation kernels, runs without a window or GL context.
+
+TEMPLATE = app
+CONFIG += console
+CONFIG -= qt
+CONFIG -= app_bundle
+TARGET = TerrainFluidBenchmark
+
+DEFINES += HEADLESS_BUILD
+QMAKE_CXXFLAGS += -std=c++11
+
+include(../Simulation/Simulation.pri)
+
+SOURCES += main.cpp
+
+mac {
+    INCLUDEPATH += /usr/local/include
+    QMAKE_CXXFLAGS += -stdlib=libc++
+}
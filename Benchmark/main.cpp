@@ -0,0 +1,402 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <chrono>
+#include <functional>
+#include <map>
+
+#include "tclap/CmdLine.h"
+#include "platform_includes.h"
+
+#include "SimulationState.h"
+#include "Simulation/FluidSimulation.h"
+#include "Exception.h"
+
+using namespace std;
+using Simulation::FluidSimulation;
+
+// Stage description
+////////////////////////////////////////////////////////////////////////////
+
+struct Stage
+{
+    std::string name;
+
+    /// Simulation stage whose kernel variant is selected before the run,
+    /// Count for stages without variants.
+    Simulation::Stage kernelStage;
+
+    /// Grid cells touched by one call (0: whole grid).
+    uint cells;
+
+    /// Compulsory memory traffic per touched cell in bytes (reads + writes of
+    /// every grid the stage streams over, ignoring caches and write-allocate).
+    uint bytesPerCell;
+
+    std::function<void(FluidSimulation&,double)> run;
+};
+
+/// Traffic of the half precision mode (FluidSimulation::halfPrecision) is
+/// counted with 2 bytes for the velocities.
+static std::vector<Stage> MakeStages(bool staggered, bool half)
+{
+    std::vector<Stage> stages;
+    typedef Simulation::Stage S;
+    // makeRain adds 100 drops with a 3x3 footprint
+    stages.push_back({"makeRain", S::Count, 900, 8,
+                      [](FluidSimulation& s, double dt){ s.makeRain(dt); }});
+    if (staggered)
+    {
+        // K and edge pass: terrain, water, 2x flux r/w, K; water pass: 2x flux, water r/w, uVel, vVel
+        stages.push_back({"simulateFlow", S::Flow, 0, 4*(2+4+1 + 2+2+2),
+                          [](FluidSimulation& s, double dt){ s.simulateFlow(dt); }});
+    }
+    else
+    {
+        // flux pass: terrain, water, 4x flux r/w; water pass: 4x flux, water r/w, uVel, vVel
+        stages.push_back({"simulateFlow", S::Flow, 0, half ? 4u*(2+8 + 4+2) + 2u*2 : 4u*(2+8 + 4+2+2),
+                          [](FluidSimulation& s, double dt){ s.simulateFlow(dt); }});
+    }
+    const uint velocity = half ? 2*2 : 4*2;
+    // uVel, vVel, terrain r/w, water r/w, sediment r/w, slope pass: terrain, slope w/r
+    stages.push_back({"simulateErosion", S::Erosion, 0, velocity + 4*(2+2+2+3),
+                      [](FluidSimulation& s, double dt){ s.simulateErosion(dt); }});
+    // uVel, vVel, sediment gather, back buffer write (swapped, no copy back)
+    stages.push_back({"simulateSedimentTransportation", S::SedimentTransportation, 0, velocity + 4*(1+1),
+                      [](FluidSimulation& s, double dt){ s.simulateSedimentTransportation(dt); }});
+    // water r/w
+    stages.push_back({"simulateEvaporation", S::Evaporation, 0, 4*2,
+                      [](FluidSimulation& s, double dt){ s.simulateEvaporation(dt); }});
+    // flow, erosion and evaporation in one sweep: terrain r/w, water r/w,
+    // 4x flux r/w, uVel, vVel, sediment r/w, slope w
+    if (!staggered)
+    {
+        stages.push_back({"simulateFused", S::FlowErosionEvaporation, 0, half ? 4u*(2+2+8+2+1) + 2u*2 : 4u*(2+2+8+2+2+1),
+                          [](FluidSimulation& s, double dt){ s.simulateFused(dt); }});
+    }
+    // terrain, back buffer write (swapped, no copy back)
+    stages.push_back({"smoothTerrain", S::Count, 0, 4*(1+1),
+                      [](FluidSimulation& s, double){ s.smoothTerrain(); }});
+    // terrain, water, packed normal
+    stages.push_back({"computeSurfaceNormals", S::SurfaceNormals, 0, 4*2+4,
+                      [](FluidSimulation& s, double){ s.computeSurfaceNormals(); }});
+    return stages;
+}
+
+// Helpers
+////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+static std::vector<T> ParseList(const std::string& text)
+{
+    std::vector<T> values;
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss,item,','))
+    {
+        if (item.empty()) continue;
+        std::stringstream is(item);
+        T v;
+        is >> v;
+        values.push_back(v);
+    }
+    return values;
+}
+
+static void SetThreadCount(Simulation::ParallelSettings settings, int threads)
+{
+    settings.threads = threads;
+    Simulation::Parallel::Configure(settings);
+}
+
+/// Prepares the terrain preset, a wet preset is flooded and run for a few
+/// steps so velocities and fluxes are non-trivial. A pond preset only floods
+/// the central sixteenth of the grid (sparse workloads).
+static void PreparePreset(SimulationState& state, FluidSimulation& sim,
+                          const std::string& terrain, const std::string& water, double dt)
+{
+    if (terrain == "steep")
+        state.createSteepTerrain();
+    else
+        state.createPerlinTerrain();
+
+    // the snapshot holds the grids of the flux model in use
+    sim.applyFluxModel();
+    if (water == "dry") return;
+
+    uint w = state.water.width();
+    uint h = state.water.height();
+    uint x0 = 0, y0 = 0, x1 = w, y1 = h;
+    if (water == "pond")
+    {
+        x0 = 3*w/8; x1 = 5*w/8;
+        y0 = 3*h/8; y1 = 5*h/8;
+    }
+
+    for (uint y=y0; y<y1; ++y)
+        for (uint x=x0; x<x1; ++x)
+            state.water(y,x) = 0.5f;
+    sim.activeTiles.invalidate();
+
+    for (int i=0; i<10; ++i)
+        sim.update(dt,water != "pond",false);
+}
+
+/// Copy of the prepared state, the fluxes and the velocities. Restored
+/// before every stage at every thread count, so each timing starts from the
+/// same state: the stages change the water (e.g. makeRain wets the dry
+/// preset) and the scaling efficiency has to compare the same work.
+struct Snapshot
+{
+    SimulationState state;
+    PaddedGrid2D<float> lFlux, rFlux, tFlux, bFlux;
+    PaddedGrid2D<float> xFlux, yFlux;
+    Grid2D<float> uVel, vVel;
+    Grid2D<Half> uVelHalf, vVelHalf;
+
+    Snapshot(const FluidSimulation& sim)
+        : state(sim.state),
+          lFlux(sim.lFlux), rFlux(sim.rFlux), tFlux(sim.tFlux), bFlux(sim.bFlux),
+          xFlux(sim.xFlux), yFlux(sim.yFlux),
+          uVel(sim.uVel), vVel(sim.vVel),
+          uVelHalf(sim.uVelHalf), vVelHalf(sim.vVelHalf)
+    {
+    }
+
+    void restore(FluidSimulation& sim) const
+    {
+        sim.state = state;
+        sim.lFlux = lFlux; sim.rFlux = rFlux; sim.tFlux = tFlux; sim.bFlux = bFlux;
+        sim.xFlux = xFlux; sim.yFlux = yFlux;
+        sim.uVel = uVel; sim.vVel = vVel;
+        sim.uVelHalf = uVelHalf; sim.vVelHalf = vVelHalf;
+        sim.activeTiles.invalidate();
+        sim.invalidateSurfaceNormals();
+        // the same drops at every thread count
+        FluidSimulation::restartRain();
+    }
+};
+
+// Main
+////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv)
+{
+    std::vector<uint> dims;
+    std::vector<int> threads;
+    std::vector<std::string> terrains;
+    std::vector<std::string> wetness;
+    std::string stageFilter;
+    int reps = 10;
+    double dt = 1000.0/60;
+    bool csv = false;
+    bool sparse = false;
+    bool staggered = false;
+    bool half = false;
+    std::vector<std::string> kernels;
+    Simulation::ParallelSettings parallel;
+
+    try
+    {
+        TCLAP::CmdLine cmd("Per-stage benchmark of the fluid simulation kernels.", ' ', "0.9");
+        TCLAP::ValueArg<std::string> dimsArg("d","dims","Grid sizes. Default: 256,512,1024,2048.",false,"256,512,1024,2048","list");
+        TCLAP::ValueArg<std::string> threadsArg("j","threads","Thread counts. Default: 1 and all cores.",false,"","list");
+        TCLAP::ValueArg<std::string> terrainArg("","terrain","Terrain presets (perlin,steep). Default: perlin,steep.",false,"perlin,steep","list");
+        TCLAP::ValueArg<std::string> wetArg("w","water","Water presets (dry,wet,pond). Default: dry,wet.",false,"dry,wet","list");
+        TCLAP::ValueArg<std::string> stageArg("s","stage","Only run stages containing this string.",false,"","string");
+        TCLAP::ValueArg<int> repsArg("n","reps","Timed repetitions per stage. Default: 10.",false,10,"int");
+        TCLAP::ValueArg<double> dtArg("t","dt","Timestep in milliseconds. Default: 16.67.",false,1000.0/60,"double");
+        TCLAP::ValueArg<std::string> kernelArg("k","kernels","Kernel variants to compare (scalar,sse4,avx2,avx512). Default: best supported.",false,"","list");
+        TCLAP::SwitchArg sparseArg("","sparse","Only visit the active tiles (FluidSimulation::sparse).",false);
+        TCLAP::SwitchArg staggeredArg("","staggered","Use the staggered edge fluxes (FluidSimulation::staggered).",false);
+        TCLAP::SwitchArg halfArg("","half","Store the velocities as 16 bit floats (FluidSimulation::halfPrecision).",false);
+        TCLAP::SwitchArg csvArg("c","csv","Print results as CSV.",false);
+        TCLAP::ValueArg<std::string> parallelArg("","parallel","Threads of the parallel loops: serial, omp, pool or gcd. Default: omp (gcd on macOS).",false,"","string");
+        TCLAP::ValueArg<std::string> scheduleArg("","schedule","static or dynamic (work stealing). Default: static.",false,"static","string");
+        TCLAP::ValueArg<uint> grainArg("","grain","Rows or tiles per chunk of the dynamic schedule. Default: about eight chunks per thread.",false,0,"uint");
+        TCLAP::SwitchArg pinArg("","pin","Pin worker i to hardware thread i.",false);
+        cmd.add(dimsArg);
+        cmd.add(threadsArg);
+        cmd.add(terrainArg);
+        cmd.add(wetArg);
+        cmd.add(stageArg);
+        cmd.add(repsArg);
+        cmd.add(dtArg);
+        cmd.add(kernelArg);
+        cmd.add(sparseArg);
+        cmd.add(staggeredArg);
+        cmd.add(halfArg);
+        cmd.add(csvArg);
+        cmd.add(parallelArg);
+        cmd.add(scheduleArg);
+        cmd.add(grainArg);
+        cmd.add(pinArg);
+        cmd.parse( argc, argv );
+
+        dims = ParseList<uint>(dimsArg.getValue());
+        threads = ParseList<int>(threadsArg.getValue());
+        terrains = ParseList<std::string>(terrainArg.getValue());
+        wetness = ParseList<std::string>(wetArg.getValue());
+        stageFilter = stageArg.getValue();
+        reps = std::max(1,repsArg.getValue());
+        dt = dtArg.getValue();
+        csv = csvArg.getValue();
+        sparse = sparseArg.getValue();
+        staggered = staggeredArg.getValue();
+        half = halfArg.getValue();
+        kernels = ParseList<std::string>(kernelArg.getValue());
+        if (!parallelArg.getValue().empty())
+            parallel.backend = Simulation::ParseParallelBackend(parallelArg.getValue());
+        parallel.schedule = Simulation::ParseSchedule(scheduleArg.getValue());
+        parallel.grain = grainArg.getValue();
+        parallel.pin = pinArg.getValue();
+        Simulation::Parallel::Configure(parallel);
+    }
+    catch (TCLAP::ArgException &e)
+    {
+        std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+        return 1;
+    }
+    catch (Exception& e)
+    {
+        std::cerr << "error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    if (threads.empty())
+    {
+        threads.push_back(1);
+        if (Simulation::Parallel::Threads() > 1) threads.push_back(Simulation::Parallel::Threads());
+    }
+
+    if (kernels.empty())
+        kernels.push_back(Simulation::KernelVariantName(Simulation::BestKernelVariant()));
+
+    std::vector<Simulation::KernelVariant> variants;
+    for (const std::string& name : kernels)
+    {
+        Simulation::KernelVariant variant;
+        try
+        {
+            variant = Simulation::ParseKernelVariant(name);
+        }
+        catch (Exception& e)
+        {
+            std::cerr << "error: " << e.what() << std::endl;
+            return 1;
+        }
+        if (!Simulation::KernelVariantSupported(variant))
+        {
+            std::cerr << "skipping kernel variant '" << name << "': not supported on this CPU" << std::endl;
+            continue;
+        }
+        variants.push_back(variant);
+    }
+
+    // one run per requested kernel variant of every stage that has variants
+    std::vector<Stage> stages;
+    for (const Stage& stage : MakeStages(staggered,half && !staggered))
+    {
+        if (stage.kernelStage == Simulation::Stage::Count)
+        {
+            stages.push_back(stage);
+            continue;
+        }
+        for (Simulation::KernelVariant variant : variants)
+        {
+            Stage s = stage;
+            s.name = stage.name + "[" + Simulation::KernelVariantName(variant) + "]";
+            s.run = [stage,variant](FluidSimulation& sim, double dt){
+                if (stage.kernelStage == Simulation::Stage::FlowErosionEvaporation)
+                    sim.setKernelVariant(variant);
+                else
+                    sim.setKernelVariant(stage.kernelStage,variant);
+                stage.run(sim,dt);
+            };
+            stages.push_back(s);
+        }
+    }
+
+    using namespace std::chrono;
+    high_resolution_clock clock;
+
+    if (csv)
+        cout << "terrain,water,dim,threads,stage,ms_per_call,mcells_per_s,gb_per_s,efficiency\n";
+
+    for (const std::string& terrain : terrains)
+    for (const std::string& water : wetness)
+    for (uint dim : dims)
+    {
+        SimulationState state(dim,dim);
+        FluidSimulation sim(state);
+        sim.sparse = sparse;
+        sim.staggered = staggered;
+        sim.halfPrecision = half;
+
+        PreparePreset(state,sim,terrain,water,dt);
+        const Snapshot prepared(sim);
+
+        // single thread reference time per stage for the scaling efficiency
+        std::map<std::string,double> reference;
+
+        for (int t : threads)
+        {
+            SetThreadCount(parallel,t);
+
+            for (const Stage& stage : stages)
+            {
+                if (!stageFilter.empty() && stage.name.find(stageFilter) == std::string::npos)
+                    continue;
+
+                prepared.restore(sim);
+                stage.run(sim,dt); // warm up
+
+                high_resolution_clock::time_point start = clock.now();
+                for (int r=0; r<reps; ++r)
+                    stage.run(sim,dt);
+                double seconds = duration_cast<duration<double>>(clock.now()-start).count()/reps;
+
+                uint cells = stage.cells ? stage.cells : dim*dim;
+
+                double cellsPerSecond = cells/seconds;
+                double bytesPerSecond = double(cells)*stage.bytesPerCell/seconds;
+
+                if (reference.find(stage.name) == reference.end())
+                    reference[stage.name] = seconds*t;
+                double efficiency = reference[stage.name]/(seconds*t);
+
+                if (csv)
+                {
+                    cout << terrain << "," << water << "," << dim << "," << t << ","
+                         << stage.name << "," << seconds*1e3 << ","
+                         << cellsPerSecond/1e6 << "," << bytesPerSecond/1e9 << ","
+                         << efficiency << "\n";
+                }
+                else
+                {
+                    cout << std::left << std::setw(7) << terrain << std::setw(4) << water
+                         << std::right << std::setw(6) << dim << std::setw(4) << t << "T  "
+                         << std::left << std::setw(40) << stage.name << std::right << std::fixed
+                         << std::setprecision(3) << std::setw(10) << seconds*1e3 << " ms "
+                         << std::setprecision(1) << std::setw(9) << cellsPerSecond/1e6 << " Mcells/s "
+                         << std::setprecision(2) << std::setw(7) << bytesPerSecond/1e9 << " GB/s "
+                         << std::setprecision(0) << std::setw(4) << efficiency*100 << "% eff\n";
+                    cout.unsetf(std::ios::fixed);
+                }
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,61 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#ifndef DOUBLEBUFFER_H
+#define DOUBLEBUFFER_H
+
+#include "platform_includes.h"
+
+/// Ping-pong buffers for a grid that is updated out of place.
+///
+/// The front buffer is an existing grid (e.g. a grid of SimulationState), the
+/// back buffer has the same shape and is owned by the DoubleBuffer. A pass
+/// reads front() and writes back(), swap() then exchanges their contents in
+/// O(1). References to the front grid stay valid and see the new values, so
+/// the renderer and other holders of the grid need not know about the swap.
+///
+/// GRID is Grid2D or PaddedGrid2D. The halo is not swapped in a meaningful
+/// state, call updateHalo() on the front before the next stencil pass.
+template<typename GRID>
+class DoubleBuffer
+{
+public:
+    DoubleBuffer(GRID& front)
+        : _front(front)
+    {
+        resize();
+    }
+
+    // the back buffer belongs to exactly one front
+    DoubleBuffer(const DoubleBuffer&) = delete;
+    DoubleBuffer& operator=(const DoubleBuffer&) = delete;
+
+    GRID& front() { return _front; }
+    const GRID& front() const { return _front; }
+    GRID& back() { return _back; }
+    const GRID& back() const { return _back; }
+
+    /// Makes the back buffer the front buffer.
+    void swap() { _front.swap(_back); }
+
+    /// Copies the front into the back buffer, adapting its shape (e.g. after
+    /// the front was resized).
+    void resize()
+    {
+        _back = _front;
+    }
+
+private:
+    GRID& _front;
+    GRID _back;
+};
+
+#endif // DOUBLEBUFFER_H
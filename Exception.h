@@ -13,6 +13,7 @@
 #define EXCEPTION_H
 
 #include <exception>
+#include <string>
 
 class Exception : public std::exception
 {
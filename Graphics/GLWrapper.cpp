@@ -108,6 +108,8 @@ namespace GL
             case ShaderVariableType::mat2_t: return "mat2";
             case ShaderVariableType::mat3_t: return "mat3";
             case ShaderVariableType::mat4_t: return "mat4";
+            case ShaderVariableType::sampler2D_t: return "sampler2D";
+            case ShaderVariableType::usampler2D_t: return "usampler2D";
             default: return "unknown";
         }
     }
@@ -151,6 +153,22 @@ namespace GL
     template<>
     uint TypeInfo<glm::vec2>::TexFormat = GL_RG;
 
+    // PackedNormal, read as normalized shorts
+    template<>
+    GLuint TypeInfo<PackedNormal>::ElementType = GL_SHORT;
+    template<>
+    uint TypeInfo<PackedNormal>::ElementCount = 2;
+    template<>
+    uint TypeInfo<PackedNormal>::TexFormat = GL_RG;
+
+    // SurfaceTexel, read as two unsigned integers
+    template<>
+    GLuint TypeInfo<SurfaceTexel>::ElementType = GL_UNSIGNED_INT;
+    template<>
+    uint TypeInfo<SurfaceTexel>::ElementCount = 2;
+    template<>
+    uint TypeInfo<SurfaceTexel>::TexFormat = GL_RG_INTEGER;
+
     // float
     template<>
     GLuint TypeInfo<float>::ElementType = GL_FLOAT;
@@ -11,6 +11,8 @@
 #define GLWRAPPER_H
 
 #include "platform_includes.h"
+#include "PackedNormal.h"
+#include "SurfaceTexel.h"
 
 namespace Graphics
 {
@@ -80,6 +82,7 @@ namespace GL
 //			GL_FLOAT_MAT4x3	mat4x3
 //			GL_SAMPLER_1D	sampler1D
         sampler2D_t = GL_SAMPLER_2D,
+        usampler2D_t = GL_UNSIGNED_INT_SAMPLER_2D,
 //			GL_SAMPLER_3D	sampler3D
 //			GL_SAMPLER_CUBE	samplerCube
 //			GL_SAMPLER_1D_SHADOW	sampler1DShadow
@@ -105,7 +108,6 @@ namespace GL
 //			GL_INT_SAMPLER_BUFFER	isamplerBuffer
 //			GL_INT_SAMPLER_2D_RECT	isampler2DRect
 //			GL_UNSIGNED_INT_SAMPLER_1D	usampler1D
-//			GL_UNSIGNED_INT_SAMPLER_2D	usampler2D
 //			GL_UNSIGNED_INT_SAMPLER_3D	usampler3D
 //			GL_UNSIGNED_INT_SAMPLER_CUBE	usamplerCube
 //			GL_UNSIGNED_INT_SAMPLER_1D_ARRAY	usampler2DArray
@@ -251,10 +251,11 @@ bool Shader::SetUniform(const string &name, const TextureBase &tex)
     try
     {
         UniformInfo& info = _uniformInfo.at(name);
-        assert(info.Type == GL::ShaderVariableType::sampler2D_t);
+        assert(info.Type == GL::ShaderVariableType::sampler2D_t ||
+               info.Type == GL::ShaderVariableType::usampler2D_t);
         assert(info.Length == 1);
         assert(Shader::_currentlyBound == this);
-        glUniform1i(info.Location,tex.TextureUnit()+GL_TEXTURE0);
+        glUniform1i(info.Location,tex.TextureUnit());
         return true;
     }
     catch (out_of_range& oor)
@@ -14,6 +14,9 @@
 #include "GLWrapper.h"
 #include "Grid2D.h"
 
+#include <stdint.h>
+#include <vector>
+
 namespace Graphics
 {
 
@@ -36,10 +39,25 @@ template<typename T, TextureFormat FORMAT, uint BPC>
 class Texture2D : public TextureBase
 {
 public:
+    Texture2D();
+
     void SetData(const Grid2D<T>& data);
 
+    /// Uploads the rows y with rows[y] != 0, or all of them if the size of
+    /// data changed since the last upload. Allocates without filtering,
+    /// which integer textures require, for texelFetch().
+    void SetRows(const Grid2D<T>& data, const std::vector<uint8_t>& rows);
+
     void Map(uint textureUnit);
 
+protected:
+    /// The internal format for the components of T, their number is only
+    /// known at run time (GL::TypeInfo).
+    static GLuint InternalFormat();
+
+    uint _width;
+    uint _height;
+
 
 // some static asserts on template parameters;
 static_assert(BPC == 8 || BPC == 16 || BPC == 32,
@@ -66,6 +84,24 @@ inline TextureBase::~TextureBase()
     glDeleteTextures(1,&_id);
 }
 
+template<typename T, TextureFormat FORMAT, uint BPC>
+inline Texture2D<T,FORMAT,BPC>::Texture2D()
+    : _width(0),
+      _height(0)
+{}
+
+template<typename T, TextureFormat FORMAT, uint BPC>
+inline GLuint Texture2D<T,FORMAT,BPC>::InternalFormat()
+{
+    switch (GL::TypeInfo<T>::ElementCount)
+    {
+    case 1: return GL::InternalTextureFormat<FORMAT,BPC,1>();
+    case 2: return GL::InternalTextureFormat<FORMAT,BPC,2>();
+    case 3: return GL::InternalTextureFormat<FORMAT,BPC,3>();
+    default: return GL::InternalTextureFormat<FORMAT,BPC,4>();
+    }
+}
+
 template<typename T, TextureFormat FORMAT, uint BPC>
 inline void Texture2D<T,FORMAT,BPC>::Map(uint textureUnit)
 {
@@ -81,12 +117,14 @@ inline void Texture2D<T,FORMAT,BPC>::SetData(const Grid2D<T>& data)
     glBindTexture(GL_TEXTURE_2D, _id);
     glTexImage2D(GL_TEXTURE_2D,
                  0,
-                 GL::InternalTextureFormat<FORMAT,BPC,GL::TypeInfo<T>::ElementCount >(), // format used for storage
+                 InternalFormat(), // format used for storage
                  data.width(),data.height(),
                  0,
                  GL::TypeInfo<T>::TexFormat,
                  GL::TypeInfo<T>::ElementType,
                  data.ptr());
+    _width = data.width();
+    _height = data.height();
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
@@ -111,7 +149,50 @@ inline void Texture2D<T,FORMAT,BPC>::SetData(const Grid2D<T>& data)
 //        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
 //        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_BORDER);
 
-    glBindTexture(GL_TEXTURE_3D, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+template<typename T, TextureFormat FORMAT, uint BPC>
+inline void Texture2D<T,FORMAT,BPC>::SetRows(const Grid2D<T>& data, const std::vector<uint8_t>& rows)
+{
+    glBindTexture(GL_TEXTURE_2D, _id);
+    if (data.width() != _width || data.height() != _height)
+    {
+        glTexImage2D(GL_TEXTURE_2D,
+                     0,
+                     InternalFormat(),
+                     data.width(),data.height(),
+                     0,
+                     GL::TypeInfo<T>::TexFormat,
+                     GL::TypeInfo<T>::ElementType,
+                     data.ptr());
+        _width = data.width();
+        _height = data.height();
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return;
+    }
+
+    // one upload per run of consecutive rows
+    for (uint begin=0; begin<_height; )
+    {
+        if (!rows[begin]) { begin++; continue; }
+        uint end = begin+1;
+        while (end < _height && rows[end]) end++;
+        glTexSubImage2D(GL_TEXTURE_2D, 0,
+                        0, begin, _width, end-begin,
+                        GL::TypeInfo<T>::TexFormat,
+                        GL::TypeInfo<T>::ElementType,
+                        &data(begin,0));
+        begin = end;
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
 }
 
 
@@ -12,11 +12,31 @@
 
 #include "platform_includes.h"
 #include "Grid2D.h"
+#include "PaddedGrid2D.h"
 #include "GLWrapper.h"
 
+#include <stdint.h>
+#include <cstring>
+#include <vector>
+
+// persistently mapped buffers need ARB_buffer_storage (GL 4.4)
+#if defined(GLEW_ARB_buffer_storage)
+#define VERTEXBUFFER_PERSISTENT
+#endif
+
 namespace Graphics
 {
 
+/// Vertex attribute data in a buffer object.
+///
+/// SetData() replaces the whole buffer, for data that rarely changes.
+/// Data that changes every frame is streamed with SetRows(), which only
+/// uploads the rows of a grid that changed. With ARB_buffer_storage the rows
+/// are written to a persistently mapped staging ring, one grid in size, and
+/// copied into the buffer by the GPU (glCopyBufferSubData), so neither side
+/// waits for the other; a fence per upload keeps the CPU from overwriting
+/// staging memory the GPU did not copy yet. Without the extension the rows
+/// are written with glBufferSubData.
 template<typename T>
 class VertexBuffer
 {
@@ -27,9 +47,39 @@ public:
     void MapData(uint location, bool normalized = false);
     void Bind();
     void SetData(const Grid2D<T>& grid);
+    void SetData(const PaddedGrid2D<T>& grid);
+
+    /// Uploads the rows y of grid with rows[y] != 0. Uploads all rows the
+    /// first time and whenever the size of the grid changed.
+    void SetRows(const Grid2D<T>& grid, const std::vector<uint8_t>& rows);
+
+    /// True if SetRows() goes through the persistently mapped staging ring.
+    bool Persistent() const { return _mapped != 0; }
 
 protected:
+    /// Staging rows [begin,end) of one upload, free once fence signals.
+    struct Upload
+    {
+        GLsync fence;
+        uint begin;
+        uint end;
+    };
+
+    void allocateRows(uint width, uint height);
+    void releaseRows();
+    void copyRows(const Grid2D<T>& grid, const std::vector<uint8_t>& rows);
+    void stageRows(const Grid2D<T>& grid, const std::vector<uint8_t>& rows);
+
     GLuint _id;
+
+    // streaming state of SetRows()
+    uint _width;
+    uint _height;
+    bool _complete;                 /// all rows were uploaded since the allocation
+    GLuint _staging;
+    T* _mapped;                     /// the staging ring, 0 without persistent mapping
+    uint _head;                     /// next free row of the ring
+    std::vector<Upload> _uploads;   /// uploads the GPU may still read from the ring
 };
 
 // Implementation
@@ -37,6 +87,12 @@ protected:
 
 template<typename T>
 inline VertexBuffer<T>::VertexBuffer()
+    : _width(0),
+      _height(0),
+      _complete(false),
+      _staging(0),
+      _mapped(0),
+      _head(0)
 {
     glGenBuffers(1,&_id);
 }
@@ -44,6 +100,7 @@ inline VertexBuffer<T>::VertexBuffer()
 template<typename T>
 inline VertexBuffer<T>::~VertexBuffer()
 {
+    releaseRows();
     glDeleteBuffers(1,&_id);
 }
 
@@ -64,11 +121,152 @@ inline void VertexBuffer<T>::Bind()
 template<typename T>
 inline void VertexBuffer<T>::SetData(const Grid2D<T> &grid)
 {
+    releaseRows();
     glBindBuffer(GL_ARRAY_BUFFER,_id);
     uint bytesize = sizeof(T)*grid.size();
     glBufferData(GL_ARRAY_BUFFER, bytesize, grid.ptr(),GL_STATIC_DRAW);
 }
 
+template<typename T>
+inline void VertexBuffer<T>::SetData(const PaddedGrid2D<T> &grid)
+{
+    releaseRows();
+    glBindBuffer(GL_ARRAY_BUFFER,_id);
+    uint bytesize = sizeof(T)*grid.size();
+    glBufferData(GL_ARRAY_BUFFER, bytesize, 0,GL_STATIC_DRAW);
+
+    // upload the interior row by row, skipping the halo
+    uint rowsize = sizeof(T)*grid.width();
+    for (uint y=0; y<grid.height(); y++)
+    {
+        glBufferSubData(GL_ARRAY_BUFFER, y*rowsize, rowsize, grid.row(y));
+    }
+}
+
+template<typename T>
+inline void VertexBuffer<T>::SetRows(const Grid2D<T>& grid, const std::vector<uint8_t>& rows)
+{
+    if (grid.width() != _width || grid.height() != _height)
+        allocateRows(grid.width(),grid.height());
+
+    const std::vector<uint8_t> all(_complete ? 0 : _height,1);
+    const std::vector<uint8_t>& upload = _complete ? rows : all;
+    _complete = true;
+
+    if (_mapped)
+        stageRows(grid,upload);
+    else
+        copyRows(grid,upload);
+}
+
+template<typename T>
+inline void VertexBuffer<T>::copyRows(const Grid2D<T>& grid, const std::vector<uint8_t>& rows)
+{
+    // consecutive rows in one call
+    const size_t rowBytes = sizeof(T)*_width;
+    glBindBuffer(GL_ARRAY_BUFFER,_id);
+    for (uint y=0; y<_height; )
+    {
+        if (!rows[y]) { y++; continue; }
+        uint y0 = y;
+        while (y < _height && rows[y]) y++;
+        glBufferSubData(GL_ARRAY_BUFFER, y0*rowBytes, (y-y0)*rowBytes, &grid(y0,0));
+    }
+}
+
+template<typename T>
+inline void VertexBuffer<T>::stageRows(const Grid2D<T>& grid, const std::vector<uint8_t>& rows)
+{
+#if defined(VERTEXBUFFER_PERSISTENT)
+    uint count = 0;
+    for (uint y=0; y<_height; y++)
+        count += rows[y] != 0;
+    if (count == 0)
+        return;
+
+    // contiguous staging rows, wait until the GPU copied the uploads there
+    // and forget the completed ones
+    if (_head+count > _height)
+        _head = 0;
+    const uint begin = _head;
+    const uint end = _head+count;
+    for (size_t i=0; i<_uploads.size(); )
+    {
+        Upload& u = _uploads[i];
+        const bool overlaps = u.begin < end && begin < u.end;
+        GLenum status = glClientWaitSync(u.fence, overlaps ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, 0);
+        while (overlaps && status == GL_TIMEOUT_EXPIRED)
+            status = glClientWaitSync(u.fence, 0, 1000000000);
+        if (status == GL_TIMEOUT_EXPIRED) { i++; continue; }
+        glDeleteSync(u.fence);
+        _uploads.erase(_uploads.begin()+i);
+    }
+
+    // consecutive rows in one copy
+    const size_t rowBytes = sizeof(T)*_width;
+    glBindBuffer(GL_COPY_READ_BUFFER,_staging);
+    glBindBuffer(GL_COPY_WRITE_BUFFER,_id);
+    for (uint y=0; y<_height; )
+    {
+        if (!rows[y]) { y++; continue; }
+        uint y0 = y;
+        while (y < _height && rows[y]) y++;
+        std::memcpy(_mapped+size_t(_head)*_width, &grid(y0,0), (y-y0)*rowBytes);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, _head*rowBytes, y0*rowBytes, (y-y0)*rowBytes);
+        _head += y-y0;
+    }
+
+    Upload u = { glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE,0), begin, end };
+    _uploads.push_back(u);
+#else
+    (void)grid;
+    (void)rows;
+#endif
+}
+
+template<typename T>
+inline void VertexBuffer<T>::allocateRows(uint width, uint height)
+{
+    releaseRows();
+    _width = width;
+    _height = height;
+    _complete = false;
+
+    const size_t bytes = sizeof(T)*size_t(width)*height;
+    glBindBuffer(GL_ARRAY_BUFFER,_id);
+    glBufferData(GL_ARRAY_BUFFER, bytes, 0, GL_DYNAMIC_DRAW);
+
+#if defined(VERTEXBUFFER_PERSISTENT)
+    if (GLEW_ARB_buffer_storage)
+    {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glGenBuffers(1,&_staging);
+        glBindBuffer(GL_COPY_READ_BUFFER,_staging);
+        glBufferStorage(GL_COPY_READ_BUFFER, bytes, 0, flags);
+        _mapped = static_cast<T*>(glMapBufferRange(GL_COPY_READ_BUFFER, 0, bytes, flags));
+    }
+#endif
+}
+
+template<typename T>
+inline void VertexBuffer<T>::releaseRows()
+{
+#if defined(VERTEXBUFFER_PERSISTENT)
+    for (const Upload& u : _uploads)
+        glDeleteSync(u.fence);
+    _uploads.clear();
+    if (_staging)
+    {
+        // deleting the buffer unmaps it
+        glDeleteBuffers(1,&_staging);
+        _staging = 0;
+    }
+#endif
+    _mapped = 0;
+    _head = 0;
+    _width = _height = 0;
+}
+
 // Instances
 ///////////////////////////////////////////////
 
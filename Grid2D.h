@@ -13,67 +13,176 @@
 #define GRID2D_H
 
 #include "platform_includes.h"
+#include "GridAllocator.h"
+#include "GridLayout.h"
 #include <vector>
-
-template<typename T>
+#include <utility>
+#include <algorithm>
+
+/// 2D grid of w*h elements.
+///
+/// LAYOUT maps cells to storage (see GridLayout.h). The default row-major
+/// layout is what the kernels, the renderer and file I/O work with; tiled
+/// and Z-order layouts keep 2D neighbourhoods close in memory. Grids of
+/// different layouts are converted with copyFrom(), forEach() and
+/// forEachTile() walk a grid in storage order.
+///
+/// The storage comes from GridAllocator: it is 64 byte aligned, large grids
+/// use huge pages, and it is first touched in parallel in as many chunks as
+/// the grid has rows, the same static partition as the kernels (see
+/// GridMemory).
+template<typename T, typename LAYOUT=RowMajorLayout>
 class Grid2D
 {
 protected:
+    typedef std::vector<T,GridAllocator<T> > Data;
+
     uint _width;
     uint _height;
     uint _size;
-    std::vector<T> _data;
+    LAYOUT _layout;
+    Data _data;
 
 public:
+    typedef LAYOUT Layout;
+
     Grid2D(uint w=0, uint h=0)
-        : _width(w), _height(h), _size(w*h), _data(_size)
-    {}
+        : _width(0), _height(0), _size(0)
+    {
+        resize(w,h);
+    }
+
+    Grid2D(const Grid2D& other)
+        : _width(other._width), _height(other._height), _size(other._size),
+          _layout(other._layout), _data(other._data.size())
+    {
+        copyStorage(other);
+    }
+
+    Grid2D(Grid2D&&) = default;
+    Grid2D& operator=(Grid2D&&) = default;
+
+    Grid2D& operator=(const Grid2D& other)
+    {
+        if (this != &other)
+        {
+            if (_data.size() != other._data.size())
+                Data(other._data.size()).swap(_data);
+            _width = other._width;
+            _height = other._height;
+            _size = other._size;
+            _layout = other._layout;
+            copyStorage(other);
+        }
+        return *this;
+    }
 
     uint width() const { return _width; }
     uint height() const { return _height;}
     uint size() const { return _size; }
 
+    /// Number of stored elements, larger than size() if the layout pads.
+    size_t storageSize() const { return _data.size(); }
+    const LAYOUT& layout() const { return _layout; }
+
+    /// Changes the shape. The contents are kept if the storage size is
+    /// unchanged, otherwise the grid is reallocated and cleared.
     void resize(uint w, uint h)
     {
         _width = w;
         _height = h;
         _size = w*h;
-        _data.resize(w*h);
+        _layout.resize(w,h);
+        if (_layout.storage() != _data.size())
+        {
+            Data(_layout.storage()).swap(_data);
+            fill(T());
+        }
+    }
+
+    /// Takes the storage for a w x h grid from memory, mappedBytes of a
+    /// private file mapping, without copying (see GridMemory::Adoption). The
+    /// grid unmaps it when it releases the storage.
+    void adopt(uint w, uint h, T* memory, size_t mappedBytes)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "Grids of non-trivial elements cannot adopt memory.");
+        _width = w;
+        _height = h;
+        _size = w*h;
+        _layout.resize(w,h);
+        GridMemory::Adoption adoption(memory,_layout.storage()*sizeof(T),mappedBytes);
+        Data(_layout.storage()).swap(_data);
     }
 
-    T& operator ()(uint y, uint x);
-    const T& operator ()(uint y, uint x) const;
+    /// Sets all elements in parallel.
+    void fill(const T& value)
+    {
+        if (_data.empty()) return;
+        T* data = &_data[0];
+        const size_t n = _data.size();
+        const size_t chunk = (n+_height-1)/_height;
+        GridMemory::ParallelRows(_height,[=](int i) {
+            std::fill(data+std::min(i*chunk,n),data+std::min((i+1)*chunk,n),value);
+        });
+    }
 
-    T& operator ()(uint i);
-    const T& operator ()(uint i) const;
+    /// Sets the cells from a grid of the same size in any layout.
+    template<typename OTHER>
+    void copyFrom(const Grid2D<T,OTHER>& other)
+    {
+        resize(other.width(),other.height());
+        forEach([&](uint y, uint x, T& value) { value = other(y,x); });
+    }
 
-    T* ptr() { return &_data[0]; }
-    const T* ptr() const { return &_data[0]; }
-};
+    /// Calls fn(y,x,value) for all cells, tile by tile in storage order.
+    template<typename FN>
+    void forEach(const FN& fn)
+    {
+        _layout.forEachTile([&](uint x0, uint y0, uint x1, uint y1) {
+            for (uint y=y0; y<y1; y++)
+                for (uint x=x0; x<x1; x++)
+                    fn(y,x,(*this)(y,x));
+        });
+    }
 
-template<typename T>
-T &Grid2D<T>::operator ()(uint y, uint x)
-{
-    return _data[y*_width+x];
-}
+    /// Calls fn(x0,y0,x1,y1) for the blocks of cells that are contiguous in
+    /// storage, in storage order (rows for the row-major layout).
+    template<typename FN>
+    void forEachTile(const FN& fn) const { _layout.forEachTile(fn); }
 
-template<typename T>
-const T& Grid2D<T>::operator ()(uint y, uint x) const
-{
-    return _data[y*_width+x];
-}
+    T& operator ()(uint y, uint x) { return _data[_layout.index(y,x)]; }
+    const T& operator ()(uint y, uint x) const { return _data[_layout.index(y,x)]; }
 
-template<typename T>
-T &Grid2D<T>::operator ()(uint i)
-{
-    return _data[i];
-}
+    /// Element i of the storage (cell i in row-major order for the default layout).
+    T& operator ()(uint i) { return _data[i]; }
+    const T& operator ()(uint i) const { return _data[i]; }
 
-template<typename T>
-const T& Grid2D<T>::operator ()(uint i) const
-{
-    return _data[i];
-}
+    T* ptr() { return &_data[0]; }
+    const T* ptr() const { return &_data[0]; }
+
+    /// Exchanges the contents with other in O(1), see DoubleBuffer.
+    void swap(Grid2D& other)
+    {
+        std::swap(_width,other._width);
+        std::swap(_height,other._height);
+        std::swap(_size,other._size);
+        std::swap(_layout,other._layout);
+        _data.swap(other._data);
+    }
+
+protected:
+    void copyStorage(const Grid2D& other)
+    {
+        if (_data.empty()) return;
+        T* data = &_data[0];
+        const T* src = &other._data[0];
+        const size_t n = _data.size();
+        const size_t chunk = (n+_height-1)/_height;
+        GridMemory::ParallelRows(_height,[=](int i) {
+            std::copy(src+std::min(i*chunk,n),src+std::min((i+1)*chunk,n),data+std::min(i*chunk,n));
+        });
+    }
+};
 
 
 class Grid2DHelper
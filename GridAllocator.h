@@ -0,0 +1,296 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#ifndef GRIDALLOCATOR_H
+#define GRIDALLOCATOR_H
+
+#include "platform_includes.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <cstddef>
+#include <cstring>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#if defined(__linux__) || defined(__APPLE__) || defined(__MACH__)
+#include <sys/mman.h>
+#endif
+
+#include "Simulation/Parallel.h"
+
+/// Memory layout and placement of the grids.
+///
+/// Grids are 64 byte aligned. Grids of at least HugePageSize bytes are mapped
+/// separately and backed by huge pages if enabled. Their pages are not touched
+/// when they are allocated: the grids initialize them in parallel with the
+/// static row partition of the kernels, so on NUMA machines every page ends
+/// up on the node of the thread that processes it (first touch).
+///
+/// A grid can also adopt a private file mapping as its storage (Adoption),
+/// which restores a checkpoint without copying: the pages are read when they
+/// are first touched and copied when they are first written.
+namespace GridMemory {
+
+enum class HugePages : uint
+{
+    Off,            /// regular pages
+    Transparent,    /// transparent huge pages (madvise), the default
+    Explicit        /// reserved huge pages (MAP_HUGETLB), transparent if none are reserved
+};
+
+static const size_t CacheLine = 64;
+static const size_t HugePageSize = size_t(2) << 20;
+
+/// Large grids start at a different multiple of the cache line within their
+/// huge page ("colour"), otherwise all grids would map to the same cache sets
+/// and a kernel streaming many grids would evict its own lines.
+static const size_t Colours = 64;
+
+inline size_t RoundUp(size_t value, size_t multiple)
+{
+    return (value+multiple-1)/multiple*multiple;
+}
+
+/// Parses "off", "thp" or "explicit", returns false otherwise.
+inline bool ParseHugePages(const std::string& name, HugePages& pages)
+{
+    if (name == "off") pages = HugePages::Off;
+    else if (name == "thp") pages = HugePages::Transparent;
+    else if (name == "explicit") pages = HugePages::Explicit;
+    else return false;
+    return true;
+}
+
+/// Huge page backing of grids allocated from now on. Starts with the
+/// TERRAIN_HUGEPAGES environment variable if set, Transparent otherwise.
+inline HugePages& hugePages()
+{
+    static HugePages pages = []() {
+        HugePages p = HugePages::Transparent;
+        const char* env = getenv("TERRAIN_HUGEPAGES");
+        if (env && *env && !ParseHugePages(env,p))
+            std::cerr << "TERRAIN_HUGEPAGES ignored: unknown value '" << env << "'.\n";
+        return p;
+    }();
+    return pages;
+}
+
+/// Pads the rows of PaddedGrid2D so every row starts on a cache line
+/// (default). Applies to grids allocated from now on.
+inline bool& padRows()
+{
+    static bool pad = true;
+    return pad;
+}
+
+inline size_t NextColour()
+{
+    static std::atomic<size_t> next(0);
+    return (next++ % Colours)*CacheLine;
+}
+
+/// Adopted file mappings by address, with their mapped length.
+inline std::mutex& AdoptedMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+inline std::map<void*,size_t>& AdoptedRegions()
+{
+    static std::map<void*,size_t> regions;
+    return regions;
+}
+
+/// Number of entries in AdoptedRegions(), Free() skips the lookup if zero.
+inline std::atomic<size_t>& AdoptedCount()
+{
+    static std::atomic<size_t> count(0);
+    return count;
+}
+
+/// Memory the next Allocate() on this thread returns, see Adoption.
+struct PendingAdoption
+{
+    void* memory;
+    size_t bytes;
+    size_t mappedBytes;
+    bool taken;
+};
+
+inline PendingAdoption*& Pending()
+{
+    static thread_local PendingAdoption* pending = 0;
+    return pending;
+}
+
+/// Lets the next Allocate() of exactly bytes on the calling thread return
+/// memory, mappedBytes of a MAP_PRIVATE mmap(), instead of new memory. Free()
+/// unmaps it later. The allocator does not construct trivially destructible
+/// elements, so a grid created in the scope keeps the mapped contents (see
+/// Grid2D::adopt()). Unmaps the memory if no allocation took it.
+class Adoption
+{
+public:
+    Adoption(void* memory, size_t bytes, size_t mappedBytes)
+    {
+        _pending.memory = memory;
+        _pending.bytes = bytes;
+        _pending.mappedBytes = mappedBytes;
+        _pending.taken = false;
+        Pending() = &_pending;
+    }
+
+    ~Adoption()
+    {
+        Pending() = 0;
+#if defined(__linux__) || defined(__APPLE__) || defined(__MACH__)
+        if (!_pending.taken)
+            munmap(_pending.memory,_pending.mappedBytes);
+#endif
+    }
+
+    Adoption(const Adoption&) = delete;
+    Adoption& operator=(const Adoption&) = delete;
+
+private:
+    PendingAdoption _pending;
+};
+
+inline void* Allocate(size_t bytes)
+{
+    PendingAdoption* pending = Pending();
+    if (pending && !pending->taken && pending->bytes == bytes)
+    {
+        std::lock_guard<std::mutex> lock(AdoptedMutex());
+        AdoptedRegions()[pending->memory] = pending->mappedBytes;
+        AdoptedCount()++;
+        pending->taken = true;
+        return pending->memory;
+    }
+
+#if defined(__linux__)
+    if (bytes >= HugePageSize)
+    {
+        size_t colour = NextColour();
+        size_t size = RoundUp(bytes+Colours*CacheLine,HugePageSize);
+#if defined(MAP_HUGETLB)
+        if (hugePages() == HugePages::Explicit)
+        {
+            void* p = mmap(0,size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0);
+            if (p != MAP_FAILED)
+                return static_cast<char*>(p)+colour;
+        }
+#endif
+        // over-allocate by a huge page and trim to a huge page boundary
+        char* raw = static_cast<char*>(mmap(0,size+HugePageSize,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0));
+        if (raw == MAP_FAILED)
+            throw std::bad_alloc();
+        char* p = reinterpret_cast<char*>(RoundUp(reinterpret_cast<uintptr_t>(raw),HugePageSize));
+        if (p != raw)
+            munmap(raw,p-raw);
+        munmap(p+size,HugePageSize-(p-raw));
+
+        madvise(p,size,hugePages() == HugePages::Off ? MADV_NOHUGEPAGE : MADV_HUGEPAGE);
+        return p+colour;
+    }
+#endif
+    void* p = 0;
+    if (posix_memalign(&p,CacheLine,bytes == 0 ? CacheLine : bytes) != 0)
+        throw std::bad_alloc();
+    return p;
+}
+
+/// Releases memory of Allocate(bytes), the size selects how it was allocated.
+inline void Free(void* p, size_t bytes)
+{
+    if (!p) return;
+#if defined(__linux__) || defined(__APPLE__) || defined(__MACH__)
+    if (AdoptedCount() > 0)
+    {
+        std::lock_guard<std::mutex> lock(AdoptedMutex());
+        std::map<void*,size_t>::iterator region = AdoptedRegions().find(p);
+        if (region != AdoptedRegions().end())
+        {
+            munmap(p,region->second);
+            AdoptedRegions().erase(region);
+            AdoptedCount()--;
+            return;
+        }
+    }
+#endif
+#if defined(__linux__)
+    if (bytes >= HugePageSize)
+    {
+        // the mapping starts at the huge page boundary below the colour offset
+        uintptr_t base = reinterpret_cast<uintptr_t>(p)/HugePageSize*HugePageSize;
+        munmap(reinterpret_cast<void*>(base),RoundUp(bytes+Colours*CacheLine,HugePageSize));
+        return;
+    }
+#endif
+    free(p);
+}
+
+/// Calls fn(i) for i in [0,n) with the static partition of the kernels'
+/// row loops (one contiguous block of rows per thread).
+template<typename FN>
+inline void ParallelRows(int n, const FN& fn)
+{
+    Simulation::Parallel::For(n,Simulation::Schedule::Static,0,[&fn](int begin, int end)
+    {
+        for (int i=begin; i<end; ++i)
+            fn(i);
+    });
+}
+
+} // namespace GridMemory
+
+/// std::vector allocator of the grids, see GridMemory. Default constructed
+/// elements of trivial types are left uninitialized, so the pages are first
+/// touched by the parallel initialization of the grid.
+template<typename T>
+class GridAllocator
+{
+public:
+    typedef T value_type;
+
+    GridAllocator() {}
+    template<typename U> GridAllocator(const GridAllocator<U>&) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(GridMemory::Allocate(n*sizeof(T))); }
+    void deallocate(T* p, size_t n) { GridMemory::Free(p,n*sizeof(T)); }
+
+    template<typename U>
+    void construct(U* p)
+    {
+        if (!std::is_trivially_destructible<U>::value)
+            ::new(static_cast<void*>(p)) U();
+    }
+
+    template<typename U, typename... ARGS>
+    void construct(U* p, ARGS&&... args)
+    {
+        ::new(static_cast<void*>(p)) U(std::forward<ARGS>(args)...);
+    }
+
+    template<typename U> struct rebind { typedef GridAllocator<U> other; };
+
+    bool operator==(const GridAllocator&) const { return true; }
+    bool operator!=(const GridAllocator&) const { return false; }
+};
+
+#endif // GRIDALLOCATOR_H
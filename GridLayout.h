@@ -0,0 +1,166 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#ifndef GRIDLAYOUT_H
+#define GRIDLAYOUT_H
+
+#include "platform_includes.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+
+/// Storage layouts of Grid2D.
+///
+/// A layout maps cell (y,x) of a width x height grid to an index into the
+/// storage and knows how many elements the storage needs. forEachTile()
+/// visits rectangles of cells that are contiguous in storage, in storage
+/// order, as fn(x0,y0,x1,y1) with exclusive upper bounds, so code that
+/// walks a grid tile by tile streams through its memory. Tested in
+/// Tests/GridLayoutTests.cpp.
+
+/// Rows one after another (the layout the renderer and the kernels expect).
+class RowMajorLayout
+{
+public:
+    RowMajorLayout() : _width(0), _height(0) {}
+
+    void resize(uint w, uint h) { _width = w; _height = h; }
+    size_t storage() const { return size_t(_width)*_height; }
+    size_t index(uint y, uint x) const { return size_t(y)*_width + x; }
+
+    template<typename FN>
+    void forEachTile(const FN& fn) const
+    {
+        for (uint y=0; y<_height; y++)
+            fn(0u,y,_width,y+1);
+    }
+
+protected:
+    uint _width;
+    uint _height;
+};
+
+/// Square blocks of B x B cells, row-major within a block and the blocks in
+/// row-major order. The storage is padded to whole blocks.
+template<uint B=32>
+class TiledLayout
+{
+public:
+    static const uint TileSize = B;
+
+    TiledLayout() : _width(0), _height(0), _tilesX(0), _tilesY(0) {}
+
+    void resize(uint w, uint h)
+    {
+        _width = w;
+        _height = h;
+        _tilesX = (w+B-1)/B;
+        _tilesY = (h+B-1)/B;
+    }
+
+    size_t storage() const { return size_t(_tilesX)*_tilesY*B*B; }
+
+    size_t index(uint y, uint x) const
+    {
+        return (size_t(y/B)*_tilesX + x/B)*(B*B) + (y%B)*B + x%B;
+    }
+
+    template<typename FN>
+    void forEachTile(const FN& fn) const
+    {
+        for (uint ty=0; ty<_tilesY; ty++)
+            for (uint tx=0; tx<_tilesX; tx++)
+                fn(tx*B,ty*B,std::min((tx+1)*B,_width),std::min((ty+1)*B,_height));
+    }
+
+protected:
+    uint _width;
+    uint _height;
+    uint _tilesX;
+    uint _tilesY;
+};
+
+/// Z-order (Morton) curve: the bits of x and y are interleaved, so every
+/// aligned 2^k x 2^k square is contiguous. The storage covers the enclosing
+/// power of two square, which wastes memory on grids far from square.
+class MortonLayout
+{
+public:
+    /// Cells of the contiguous squares forEachTile() visits.
+    static const uint TileSize = 8;
+
+    MortonLayout() : _width(0), _height(0), _side(0) {}
+
+    void resize(uint w, uint h)
+    {
+        _width = w;
+        _height = h;
+        _side = 1;
+        while (_side < w || _side < h)
+            _side *= 2;
+        if (w == 0 || h == 0)
+            _side = 0;
+    }
+
+    size_t storage() const { return size_t(_side)*_side; }
+
+    size_t index(uint y, uint x) const
+    {
+        return Spread(x) | (Spread(y) << 1);
+    }
+
+    template<typename FN>
+    void forEachTile(const FN& fn) const
+    {
+        // the tiles are themselves in Z-order
+        uint tiles = (_side+TileSize-1)/TileSize;
+        size_t count = size_t(tiles)*tiles;
+        for (size_t i=0; i<count; i++)
+        {
+            uint x0 = Compact(i)*TileSize;
+            uint y0 = Compact(i >> 1)*TileSize;
+            if (x0 < _width && y0 < _height)
+                fn(x0,y0,std::min(x0+TileSize,_width),std::min(y0+TileSize,_height));
+        }
+    }
+
+    /// Inserts a zero bit above every bit of v (bit i moves to bit 2i).
+    static size_t Spread(uint v)
+    {
+        uint64_t x = v;
+        x = (x | (x << 16)) & 0x0000FFFF0000FFFFull;
+        x = (x | (x << 8))  & 0x00FF00FF00FF00FFull;
+        x = (x | (x << 4))  & 0x0F0F0F0F0F0F0F0Full;
+        x = (x | (x << 2))  & 0x3333333333333333ull;
+        x = (x | (x << 1))  & 0x5555555555555555ull;
+        return size_t(x);
+    }
+
+    /// Inverse of Spread(), gathers the even bits of v.
+    static uint Compact(size_t v)
+    {
+        uint64_t x = uint64_t(v) & 0x5555555555555555ull;
+        x = (x | (x >> 1))  & 0x3333333333333333ull;
+        x = (x | (x >> 2))  & 0x0F0F0F0F0F0F0F0Full;
+        x = (x | (x >> 4))  & 0x00FF00FF00FF00FFull;
+        x = (x | (x >> 8))  & 0x0000FFFF0000FFFFull;
+        x = (x | (x >> 16)) & 0x00000000FFFFFFFFull;
+        return uint(x);
+    }
+
+protected:
+    uint _width;
+    uint _height;
+    uint _side;
+};
+
+#endif // GRIDLAYOUT_H
@@ -0,0 +1,103 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#ifndef HALF_H
+#define HALF_H
+
+#include <stdint.h>
+#include <cstring>
+
+/// IEEE 754 binary16 storage type for grids that do not need full precision.
+///
+/// Only stores values: they convert to float for arithmetic and back with
+/// round to nearest even, the same rounding as F16C (vcvtps2ph), so scalar
+/// and vectorized kernels produce identical grids. 11 significant bits
+/// (relative error below 4.9e-4), normal values from 6.1e-5 to 65504;
+/// smaller magnitudes lose precision gradually, larger ones become infinite.
+///
+/// Default construction leaves the value uninitialized like a float (see
+/// GridAllocator), Half() is zero.
+class Half
+{
+public:
+    Half() = default;
+    Half(float value) : bits(FromFloat(value)) {}
+
+    operator float() const { return ToFloat(bits); }
+
+    uint16_t bits;
+
+    static uint16_t FromFloat(float value)
+    {
+        uint32_t f;
+        memcpy(&f,&value,4);
+        const uint32_t sign = f & 0x80000000u;
+        f ^= sign;
+
+        uint16_t h;
+        if (f >= (127u+16) << 23)
+        {
+            // overflow to infinity, NaN stays (quiet) NaN
+            h = f > 255u << 23 ? 0x7e00 : 0x7c00;
+        }
+        else if (f < (127u-14) << 23)
+        {
+            // subnormal or zero: adding 0.5 aligns the mantissa so the float
+            // adder rounds it to the 10 bits of the result
+            const uint32_t magicBits = (127u-15+23-10+1) << 23;
+            float v, magic;
+            memcpy(&v,&f,4);
+            memcpy(&magic,&magicBits,4);
+            v += magic;
+            memcpy(&f,&v,4);
+            h = uint16_t(f - magicBits);
+        }
+        else
+        {
+            // rebias the exponent and round the mantissa to nearest even
+            const uint32_t odd = (f >> 13) & 1;
+            f += (uint32_t(15-127) << 23) + 0xfff + odd;
+            h = uint16_t(f >> 13);
+        }
+        return h | uint16_t(sign >> 16);
+    }
+
+    static float ToFloat(uint16_t h)
+    {
+        const uint32_t exponentMask = 0x7c00u << 13;
+        uint32_t f = (h & 0x7fffu) << 13;
+        const uint32_t exponent = f & exponentMask;
+        f += (127u-15) << 23;
+
+        float value;
+        if (exponent == exponentMask)
+        {
+            // infinity or NaN
+            f += (128u-16) << 23;
+        }
+        else if (exponent == 0)
+        {
+            // subnormal or zero, renormalized by the float subtraction
+            const uint32_t magicBits = (127u-14) << 23;
+            float magic;
+            memcpy(&magic,&magicBits,4);
+            f += 1u << 23;
+            memcpy(&value,&f,4);
+            value -= magic;
+            memcpy(&f,&value,4);
+        }
+        f |= uint32_t(h & 0x8000u) << 16;
+        memcpy(&value,&f,4);
+        return value;
+    }
+};
+
+#endif // HALF_H
@@ -0,0 +1,19 @@
+# Command line batch runner, runs the simulation without a window or GL context.
+
+TEMPLATE = app
+CONFIG += console
+CONFIG -= qt
+CONFIG -= app_bundle
+TARGET = TerrainFluidHeadless
+
+DEFINES += HEADLESS_BUILD
+QMAKE_CXXFLAGS += -std=c++11
+
+include(../Simulation/Simulation.pri)
+
+SOURCES += main.cpp
+
+mac {
+    INCLUDEPATH += /usr/local/include
+    QMAKE_CXXFLAGS += -stdlib=libc++
+}
@@ -0,0 +1,424 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#include <iostream>
+#include <fstream>
+#include <stdlib.h>
+#include <memory>
+#include <cmath>
+
+#include "tclap/CmdLine.h"
+#include "platform_includes.h"
+
+#include "GridAllocator.h"
+#include "SimulationState.h"
+#include "Simulation/FluidSimulation.h"
+#include "Simulation/BatchRunner.h"
+#include "Simulation/Checkpoint.h"
+#include "Exception.h"
+
+using namespace std;
+
+int main(int argc, char** argv)
+{
+    // Settings ////////////////////////////////////////////////////////////
+    ////////////////////////////////////////////////////////////////////////
+
+    uint terrainDim = 300;
+    ulong steps = 1000;
+    double dt = 1000.0/60;
+    std::string terrainType = "perlin";
+    std::string rainSchedule;
+    std::string floodSchedule;
+    float floodX = -1, floodY = -1;
+    ulong reportInterval = 0;
+    std::string profileJson;
+    std::string profileCsv;
+    std::string kernels;
+    bool fused = false;
+    bool sparse = false;
+    bool staggered = false;
+    bool halfPrecision = false;
+    bool errorReport = false;
+    bool adaptive = false;
+    double courant = 0.9;
+    uint blockSteps = 0;
+    uint tileSize = 256;
+    float maxDisplacement = 2.0f;
+    std::string hugePages;
+    bool padRows = true;
+    std::string parallel;
+    uint threads = 0;
+    std::string schedule;
+    uint grain = 0;
+    bool pin = false;
+    std::string checkpointPath;
+    ulong checkpointInterval = 0;
+    std::string restorePath;
+
+    // Read Command Line Arguments /////////////////////////////////////////
+    ////////////////////////////////////////////////////////////////////////
+    try
+    {
+        TCLAP::CmdLine cmd("Terrain Erosion & Fluid Simulation (headless batch mode).", ' ', "0.9");
+        TCLAP::ValueArg<uint> dimArg("d","dim","Size of the terrain. Default: 300.",false,300,"uint");
+        TCLAP::ValueArg<ulong> stepsArg("n","steps","Number of simulation steps. Default: 1000.",false,1000,"ulong");
+        TCLAP::ValueArg<double> dtArg("t","dt","Timestep in milliseconds. Default: 16.67.",false,1000.0/60,"double");
+        TCLAP::ValueArg<std::string> terrainArg("","terrain","Initial terrain: perlin or steep. Default: perlin.",false,"perlin","string");
+        TCLAP::ValueArg<std::string> rainArg("r","rain","Steps with rain, e.g. \"0:500,1000:\". Default: none.",false,"","intervals");
+        TCLAP::ValueArg<std::string> floodArg("f","flood","Steps with flooding, e.g. \"0:500\". Default: none.",false,"","intervals");
+        TCLAP::ValueArg<float> floodXArg("x","flood-x","Flood source x coordinate. Default: center.",false,-1,"float");
+        TCLAP::ValueArg<float> floodYArg("y","flood-y","Flood source y coordinate. Default: center.",false,-1,"float");
+        TCLAP::ValueArg<ulong> reportArg("p","progress","Report throughput every n steps. Default: off.",false,0,"ulong");
+        TCLAP::ValueArg<std::string> jsonArg("","profile-json","Write per-stage timing statistics as JSON to this file.",false,"","file");
+        TCLAP::ValueArg<std::string> kernelArg("k","kernels","Most recent instruction set the kernels may use: scalar, sse4, avx2 or avx512. Default: best supported.",false,"","string");
+        TCLAP::ValueArg<std::string> csvArg("","profile-csv","Write per-stage timing statistics as CSV to this file.",false,"","file");
+        cmd.add(dimArg);
+        cmd.add(stepsArg);
+        cmd.add(dtArg);
+        cmd.add(terrainArg);
+        cmd.add(rainArg);
+        cmd.add(floodArg);
+        cmd.add(floodXArg);
+        cmd.add(floodYArg);
+        cmd.add(reportArg);
+        cmd.add(jsonArg);
+        cmd.add(csvArg);
+        TCLAP::SwitchArg fusedArg("","fused","Run flow, erosion and evaporation as one sweep over the grid.",false);
+        TCLAP::SwitchArg sparseArg("","sparse","Skip dry 32x32 tiles in flow, erosion, transport and evaporation.",false);
+        TCLAP::SwitchArg staggeredArg("","staggered","Store one signed flux per cell edge instead of four outflows per cell.",false);
+        TCLAP::SwitchArg halfArg("","half-precision","Store the velocities as 16 bit floats.",false);
+        TCLAP::SwitchArg errorArg("","error-report","Rerun in single precision from the same start and report the difference of the fields.",false);
+        TCLAP::SwitchArg adaptiveArg("a","adaptive","Simulate dt per step in as few stable substeps as possible.",false);
+        TCLAP::ValueArg<double> courantArg("","courant","Fraction of the stability limit the adaptive timestep uses. Default: 0.9.",false,0.9,"double");
+        TCLAP::ValueArg<uint> blockArg("b","block-steps","Advance this many steps per tile (temporal blocking). Default: off.",false,0,"uint");
+        TCLAP::ValueArg<uint> tileArg("","tile-size","Tile size of the temporal blocking. Default: 256.",false,256,"uint");
+        TCLAP::ValueArg<float> cflArg("","max-displacement","Largest sediment advection in cells per step the temporal blocking allows. Default: 2.",false,2.0f,"float");
+        TCLAP::ValueArg<std::string> hugePagesArg("","huge-pages","Huge pages for the grids: off, thp or explicit. Default: thp.",false,"","string");
+        TCLAP::SwitchArg noPadArg("","no-row-padding","Do not pad the rows of the simulation grids to cache lines.",false);
+        TCLAP::ValueArg<std::string> parallelArg("","parallel","Threads of the parallel loops: serial, omp, pool or gcd. Default: omp (gcd on macOS).",false,"","string");
+        TCLAP::ValueArg<uint> threadsArg("j","threads","Worker threads. Default: all hardware threads.",false,0,"uint");
+        TCLAP::ValueArg<std::string> scheduleArg("","schedule","Distribution of the rows and tiles over the threads: static or dynamic (work stealing). Default: static.",false,"","string");
+        TCLAP::ValueArg<uint> grainArg("","grain","Rows or tiles per chunk of the dynamic schedule. Default: about eight chunks per thread.",false,0,"uint");
+        TCLAP::SwitchArg pinArg("","pin","Pin worker i to hardware thread i.",false);
+        TCLAP::ValueArg<std::string> checkpointArg("","checkpoint","Save the complete state to this file after the last step.",false,"","file");
+        TCLAP::ValueArg<ulong> checkpointEveryArg("","checkpoint-every","Also save the --checkpoint file every n steps. Default: off.",false,0,"ulong");
+        TCLAP::ValueArg<std::string> restoreArg("","restore","Continue from a checkpoint, --steps more steps. Needs the options of the saved run.",false,"","file");
+        cmd.add(kernelArg);
+        cmd.add(fusedArg);
+        cmd.add(sparseArg);
+        cmd.add(staggeredArg);
+        cmd.add(halfArg);
+        cmd.add(errorArg);
+        cmd.add(adaptiveArg);
+        cmd.add(courantArg);
+        cmd.add(blockArg);
+        cmd.add(tileArg);
+        cmd.add(cflArg);
+        cmd.add(hugePagesArg);
+        cmd.add(noPadArg);
+        cmd.add(parallelArg);
+        cmd.add(threadsArg);
+        cmd.add(scheduleArg);
+        cmd.add(grainArg);
+        cmd.add(pinArg);
+        cmd.add(checkpointArg);
+        cmd.add(checkpointEveryArg);
+        cmd.add(restoreArg);
+        cmd.parse( argc, argv );
+        terrainDim = dimArg.getValue();
+        steps = stepsArg.getValue();
+        dt = dtArg.getValue();
+        terrainType = terrainArg.getValue();
+        rainSchedule = rainArg.getValue();
+        floodSchedule = floodArg.getValue();
+        floodX = floodXArg.getValue();
+        floodY = floodYArg.getValue();
+        reportInterval = reportArg.getValue();
+        profileJson = jsonArg.getValue();
+        profileCsv = csvArg.getValue();
+        kernels = kernelArg.getValue();
+        fused = fusedArg.getValue();
+        sparse = sparseArg.getValue();
+        staggered = staggeredArg.getValue();
+        halfPrecision = halfArg.getValue();
+        errorReport = errorArg.getValue();
+        adaptive = adaptiveArg.getValue();
+        courant = courantArg.getValue();
+        blockSteps = blockArg.getValue();
+        tileSize = std::max(1u,tileArg.getValue());
+        maxDisplacement = cflArg.getValue();
+        hugePages = hugePagesArg.getValue();
+        padRows = !noPadArg.getValue();
+        parallel = parallelArg.getValue();
+        threads = threadsArg.getValue();
+        schedule = scheduleArg.getValue();
+        grain = grainArg.getValue();
+        pin = pinArg.getValue();
+        checkpointPath = checkpointArg.getValue();
+        checkpointInterval = checkpointEveryArg.getValue();
+        restorePath = restoreArg.getValue();
+    }
+    catch (TCLAP::ArgException &e)
+    {
+        std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+        return 1;
+    }
+
+    // Setup ///////////////////////////////////////////////////////////////
+    ////////////////////////////////////////////////////////////////////////
+
+    // the grids read the memory settings when they allocate
+    if (!hugePages.empty() && !GridMemory::ParseHugePages(hugePages,GridMemory::hugePages()))
+    {
+        std::cerr << "error: unknown huge page mode '" << hugePages << "'" << std::endl;
+        return 1;
+    }
+    GridMemory::padRows() = padRows;
+
+    // before the grids are allocated, they are first touched by the workers
+    try
+    {
+        Simulation::ParallelSettings settings;
+        if (!parallel.empty())
+            settings.backend = Simulation::ParseParallelBackend(parallel);
+        if (!schedule.empty())
+            settings.schedule = Simulation::ParseSchedule(schedule);
+        settings.threads = threads;
+        settings.grain = grain;
+        settings.pin = pin;
+        Simulation::Parallel::Configure(settings);
+    }
+    catch (Exception& e)
+    {
+        std::cerr << "error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    SimulationState state(terrainDim,terrainDim);
+    if (terrainType == "steep")
+    {
+        state.createSteepTerrain();
+    }
+    else if (terrainType != "perlin")
+    {
+        std::cerr << "error: unknown terrain type '" << terrainType << "'" << std::endl;
+        return 1;
+    }
+
+    Simulation::KernelVariant kernelLimit = Simulation::DefaultKernelVariant();
+    Simulation::StepSchedule rain, flood;
+    try
+    {
+        if (!kernels.empty())
+            kernelLimit = Simulation::ParseKernelVariant(kernels);
+        rain = Simulation::StepSchedule::Parse(rainSchedule);
+        flood = Simulation::StepSchedule::Parse(floodSchedule);
+    }
+    catch (Exception& e)
+    {
+        std::cerr << "error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    if (adaptive && blockSteps > 1)
+    {
+        std::cerr << "error: --adaptive cannot be combined with --block-steps" << std::endl;
+        return 1;
+    }
+
+    if (checkpointInterval > 0 && checkpointPath.empty())
+    {
+        std::cerr << "error: --checkpoint-every needs --checkpoint" << std::endl;
+        return 1;
+    }
+
+    if (errorReport && !restorePath.empty())
+    {
+        std::cerr << "error: --error-report cannot be combined with --restore" << std::endl;
+        return 1;
+    }
+
+    // the error report reruns from the same start
+    std::unique_ptr<SimulationState> initialState;
+    if (errorReport)
+        initialState.reset(new SimulationState(state));
+
+    std::unique_ptr<Simulation::AdaptiveStepper> stepper;
+    std::unique_ptr<Simulation::TemporalBlocking> blocking;
+
+    // applies the settings to a simulation and its runner
+    auto configure = [&](Simulation::FluidSimulation& simulation, Simulation::BatchRunner& runner, bool half,
+                         std::unique_ptr<Simulation::AdaptiveStepper>& stepper,
+                         std::unique_ptr<Simulation::TemporalBlocking>& blocking)
+    {
+        simulation.setKernelVariant(kernelLimit);
+        simulation.fused = fused;
+        simulation.sparse = sparse;
+        simulation.staggered = staggered;
+        simulation.halfPrecision = half;
+
+        if (adaptive)
+        {
+            stepper.reset(new Simulation::AdaptiveStepper(simulation));
+            stepper->courant = courant;
+            runner.stepper = stepper.get();
+        }
+
+        if (blockSteps > 1)
+        {
+            blocking.reset(new Simulation::TemporalBlocking(simulation));
+            blocking->steps = blockSteps;
+            blocking->tileSize = tileSize;
+            blocking->maxDisplacement = maxDisplacement;
+            runner.blocking = blocking.get();
+        }
+
+        runner.rain = rain;
+        runner.flood = flood;
+        runner.dt = dt;
+        if (floodX >= 0) runner.floodPos.x = floodX;
+        if (floodY >= 0) runner.floodPos.y = floodY;
+    };
+
+    Simulation::FluidSimulation simulation(state);
+    Simulation::BatchRunner runner(state,simulation);
+    configure(simulation,runner,halfPrecision,stepper,blocking);
+    runner.reportInterval = reportInterval;
+    runner.checkpointInterval = checkpointInterval;
+    runner.checkpointPath = checkpointPath;
+
+    if (!restorePath.empty())
+    {
+        try
+        {
+            runner.setStep(Simulation::Checkpoint::Load(restorePath,simulation));
+        }
+        catch (Exception& e)
+        {
+            std::cerr << "error: " << e.what() << std::endl;
+            return 1;
+        }
+        cout << "restored step " << runner.step() << " from " << restorePath << "\n";
+    }
+
+    // Run Simulation //////////////////////////////////////////////////////
+    ////////////////////////////////////////////////////////////////////////
+
+    Simulation::BatchRunner::Result result;
+    try
+    {
+        result = runner.run(steps);
+
+        // unless run() just saved this step
+        if (!checkpointPath.empty() && (checkpointInterval == 0 || runner.step() % checkpointInterval != 0))
+            Simulation::Checkpoint::Save(checkpointPath,simulation,runner.step());
+    }
+    catch (Exception& e)
+    {
+        std::cerr << "error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    cout << result.steps << " steps on " << terrainDim << "x" << terrainDim << " grid in "
+         << result.seconds << " s\n";
+    cout << result.stepsPerSecond() << " steps/s, "
+         << result.cellsPerSecond(state.water.size())/1e6 << " Mcells/s" << endl;
+
+    if (stepper)
+    {
+        cout << "adaptive: " << result.updates << " substeps, " << double(result.steps)*dt/result.updates
+             << " ms average dt, " << stepper->dt << " ms last dt, " << stepper->limited << " intervals at the substep limit\n";
+    }
+
+    if (blocking)
+    {
+        cout << "temporal blocking: " << blockSteps << " steps per " << tileSize << "x" << tileSize
+             << " tile, halo " << blocking->halo(blockSteps) << ", " << blocking->fallbacks << " fallbacks\n";
+    }
+
+    if (sparse)
+    {
+        cout << "sparse: " << simulation.activeTiles.count() << " of " << simulation.activeTiles.tiles()
+             << " tiles active after the last step\n";
+    }
+
+    const Simulation::ParallelSettings& settings = Simulation::Parallel::Settings();
+    cout << "parallel: " << Simulation::ParallelBackendName(settings.backend) << ", " << Simulation::Parallel::Threads()
+         << " threads, " << Simulation::ScheduleName(settings.schedule) << " schedule\n";
+
+    cout << "kernels:";
+    for (Simulation::Stage stage : {Simulation::Stage::Flow, Simulation::Stage::Erosion, Simulation::Stage::SedimentTransportation,
+                                    Simulation::Stage::Evaporation, Simulation::Stage::SurfaceNormals})
+        cout << " " << Simulation::StageName(stage) << "=" << Simulation::KernelVariantName(simulation.kernelVariant(stage));
+    cout << "\n";
+
+    const Simulation::Profiler& profiler = simulation.profiler;
+    cout << "step latency p50 " << profiler.stepLatency().percentile(0.5)*1e3 << " ms, p99 "
+         << profiler.stepLatency().percentile(0.99)*1e3 << " ms\n";
+    for (uint i=0; i<uint(Simulation::Stage::Count); i++)
+    {
+        const Simulation::LatencyHistogram& h = profiler.stage(Simulation::Stage(i)).latency;
+        if (h.count() == 0) continue;
+        cout << "  " << Simulation::StageName(Simulation::Stage(i)) << ": " << h.total() << " s total, p50 "
+             << h.percentile(0.5)*1e3 << " ms, p99 " << h.percentile(0.99)*1e3 << " ms\n";
+    }
+
+    if (!profileJson.empty())
+    {
+        std::ofstream out(profileJson);
+        profiler.writeJson(out);
+    }
+    if (!profileCsv.empty())
+    {
+        std::ofstream out(profileCsv);
+        profiler.writeCsv(out);
+    }
+
+    if (errorReport)
+    {
+        // same run in single precision, the drops start over
+        Simulation::FluidSimulation::restartRain();
+        SimulationState& refState = *initialState;
+        Simulation::FluidSimulation reference(refState);
+        Simulation::BatchRunner refRunner(refState,reference);
+        std::unique_ptr<Simulation::AdaptiveStepper> refStepper;
+        std::unique_ptr<Simulation::TemporalBlocking> refBlocking;
+        configure(reference,refRunner,false,refStepper,refBlocking);
+        refRunner.run(steps);
+
+        cout << "error against single precision (max abs, rms, max |reference|, total difference):\n";
+        const PaddedGrid2D<float>* fields[] = { &state.terrain, &state.water, &state.suspendedSediment };
+        const PaddedGrid2D<float>* refFields[] = { &refState.terrain, &refState.water, &refState.suspendedSediment };
+        const char* names[] = { "terrain", "water", "sediment" };
+        for (int f=0; f<3; f++)
+        {
+            double maxError = 0, sumSquares = 0, maxValue = 0, total = 0, refTotal = 0;
+            for (uint y=0; y<state.water.height(); y++)
+            {
+                for (uint x=0; x<state.water.width(); x++)
+                {
+                    double value = (*fields[f])(y,x);
+                    double ref = (*refFields[f])(y,x);
+                    maxError = std::max(maxError,std::abs(value-ref));
+                    sumSquares += (value-ref)*(value-ref);
+                    maxValue = std::max(maxValue,std::abs(ref));
+                    total += value;
+                    refTotal += ref;
+                }
+            }
+            cout << "  " << names[f] << ": " << maxError << ", " << std::sqrt(sumSquares/state.water.size())
+                 << ", " << maxValue << ", " << total-refTotal << "\n";
+        }
+    }
+
+    return 0;
+}
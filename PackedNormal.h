@@ -0,0 +1,72 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#ifndef PACKEDNORMAL_H
+#define PACKEDNORMAL_H
+
+#include "platform_includes.h"
+
+#include <stdint.h>
+#include <cmath>
+#include <algorithm>
+
+/// Unit vector in 4 bytes: the octahedral projection of the vector, two
+/// signed normalized 16 bit components.
+///
+/// The vector is projected onto the octahedron |x|+|y|+|z| = 1, whose lower
+/// half is folded over the upper one, so (x,y) cover the square [-1,1]^2.
+/// The angular error is below 0.04 degrees. OpenGL reads the components as
+/// normalized shorts, lambert_v.glsl unfolds them again.
+struct PackedNormal
+{
+    int16_t x;
+    int16_t y;
+
+    /// n does not need to be normalized. Written without data dependent
+    /// branches, the signs of the slopes are random.
+    static PackedNormal Encode(const glm::vec3& n)
+    {
+        float s = 1.0f/(std::abs(n.x)+std::abs(n.y)+std::abs(n.z));
+        float px = n.x*s;
+        float py = n.y*s;
+        float fx = std::copysign(1.0f-std::abs(py),px);
+        float fy = std::copysign(1.0f-std::abs(px),py);
+        PackedNormal packed = { ToSnorm(n.z < 0.0f ? fx : px), ToSnorm(n.z < 0.0f ? fy : py) };
+        return packed;
+    }
+
+    glm::vec3 decode() const
+    {
+        glm::vec3 n(FromSnorm(x),FromSnorm(y),0.0f);
+        n.z = 1.0f-std::abs(n.x)-std::abs(n.y);
+        if (n.z < 0.0f)
+        {
+            float fx = (1.0f-std::abs(n.y))*(n.x >= 0.0f ? 1.0f : -1.0f);
+            float fy = (1.0f-std::abs(n.x))*(n.y >= 0.0f ? 1.0f : -1.0f);
+            n.x = fx;
+            n.y = fy;
+        }
+        return glm::normalize(n);
+    }
+
+    /// Rounds to nearest, halfway cases away from zero.
+    static int16_t ToSnorm(float v)
+    {
+        return int16_t(v*32767.0f + std::copysign(0.5f,v));
+    }
+
+    static float FromSnorm(int16_t v)
+    {
+        return std::max(v/32767.0f,-1.0f);
+    }
+};
+
+#endif // PACKEDNORMAL_H
@@ -0,0 +1,278 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#ifndef PADDEDGRID2D_H
+#define PADDEDGRID2D_H
+
+#include "platform_includes.h"
+#include "Grid2D.h"
+#include "GridAllocator.h"
+#include <vector>
+#include <algorithm>
+
+/// How the halo (ghost cells) around a PaddedGrid2D is filled.
+enum class BoundaryPolicy : uint
+{
+    Clamp,      /// repeat the closest edge value
+    Reflect,    /// mirror at the edge cell (-1 -> 1)
+    Zero,       /// constant zero
+    Periodic    /// wrap around
+};
+
+/// 2D grid surrounded by a halo of ghost cells.
+///
+/// Coordinates in [-halo, width+halo) x [-halo, height+halo) are valid, so
+/// stencil kernels can read neighbours without bounds checks. The halo is
+/// filled according to the boundary policy by updateHalo(), which has to be
+/// called after the interior was modified and before it is read by a stencil.
+///
+/// With GridMemory::padRows() the left halo is widened and the pitch rounded
+/// up to whole cache lines, so row(y) is 64 byte aligned for every y. The
+/// rows are first touched in parallel like Grid2D.
+template<typename T>
+class PaddedGrid2D
+{
+protected:
+    typedef std::vector<T,GridAllocator<T> > Data;
+
+    uint _width;
+    uint _height;
+    uint _size;
+    uint _halo;
+    uint _pitch;
+    uint _origin;
+    BoundaryPolicy _policy;
+    Data _data;
+
+public:
+    PaddedGrid2D(uint w=0, uint h=0, uint halo=1, BoundaryPolicy policy=BoundaryPolicy::Clamp)
+        : _halo(halo), _policy(policy)
+    {
+        resize(w,h);
+    }
+
+    PaddedGrid2D(const PaddedGrid2D& other)
+        : _width(other._width), _height(other._height), _size(other._size),
+          _halo(other._halo), _pitch(other._pitch), _origin(other._origin),
+          _policy(other._policy), _data(other._data.size())
+    {
+        copyRows(other);
+    }
+
+    PaddedGrid2D(PaddedGrid2D&&) = default;
+    PaddedGrid2D& operator=(PaddedGrid2D&&) = default;
+
+    PaddedGrid2D& operator=(const PaddedGrid2D& other)
+    {
+        if (this != &other)
+        {
+            if (_data.size() != other._data.size())
+                Data(other._data.size()).swap(_data);
+            _width = other._width;
+            _height = other._height;
+            _size = other._size;
+            _halo = other._halo;
+            _pitch = other._pitch;
+            _origin = other._origin;
+            _policy = other._policy;
+            copyRows(other);
+        }
+        return *this;
+    }
+
+    uint width() const { return _width; }
+    uint height() const { return _height;}
+    uint size() const { return _size; }
+    uint halo() const { return _halo; }
+    uint pitch() const { return _pitch; }
+    BoundaryPolicy policy() const { return _policy; }
+
+    /// Storage index of cell (0,0).
+    uint origin() const { return _origin; }
+
+    /// The storage including the halo and the row padding.
+    size_t storageSize() const { return _data.size(); }
+    T* storage() { return _data.empty() ? 0 : &_data[0]; }
+    const T* storage() const { return _data.empty() ? 0 : &_data[0]; }
+
+    /// Changes the shape, the grid is reallocated and cleared.
+    void resize(uint w, uint h)
+    {
+        // cache line multiples of elements, 1 if T does not divide a line
+        uint align = GridMemory::CacheLine % sizeof(T) == 0 ? GridMemory::CacheLine/sizeof(T) : 1;
+        uint lead = _halo;
+        _pitch = w + 2*_halo;
+        if (GridMemory::padRows())
+        {
+            lead = GridMemory::RoundUp(_halo,align);
+            _pitch = GridMemory::RoundUp(lead + w + _halo,align);
+        }
+
+        _width = w;
+        _height = h;
+        _size = w*h;
+        _origin = _halo*_pitch + lead;
+        Data(_pitch*(h+2*_halo)).swap(_data);
+        fill(T());
+    }
+
+    /// Takes the storage like Grid2D::adopt(), with the halo, pitch and
+    /// origin the storage was written with, which need not match the current
+    /// GridMemory::padRows() setting.
+    void adopt(uint w, uint h, uint halo, uint pitch, uint origin, BoundaryPolicy policy, T* memory, size_t mappedBytes)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "Grids of non-trivial elements cannot adopt memory.");
+        _width = w;
+        _height = h;
+        _size = w*h;
+        _halo = halo;
+        _pitch = pitch;
+        _origin = origin;
+        _policy = policy;
+        GridMemory::Adoption adoption(memory,sizeof(T)*_pitch*(h+2*_halo),mappedBytes);
+        Data(_pitch*(h+2*_halo)).swap(_data);
+    }
+
+    /// Sets all cells including the halo in parallel, row by row.
+    void fill(const T& value)
+    {
+        if (_data.empty()) return;
+        T* data = &_data[0];
+        const uint pitch = _pitch;
+        GridMemory::ParallelRows(_height+2*_halo,[=](int y) {
+            std::fill(data+y*pitch,data+(y+1)*pitch,value);
+        });
+    }
+
+    T& operator ()(int y, int x) { return _data[_origin + y*int(_pitch) + x]; }
+    const T& operator ()(int y, int x) const { return _data[_origin + y*int(_pitch) + x]; }
+
+    /// Pointer to the first interior cell of row y, row(y)[-1] is valid halo.
+    T* row(int y) { return &_data[_origin + y*int(_pitch)]; }
+    const T* row(int y) const { return &_data[_origin + y*int(_pitch)]; }
+
+    /// Fills the ghost cells from the interior according to the boundary policy.
+    void updateHalo();
+
+    /// Copies the interior into a dense grid (e.g. for upload or output).
+    void copyTo(Grid2D<T>& grid) const;
+
+    /// Sets the interior from a dense grid of the same size and updates the halo.
+    void copyFrom(const Grid2D<T>& grid);
+
+    /// Exchanges the contents with other in O(1), see DoubleBuffer.
+    void swap(PaddedGrid2D& other)
+    {
+        std::swap(_width,other._width);
+        std::swap(_height,other._height);
+        std::swap(_size,other._size);
+        std::swap(_halo,other._halo);
+        std::swap(_pitch,other._pitch);
+        std::swap(_origin,other._origin);
+        std::swap(_policy,other._policy);
+        _data.swap(other._data);
+    }
+
+protected:
+    void copyRows(const PaddedGrid2D& other)
+    {
+        if (_data.empty()) return;
+        T* data = &_data[0];
+        const T* src = &other._data[0];
+        const uint pitch = _pitch;
+        GridMemory::ParallelRows(_height+2*_halo,[=](int y) {
+            std::copy(src+y*pitch,src+(y+1)*pitch,data+y*pitch);
+        });
+    }
+
+    /// Maps a coordinate outside of [0,n) to the interior cell it mirrors.
+    int source(int i, int n) const;
+};
+
+// Implementation
+///////////////////////////////////////////////
+
+template<typename T>
+inline int PaddedGrid2D<T>::source(int i, int n) const
+{
+    switch (_policy)
+    {
+    case BoundaryPolicy::Reflect:
+        i = i < 0 ? -i : i;
+        i = i >= n ? 2*(n-1)-i : i;
+        return glm::clamp(i,0,n-1);
+    case BoundaryPolicy::Periodic:
+        return ((i % n) + n) % n;
+    default:
+        return glm::clamp(i,0,n-1);
+    }
+}
+
+template<typename T>
+void PaddedGrid2D<T>::updateHalo()
+{
+    if (_halo == 0 || _size == 0) return;
+
+    int h = _halo;
+    int w = _width;
+    int n = _height;
+
+    if (_policy == BoundaryPolicy::Zero)
+    {
+        for (int y=-h; y<n+h; y++)
+        {
+            T* r = row(y);
+            bool outside = (y < 0 || y >= n);
+            for (int x=-h; x<w+h; x++)
+            {
+                if (outside || x < 0 || x >= w) r[x] = T();
+            }
+        }
+        return;
+    }
+
+    // left and right ghost columns of the interior rows
+    for (int y=0; y<n; y++)
+    {
+        T* r = row(y);
+        for (int x=1; x<=h; x++)
+        {
+            r[-x] = r[source(-x,w)];
+            r[w-1+x] = r[source(w-1+x,w)];
+        }
+    }
+
+    // ghost rows, copied including their ghost columns (fills the corners)
+    for (int y=1; y<=h; y++)
+    {
+        std::copy(row(source(-y,n))-h, row(source(-y,n))+w+h, row(-y)-h);
+        std::copy(row(source(n-1+y,n))-h, row(source(n-1+y,n))+w+h, row(n-1+y)-h);
+    }
+}
+
+template<typename T>
+void PaddedGrid2D<T>::copyTo(Grid2D<T>& grid) const
+{
+    grid.resize(_width,_height);
+    for (uint y=0; y<_height; y++)
+        std::copy(row(y), row(y)+_width, &grid(y,0));
+}
+
+template<typename T>
+void PaddedGrid2D<T>::copyFrom(const Grid2D<T>& grid)
+{
+    assert(grid.width() == _width && grid.height() == _height);
+    for (uint y=0; y<_height; y++)
+        std::copy(&grid(y,0), &grid(y,0)+_width, row(y));
+    updateHalo();
+}
+
+#endif // PADDEDGRID2D_H
@@ -9,7 +9,7 @@
     MIT license (http://opensource.org/licenses/MIT).
 *****************************************************************************/
 
-#version 150
+#version 330
 
 // Transform matrices
 /////////////////////////////////////////////////
@@ -9,7 +9,7 @@
     MIT license (http://opensource.org/licenses/MIT).
 *****************************************************************************/
 
-#version 150
+#version 330
 
 // Transform matrices
 /////////////////////////////////////////////////
@@ -22,20 +22,13 @@ uniform mat4 uViewMatrixNormal;   // View Matrix
 /////////////////////////////////////////////////
 
 uniform bool uIsWater;
-uniform int uGridSize;
+uniform int uGridSize;            // grid width
+uniform int uGridHeight;
+uniform int uChunksX;             // chunks per grid row, see TerrainChunks.h
 
-// Vertex Attributes
-/////////////////////////////////////////////////
-
-in vec2     inGridCoord;
-in float    inTerrainHeight;
-in float    inWaterHeight;
-in float    inSediment;
-in vec3     inNormal;
-
-in float    inDebugXVelocity;
-in float    inDebugYVelocity;
-in float    inDebugAdvection;
+// Terrain height (float bits) in r, water and sediment (half floats) in g,
+// see SurfaceTexel.h
+uniform usampler2D uSurface;
 
 // Output
 /////////////////////////////////////////////////
@@ -49,26 +42,68 @@ out vec4  vNormal;
 out vec3  vColor;
 out float vSediment;
 
+// Helpers
+/////////////////////////////////////////////////
+
+const int ChunkSize = 64;
+const int ChunkVertices = (ChunkSize+1)*(ChunkSize+1);
+
+// IEEE binary16 to float, infinities and NaNs become the largest half
+float halfToFloat(uint h)
+{
+    float s = (h & 0x8000u) != 0u ? -1.0 : 1.0;
+    uint e = (h >> 10) & 0x1Fu;
+    float m = float(h & 0x3FFu)/1024.0;
+    if (e == 0u)
+        return s*m*exp2(-14.0);
+    if (e == 31u)
+        return s*65504.0;
+    return s*(1.0+m)*exp2(float(e)-15.0);
+}
+
+// terrain and water surface height of a cell, clamped to the grid
+float surfaceHeight(ivec2 cell)
+{
+    uvec2 t = texelFetch(uSurface,clamp(cell,ivec2(0),ivec2(uGridSize,uGridHeight)-1),0).rg;
+    return uintBitsToFloat(t.r) + halfToFloat(t.g & 0xFFFFu);
+}
+
 // Main
 /////////////////////////////////////////////////
 
 void main(void)
 {
+    // the cell of the vertex, chunk*ChunkVertices + y*(ChunkSize+1) + x
+    int chunk = gl_VertexID / ChunkVertices;
+    int local = gl_VertexID % ChunkVertices;
+    ivec2 cell = ivec2(chunk % uChunksX, chunk / uChunksX)*ChunkSize
+               + ivec2(local % (ChunkSize+1), local / (ChunkSize+1));
+    cell = min(cell,ivec2(uGridSize,uGridHeight)-1);
+
+    uvec2 texel = texelFetch(uSurface,cell,0).rg;
+    float terrain = uintBitsToFloat(texel.r);
+    float water = halfToFloat(texel.g & 0xFFFFu);
+
     // transform and project the vertex position
-    vec2 p = inGridCoord-vec2(0.5,0.5);
+    vec2 gridCoord = vec2(cell)/vec2(max(ivec2(uGridSize,uGridHeight)-1,1));
+    vec2 p = gridCoord-vec2(0.5,0.5);
 
     // pass on some values
-    vGridCoord = inGridCoord;
-    vSediment = inSediment;
-
-    // surface normal
-    vec4 N = vec4(normalize(inNormal),1);
+    vGridCoord = gridCoord;
+    vSediment = halfToFloat(texel.g >> 16);
+
+    // surface normal from the neighbouring heights
+    float r = surfaceHeight(cell+ivec2(1,0));
+    float l = surfaceHeight(cell-ivec2(1,0));
+    float t = surfaceHeight(cell+ivec2(0,1));
+    float b = surfaceHeight(cell-ivec2(0,1));
+    vec4 N = vec4(normalize(vec3(l-r,t-b,2.0)),1);
     N = vec4(N.x,N.z,-N.y,1);
     vNormal = uViewMatrixNormal*N ;
     
     // terrain height values
-    vTerrainHeight = inTerrainHeight+inWaterHeight;
-    vWaterHeight = inWaterHeight;
+    vTerrainHeight = terrain+water;
+    vWaterHeight = water;
 
     // framgment position in camera space
     vFragPos = vec4(p.x*uGridSize,vTerrainHeight,p.y*uGridSize,1);
@@ -0,0 +1,181 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#include "ActiveTiles.h"
+#include "Parallel.h"
+
+#include <algorithm>
+
+using namespace Simulation;
+
+ActiveTiles::ActiveTiles(uint width, uint height)
+{
+    resize(width,height);
+}
+
+void ActiveTiles::resize(uint width, uint height)
+{
+    _width = width;
+    _height = height;
+    _tilesX = (width+TileSize-1)/TileSize;
+    _tilesY = (height+TileSize-1)/TileSize;
+
+    _live.assign(tiles(),0);
+    _queued.assign(tiles(),0);
+    _rescan.clear();
+    _active.clear();
+    _invalidated = true;
+}
+
+void ActiveTiles::touch(int x0, int y0, int x1, int y1)
+{
+    x0 = std::max(x0,0);
+    y0 = std::max(y0,0);
+    x1 = std::min(x1,int(_width));
+    y1 = std::min(y1,int(_height));
+    if (x0 >= x1 || y0 >= y1)
+        return;
+
+    for (int ty=y0/TileSize; ty<=(y1-1)/TileSize; ty++)
+    {
+        for (int tx=x0/TileSize; tx<=(x1-1)/TileSize; tx++)
+        {
+            uint index = ty*_tilesX+tx;
+            if (!_queued[index])
+            {
+                _queued[index] = 1;
+                _rescan.push_back(index);
+            }
+        }
+    }
+}
+
+namespace {
+
+/// True if a cell of the tile holds velocity or outflow flux, for the
+/// velocity storage (float or Half) the grids currently use.
+template<typename S>
+bool HasFlow(const Kernels::Fields& f, int x0, int y0, int x1, int y1)
+{
+    const Grid2D<S>& uVel = *Kernels::Storage<S>::Pick(f.uVel,f.uVelHalf);
+    const Grid2D<S>& vVel = *Kernels::Storage<S>::Pick(f.vVel,f.vVelHalf);
+    for (int y=y0; y<y1; y++)
+    {
+        const S* uRow = &uVel(y,0);
+        const S* vRow = &vVel(y,0);
+        const float* lRow = f.lFlux->row(y);
+        const float* rRow = f.rFlux->row(y);
+        const float* tRow = f.tFlux->row(y);
+        const float* bRow = f.bFlux->row(y);
+        for (int x=x0; x<x1; x++)
+        {
+            if (float(uRow[x]) != 0.0f || float(vRow[x]) != 0.0f ||
+                lRow[x] != 0.0f || rRow[x] != 0.0f ||
+                tRow[x] != 0.0f || bRow[x] != 0.0f)
+                return true;
+        }
+    }
+    return false;
+}
+
+}
+
+bool ActiveTiles::scan(uint index, const Kernels::Fields& f) const
+{
+    int x0 = (index%_tilesX)*TileSize;
+    int y0 = (index/_tilesX)*TileSize;
+    int x1 = std::min(x0+TileSize,int(_width));
+    int y1 = std::min(y0+TileSize,int(_height));
+
+    for (int y=y0; y<y1; y++)
+    {
+        const float* wRow = f.water->row(y);
+        const float* sRow = f.sediment->row(y);
+
+        for (int x=x0; x<x1; x++)
+        {
+            if (wRow[x] != 0.0f || sRow[x] != 0.0f)
+                return true;
+        }
+    }
+
+    // velocities and the fluxes of the model in use
+    if (f.uVelHalf)
+        return HasFlow<Half>(f,x0,y0,x1,y1);
+    if (!f.xFlux)
+        return HasFlow<float>(f,x0,y0,x1,y1);
+
+    for (int y=y0; y<y1; y++)
+    {
+        const float* uRow = &(*f.uVel)(y,0);
+        const float* vRow = &(*f.vVel)(y,0);
+        const float* xRow = f.xFlux->row(y);
+        const float* yRow = f.yFlux->row(y);
+        for (int x=x0; x<x1; x++)
+        {
+            if (uRow[x] != 0.0f || vRow[x] != 0.0f || xRow[x] != 0.0f || yRow[x] != 0.0f)
+                return true;
+        }
+    }
+    return false;
+}
+
+void ActiveTiles::update(const Kernels::Fields& fields)
+{
+    if (_invalidated)
+    {
+        _rescan.resize(tiles());
+        for (uint i=0; i<tiles(); i++)
+            _rescan[i] = i;
+        _invalidated = false;
+    }
+
+    // Tiles that are not rescanned keep their state: they were neither
+    // active nor touched, so nothing changed them.
+    Parallel::ForEach(int(_rescan.size()),[&](int i)
+    {
+        _live[_rescan[i]] = scan(_rescan[i],fields);
+    });
+
+    // live tiles and their neighbours
+    _active.clear();
+    _rescan.clear();
+    for (uint ty=0; ty<_tilesY; ty++)
+    {
+        uint ty0 = ty > 0 ? ty-1 : 0;
+        uint ty1 = std::min(ty+1,_tilesY-1);
+        for (uint tx=0; tx<_tilesX; tx++)
+        {
+            uint tx0 = tx > 0 ? tx-1 : 0;
+            uint tx1 = std::min(tx+1,_tilesX-1);
+
+            bool active = false;
+            for (uint ny=ty0; ny<=ty1 && !active; ny++)
+                for (uint nx=tx0; nx<=tx1 && !active; nx++)
+                    active = _live[ny*_tilesX+nx];
+
+            uint index = ty*_tilesX+tx;
+            _queued[index] = active;
+            if (active)
+            {
+                // the kernels may change it, so it is rescanned next time
+                _rescan.push_back(index);
+
+                Tile tile;
+                tile.x0 = tx*TileSize;
+                tile.y0 = ty*TileSize;
+                tile.x1 = std::min(tile.x0+TileSize,int(_width));
+                tile.y1 = std::min(tile.y0+TileSize,int(_height));
+                _active.push_back(tile);
+            }
+        }
+    }
+}
@@ -0,0 +1,83 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#ifndef ACTIVETILES_H
+#define ACTIVETILES_H
+
+#include "platform_includes.h"
+#include "Simulation/Kernels.h"
+
+#include <vector>
+
+namespace Simulation {
+
+/// Tracks the tiles of the grid the flow, erosion, transportation and
+/// evaporation kernels have to visit, so dry regions are skipped.
+///
+/// A tile is live if any of its cells holds water or sediment or has a
+/// non-zero flux or velocity. The kernels leave every cell of a tile
+/// without live neighbours untouched, and water moves at most one cell per
+/// step, so the active tiles are the live tiles and their eight neighbours.
+///
+/// Only the tiles that were active in the last step and the tiles marked by
+/// touch() are rescanned, the rest of the grid is never read.
+class ActiveTiles
+{
+public:
+    static const int TileSize = 32;
+
+    struct Tile
+    {
+        int x0, y0;     /// first cell
+        int x1, y1;     /// one past the last cell
+    };
+
+    ActiveTiles(uint width, uint height);
+
+    /// Adapts to a resized grid and rescans everything on the next update().
+    void resize(uint width, uint height);
+
+    /// Marks the tiles overlapping the cells [x0,x1) x [y0,y1) for a rescan,
+    /// must be called after adding water or sediment outside of the kernels.
+    void touch(int x0, int y0, int x1, int y1);
+
+    /// Rescans all tiles on the next update(), for changes to the grids that
+    /// are not tracked by touch() (e.g. a dense update or a swapped grid).
+    void invalidate() { _invalidated = true; }
+
+    /// Rescans the tiles of the last step and the touched ones and rebuilds
+    /// the list of active tiles, ordered by rows of tiles.
+    void update(const Kernels::Fields& fields);
+
+    uint count() const { return _active.size(); }
+    const Tile& operator[](uint i) const { return _active[i]; }
+
+    /// Number of tiles of the whole grid.
+    uint tiles() const { return _tilesX*_tilesY; }
+
+protected:
+    bool scan(uint index, const Kernels::Fields& fields) const;
+
+    uint _width;
+    uint _height;
+    uint _tilesX;
+    uint _tilesY;
+
+    bool _invalidated;
+    std::vector<uint8_t> _live;     /// per tile, result of the last scan
+    std::vector<uint8_t> _queued;   /// per tile, in _rescan
+    std::vector<uint> _rescan;
+    std::vector<Tile> _active;
+};
+
+} // namespace Simulation
+
+#endif // ACTIVETILES_H
@@ -0,0 +1,83 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#include "AdaptiveStepper.h"
+
+#include <cmath>
+
+using namespace Simulation;
+
+AdaptiveStepper::AdaptiveStepper(FluidSimulation& simulation)
+    : courant(0.9),
+      maxDisplacement(2.0f),
+      maxSubsteps(64),
+      dt(0.0),
+      steps(0),
+      totalSteps(0),
+      limited(0),
+      _simulation(simulation)
+{
+}
+
+double AdaptiveStepper::stableDt() const
+{
+    const FluidSimulation& s = _simulation;
+
+    // surface waves, omega*dt <= 2
+    double omega = std::sqrt(16.0*s.pipeArea*s.gravity/(s.pipeLength*s.lX*s.lY));
+    double limit = courant*2.0/omega;
+
+    // sediment advection
+    float speed = s.maxVelocity();
+    if (speed > 0.0f)
+        limit = std::min(limit,double(maxDisplacement)/speed);
+
+    return limit;
+}
+
+uint AdaptiveStepper::advance(double interval, bool rain, bool flood)
+{
+    const double minDt = interval/maxSubsteps;
+
+    steps = 0;
+    bool clamped = false;
+    double remaining = interval;
+    while (remaining > 0.0)
+    {
+        double limit = stableDt();
+        if (limit < minDt)
+        {
+            clamped = true;
+            limit = minDt;
+        }
+
+        // equal substeps for the rest of the interval, the last one takes
+        // the remainder so rounding cannot leave a tiny extra step
+        if (remaining <= limit)
+        {
+            dt = remaining;
+            remaining = 0.0;
+        }
+        else
+        {
+            dt = remaining/std::ceil(remaining/limit);
+            remaining -= dt;
+        }
+
+        _simulation.update(dt,rain && steps == 0,flood);
+        steps++;
+    }
+
+    totalSteps += steps;
+    if (clamped)
+        limited++;
+    return steps;
+}
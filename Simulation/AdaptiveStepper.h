@@ -0,0 +1,78 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#ifndef ADAPTIVESTEPPER_H
+#define ADAPTIVESTEPPER_H
+
+#include "platform_includes.h"
+#include "Simulation/FluidSimulation.h"
+
+namespace Simulation {
+
+/// Advances a FluidSimulation by a requested interval of simulated time in
+/// as few steps as the stability limits allow (adaptive CFL timestep).
+///
+/// Two limits bound the timestep:
+/// - the surface waves of the pipe model. Their fastest mode oscillates with
+///   omega^2 = 16*A*g/(l*dx*dy), the explicit update is stable for
+///   omega*dt <= 2. This limit only depends on the constants.
+/// - the sediment advection, which should not move further than
+///   maxDisplacement cells per step. FluidSimulation::maxVelocity() of the
+///   previous step provides the velocity, reduced in the velocity pass.
+///   The outflow scaling keeps the displacement close to one cell (a cell
+///   cannot drain more than its water per step), so with the default of two
+///   cells this limit only caps how fast the timestep grows.
+///
+/// The interval is split into equally long substeps that obey the limits of
+/// the start of the interval. The limits are re-evaluated after every
+/// substep, so the steps shrink as soon as the flow speeds up.
+class AdaptiveStepper
+{
+public:
+    AdaptiveStepper(FluidSimulation& simulation);
+
+    /// Fraction of the wave stability limit used as timestep.
+    double courant;
+
+    /// Largest sediment advection per step in cells.
+    float maxDisplacement;
+
+    /// Upper bound on the substeps of one interval, the timestep is never
+    /// smaller than interval/maxSubsteps.
+    uint maxSubsteps;
+
+    /// Timestep of the last substep in milliseconds.
+    double dt;
+
+    /// Substeps taken by the last advance().
+    uint steps;
+
+    /// Substeps taken by all advance() calls.
+    ulong totalSteps;
+
+    /// Number of advance() calls that hit maxSubsteps.
+    ulong limited;
+
+    /// Largest stable timestep for the current velocities in milliseconds.
+    double stableDt() const;
+
+    /// Advances the simulation by interval milliseconds. Rain falls once at
+    /// the start of the interval, flooding is added in every substep in
+    /// proportion to its timestep. Returns the number of substeps.
+    uint advance(double interval, bool rain=true, bool flood=false);
+
+protected:
+    FluidSimulation& _simulation;
+};
+
+} // namespace Simulation
+
+#endif // ADAPTIVESTEPPER_H
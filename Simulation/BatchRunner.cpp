@@ -0,0 +1,162 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#include "BatchRunner.h"
+#include "Checkpoint.h"
+
+#include "Exception.h"
+
+#include <chrono>
+#include <sstream>
+#include <limits>
+
+using namespace Simulation;
+using namespace std;
+
+// StepSchedule
+//////////////////////////////////////////////
+
+StepSchedule StepSchedule::Parse(const std::string& text)
+{
+    StepSchedule schedule;
+
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss,item,','))
+    {
+        if (item.empty()) continue;
+
+        size_t sep = item.find(':');
+        try
+        {
+            if (sep == std::string::npos)
+            {
+                ulong step = std::stoul(item);
+                schedule.add(step,step+1);
+            }
+            else
+            {
+                std::string first = item.substr(0,sep);
+                std::string second = item.substr(sep+1);
+                ulong begin = first.empty() ? 0 : std::stoul(first);
+                ulong end = second.empty() ? std::numeric_limits<ulong>::max() : std::stoul(second);
+                if (end < begin)
+                    throw Exception("Invalid step interval '" + item + "': end lies before begin.");
+                schedule.add(begin,end);
+            }
+        }
+        catch (std::logic_error&)
+        {
+            throw Exception("Invalid step interval '" + item + "'.");
+        }
+    }
+
+    return schedule;
+}
+
+StepSchedule StepSchedule::Always()
+{
+    StepSchedule schedule;
+    schedule.add(0,std::numeric_limits<ulong>::max());
+    return schedule;
+}
+
+void StepSchedule::add(ulong begin, ulong end)
+{
+    _intervals.push_back(std::make_pair(begin,end));
+}
+
+bool StepSchedule::active(ulong step) const
+{
+    for (auto& interval : _intervals)
+    {
+        if (step >= interval.first && step < interval.second)
+            return true;
+    }
+    return false;
+}
+
+// BatchRunner
+//////////////////////////////////////////////
+
+BatchRunner::BatchRunner(SimulationState& state, FluidSimulation& simulation)
+    : floodPos(state.water.width()/2, state.water.height()/2),
+      dt(1000.0/60),
+      reportInterval(0),
+      checkpointInterval(0),
+      blocking(0),
+      stepper(0),
+      _state(state),
+      _simulation(simulation),
+      _step(0)
+{}
+
+BatchRunner::Result BatchRunner::run(ulong steps)
+{
+    using namespace std::chrono;
+
+    high_resolution_clock clock;
+    high_resolution_clock::time_point start = clock.now();
+    high_resolution_clock::time_point lastReport = start;
+
+    _simulation.rainPos = floodPos;
+
+    std::vector<bool> rainSteps, floodSteps;
+    ulong updates = 0;
+
+    for (ulong i=0; i<steps; )
+    {
+        ulong n = 1;
+        if (stepper)
+        {
+            updates += stepper->advance(dt,rain.active(_step),flood.active(_step));
+        }
+        else if (blocking && blocking->steps > 1)
+        {
+            n = std::min(ulong(blocking->steps),steps-i);
+            rainSteps.resize(n);
+            floodSteps.resize(n);
+            for (ulong k=0; k<n; ++k)
+            {
+                rainSteps[k] = rain.active(_step+k);
+                floodSteps[k] = flood.active(_step+k);
+            }
+            blocking->advance(dt,rainSteps,floodSteps);
+            updates += n;
+        }
+        else
+        {
+            _simulation.update(dt,rain.active(_step),flood.active(_step));
+            updates++;
+        }
+
+        ulong before = i;
+        i += n;
+        _step += n;
+
+        if (reportInterval > 0 && i/reportInterval != before/reportInterval)
+        {
+            high_resolution_clock::time_point now = clock.now();
+            double s = duration_cast<duration<double>>(now-lastReport).count();
+            std::cout << "step " << _step << ": " << reportInterval/s << " steps/s\n";
+            lastReport = now;
+        }
+
+        if (checkpointInterval > 0 && _step/checkpointInterval != (_step-n)/checkpointInterval)
+            Checkpoint::Save(checkpointPath,_simulation,_step);
+    }
+
+    Result result;
+    result.steps = steps;
+    result.updates = updates;
+    result.seconds = duration_cast<duration<double>>(clock.now()-start).count();
+    return result;
+}
@@ -0,0 +1,107 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#ifndef BATCHRUNNER_H
+#define BATCHRUNNER_H
+
+#include "platform_includes.h"
+#include "SimulationState.h"
+#include "Simulation/FluidSimulation.h"
+#include "Simulation/TemporalBlocking.h"
+#include "Simulation/AdaptiveStepper.h"
+
+#include <string>
+#include <vector>
+#include <utility>
+
+namespace Simulation {
+
+/// Set of step intervals [begin,end) during which an effect (rain, flood) is active.
+class StepSchedule
+{
+public:
+    StepSchedule() {}
+
+    /// Parses a comma separated list of intervals, e.g. "0:500,1000:1200".
+    /// A single number "n" activates only step n, "n:" is open ended.
+    static StepSchedule Parse(const std::string& text);
+
+    /// Schedule that is active for every step.
+    static StepSchedule Always();
+
+    void add(ulong begin, ulong end);
+
+    bool active(ulong step) const;
+
+    bool empty() const { return _intervals.empty(); }
+
+protected:
+    std::vector< std::pair<ulong,ulong> > _intervals;
+};
+
+/// Drives a FluidSimulation without any windowing or rendering.
+class BatchRunner
+{
+public:
+    struct Result
+    {
+        ulong steps;
+        ulong updates;      /// FluidSimulation::update() calls (substeps)
+        double seconds;
+
+        double stepsPerSecond() const { return seconds > 0.0 ? steps/seconds : 0.0; }
+        double cellsPerSecond(uint cells) const { return stepsPerSecond()*cells; }
+    };
+
+    BatchRunner(SimulationState& state, FluidSimulation& simulation);
+
+    StepSchedule rain;
+    StepSchedule flood;
+
+    /// Position of the flood source in grid coordinates.
+    glm::vec2 floodPos;
+
+    /// Timestep passed to FluidSimulation::update (in milliseconds).
+    double dt;
+
+    /// Print progress every n steps (0 disables progress output).
+    ulong reportInterval;
+
+    /// Writes a Checkpoint to checkpointPath whenever the step count
+    /// reaches a multiple of checkpointInterval (0 disables checkpoints).
+    ulong checkpointInterval;
+    std::string checkpointPath;
+
+    /// Advances blocking->steps steps at once if set (default: none).
+    TemporalBlocking* blocking;
+
+    /// Simulates dt per step in stable substeps if set (default: none),
+    /// takes precedence over blocking.
+    AdaptiveStepper* stepper;
+
+    /// Runs the given number of steps as fast as possible.
+    Result run(ulong steps);
+
+    /// Steps run so far, the schedules and checkpoints count from it.
+    ulong step() const { return _step; }
+
+    /// Continues the step count, e.g. with the step Checkpoint::Load() returned.
+    void setStep(ulong step) { _step = step; }
+
+protected:
+    SimulationState& _state;
+    FluidSimulation& _simulation;
+    ulong _step;
+};
+
+} // namespace Simulation
+
+#endif // BATCHRUNNER_H
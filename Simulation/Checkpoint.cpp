@@ -0,0 +1,474 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#include "Checkpoint.h"
+#include "Exception.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace Simulation;
+
+namespace {
+
+const char Magic[8] = { 'T','F','S','T','A','T','E','\0' };
+const uint32_t ByteOrder = 0x01020304;
+
+/// Grid data per write of Save(), the blocks are spread over the workers.
+const size_t BlockBytes = size_t(4) << 20;
+
+struct Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;         /// ByteOrder as written by the saving machine
+    uint64_t alignment;
+    uint64_t fileBytes;
+    uint64_t step;
+    uint32_t width;
+    uint32_t height;
+    float rainPos[2];
+    float maxVelocity;
+    uint32_t staggeredFluxes;
+    uint32_t halfFields;
+    uint32_t gridCount;         /// GridEntry records after the header
+    uint64_t rainOffset;        /// FluidSimulation::rainState() as text
+    uint64_t rainBytes;
+};
+
+struct GridEntry
+{
+    char name[24];
+    uint32_t elementBytes;
+    uint32_t padded;            /// a PaddedGrid2D, halo to policy are valid
+    uint32_t width;
+    uint32_t height;
+    uint32_t halo;
+    uint32_t pitch;
+    uint32_t origin;
+    uint32_t policy;
+    uint64_t offset;
+    uint64_t bytes;             /// 0 for empty grids
+};
+
+uint64_t RoundUp(uint64_t value, uint64_t multiple)
+{
+    return (value+multiple-1)/multiple*multiple;
+}
+
+void Fail(const std::string& what, const std::string& path, int error)
+{
+    throw Exception(what + " '" + path + "': " + strerror(error));
+}
+
+bool WriteAll(int fd, const char* data, size_t bytes, uint64_t offset)
+{
+    while (bytes > 0)
+    {
+        ssize_t n = pwrite(fd,data,bytes,offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        bytes -= n;
+        offset += n;
+    }
+    return true;
+}
+
+bool ReadAll(int fd, char* data, size_t bytes, uint64_t offset)
+{
+    while (bytes > 0)
+    {
+        ssize_t n = pread(fd,data,bytes,offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        bytes -= n;
+        offset += n;
+    }
+    return true;
+}
+
+/// Calls visit(name,grid) for every grid of a checkpoint, in file order.
+template<typename VISITOR>
+void VisitGrids(FluidSimulation& s, VISITOR& visit)
+{
+    visit("water",s.state.water);
+    visit("terrain",s.state.terrain);
+    visit("suspendedSediment",s.state.suspendedSediment);
+    visit("surfaceNormals",s.state.surfaceNormals);
+    visit("uVel",s.uVel);
+    visit("vVel",s.vVel);
+    visit("lFlux",s.lFlux);
+    visit("rFlux",s.rFlux);
+    visit("tFlux",s.tFlux);
+    visit("bFlux",s.bFlux);
+    visit("xFlux",s.xFlux);
+    visit("yFlux",s.yFlux);
+    visit("uVelHalf",s.uVelHalf);
+    visit("vVelHalf",s.vVelHalf);
+}
+
+template<typename T>
+const char* Describe(const Grid2D<T>& grid, GridEntry& entry)
+{
+    entry.elementBytes = sizeof(T);
+    entry.width = grid.width();
+    entry.height = grid.height();
+    entry.bytes = grid.size() ? grid.storageSize()*sizeof(T) : 0;
+    return entry.bytes ? reinterpret_cast<const char*>(grid.ptr()) : 0;
+}
+
+template<typename T>
+const char* Describe(const PaddedGrid2D<T>& grid, GridEntry& entry)
+{
+    entry.elementBytes = sizeof(T);
+    entry.padded = 1;
+    entry.width = grid.width();
+    entry.height = grid.height();
+    entry.halo = grid.halo();
+    entry.pitch = grid.pitch();
+    entry.origin = grid.origin();
+    entry.policy = uint32_t(grid.policy());
+    entry.bytes = grid.size() ? grid.storageSize()*sizeof(T) : 0;
+    return entry.bytes ? reinterpret_cast<const char*>(grid.storage()) : 0;
+}
+
+/// Table of the grids and their storage, for Save().
+struct GridTable
+{
+    std::vector<GridEntry> entries;
+    std::vector<const char*> data;
+
+    template<typename GRID>
+    void operator()(const char* name, const GRID& grid)
+    {
+        GridEntry entry;
+        memset(&entry,0,sizeof(entry));
+        strncpy(entry.name,name,sizeof(entry.name)-1);
+        data.push_back(Describe(grid,entry));
+        entries.push_back(entry);
+    }
+};
+
+/// Bytes of the storage of a w x h grid as the entry describes it, 0 if the
+/// shape is inconsistent.
+uint64_t StorageBytes(const GridEntry& entry, size_t elementBytes, bool padded)
+{
+    if (entry.elementBytes != elementBytes || bool(entry.padded) != padded)
+        return 0;
+    const uint64_t w = entry.width, h = entry.height;
+    if (!padded)
+        return w*h*elementBytes;
+
+    // every interior and halo cell lies in the storage
+    const uint64_t halo = entry.halo, pitch = entry.pitch;
+    const uint64_t rows = h+2*halo;
+    if (entry.policy > uint32_t(BoundaryPolicy::Periodic) || pitch < w+2*halo ||
+        entry.origin < halo*pitch+halo || entry.origin+(h+halo-1)*pitch+w+halo > rows*pitch)
+        return 0;
+    return rows*pitch*elementBytes;
+}
+
+/// Maps the grids of a checkpoint, then lets the grids adopt the mappings.
+/// Unmaps whatever was not adopted on destruction, so a failed Load()
+/// leaves the simulation untouched.
+class GridRestore
+{
+public:
+    GridRestore(const std::string& path, int fd, uint64_t fileBytes, const Header& header,
+                const std::vector<GridEntry>& entries)
+        : _path(path), _fd(fd), _fileBytes(fileBytes), _header(header), _entries(entries),
+          _pageSize(sysconf(_SC_PAGESIZE)), _adopting(false), _next(0)
+    {}
+
+    ~GridRestore()
+    {
+        for (size_t i=_next; i<_mappings.size(); i++)
+        {
+            if (_mappings[i].memory)
+                munmap(_mappings[i].memory,_mappings[i].mappedBytes);
+        }
+    }
+
+    /// Switches from mapping to adopting, every grid is visited once in
+    /// each phase in the same order.
+    void adopt() { _adopting = true; _next = 0; }
+
+    template<typename T>
+    void operator()(const char* name, Grid2D<T>& grid)
+    {
+        if (!_adopting)
+        {
+            map(name,sizeof(T),false);
+            return;
+        }
+        Mapping& m = _mappings[_next++];
+        if (m.memory)
+            grid.adopt(m.entry->width,m.entry->height,static_cast<T*>(m.memory),m.mappedBytes);
+        else
+            grid.resize(0,0);
+    }
+
+    template<typename T>
+    void operator()(const char* name, PaddedGrid2D<T>& grid)
+    {
+        if (!_adopting)
+        {
+            map(name,sizeof(T),true);
+            return;
+        }
+        Mapping& m = _mappings[_next++];
+        const GridEntry& e = *m.entry;
+        if (m.memory)
+            grid.adopt(e.width,e.height,e.halo,e.pitch,e.origin,BoundaryPolicy(e.policy),static_cast<T*>(m.memory),m.mappedBytes);
+        else
+            grid.resize(0,0);
+    }
+
+protected:
+    struct Mapping
+    {
+        const GridEntry* entry;
+        void* memory;           /// 0 for empty grids
+        size_t mappedBytes;
+    };
+
+    void map(const char* name, size_t elementBytes, bool padded)
+    {
+        const GridEntry* entry = 0;
+        for (const GridEntry& e : _entries)
+        {
+            if (strncmp(e.name,name,sizeof(e.name)) == 0)
+                entry = &e;
+        }
+        if (!entry)
+            throw Exception("Checkpoint '" + _path + "' has no grid '" + name + "'.");
+
+        Mapping m = { entry, 0, 0 };
+        if (entry->bytes == 0)
+        {
+            _mappings.push_back(m);
+            return;
+        }
+
+        if (entry->width != _header.width || entry->height != _header.height ||
+            entry->bytes != StorageBytes(*entry,elementBytes,padded) ||
+            entry->offset % Checkpoint::Alignment != 0 || entry->offset+entry->bytes > _fileBytes)
+            throw Exception("Checkpoint '" + _path + "' has an invalid grid '" + name + "'.");
+
+        m.mappedBytes = RoundUp(entry->bytes,_pageSize);
+        if (entry->offset % _pageSize == 0)
+        {
+            m.memory = mmap(0,m.mappedBytes,PROT_READ|PROT_WRITE,MAP_PRIVATE,_fd,entry->offset);
+            if (m.memory == MAP_FAILED)
+                Fail("Cannot map checkpoint",_path,errno);
+        }
+        else
+        {
+            // pages larger than the alignment, read into anonymous memory
+            m.memory = mmap(0,m.mappedBytes,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANON,-1,0);
+            if (m.memory == MAP_FAILED)
+                Fail("Cannot allocate memory for checkpoint",_path,errno);
+            if (!ReadAll(_fd,static_cast<char*>(m.memory),entry->bytes,entry->offset))
+            {
+                int error = errno;
+                munmap(m.memory,m.mappedBytes);
+                Fail("Cannot read checkpoint",_path,error);
+            }
+        }
+        _mappings.push_back(m);
+    }
+
+    const std::string& _path;
+    const int _fd;
+    const uint64_t _fileBytes;
+    const Header& _header;
+    const std::vector<GridEntry>& _entries;
+    const uint64_t _pageSize;
+    bool _adopting;
+    size_t _next;               /// mappings before it were adopted
+    std::vector<Mapping> _mappings;
+};
+
+} // namespace
+
+void Checkpoint::Save(const std::string& path, FluidSimulation& simulation, ulong step)
+{
+    GridTable table;
+    VisitGrids(simulation,table);
+    const std::string rain = FluidSimulation::rainState();
+
+    Header header;
+    memset(&header,0,sizeof(header));
+    memcpy(header.magic,Magic,sizeof(Magic));
+    header.version = Version;
+    header.byteOrder = ByteOrder;
+    header.alignment = Alignment;
+    header.step = step;
+    header.width = simulation.water.width();
+    header.height = simulation.water.height();
+    header.rainPos[0] = simulation.rainPos.x;
+    header.rainPos[1] = simulation.rainPos.y;
+    header.maxVelocity = simulation._maxVelocity;
+    header.staggeredFluxes = simulation._staggeredFluxes;
+    header.halfFields = simulation._halfFields;
+    header.gridCount = table.entries.size();
+    header.rainOffset = sizeof(Header) + table.entries.size()*sizeof(GridEntry);
+    header.rainBytes = rain.size();
+
+    // grids at aligned offsets after the header
+    uint64_t offset = RoundUp(header.rainOffset+header.rainBytes,Alignment);
+    for (GridEntry& entry : table.entries)
+    {
+        if (entry.bytes == 0) continue;
+        entry.offset = offset;
+        offset += RoundUp(entry.bytes,Alignment);
+    }
+    header.fileBytes = offset;
+
+    std::vector<char> head(header.rainOffset+header.rainBytes);
+    memcpy(&head[0],&header,sizeof(header));
+    memcpy(&head[sizeof(header)],&table.entries[0],table.entries.size()*sizeof(GridEntry));
+    memcpy(&head[header.rainOffset],rain.data(),rain.size());
+
+    // the header and the grids in blocks, written by all workers
+    struct Block
+    {
+        const char* data;
+        size_t bytes;
+        uint64_t offset;
+    };
+    std::vector<Block> blocks;
+    Block headBlock = { &head[0], head.size(), 0 };
+    blocks.push_back(headBlock);
+    for (size_t i=0; i<table.entries.size(); i++)
+    {
+        const GridEntry& entry = table.entries[i];
+        for (uint64_t done=0; done<entry.bytes; done+=BlockBytes)
+        {
+            Block block = { table.data[i]+done, size_t(std::min<uint64_t>(BlockBytes,entry.bytes-done)), entry.offset+done };
+            blocks.push_back(block);
+        }
+    }
+
+    const std::string temp = path + ".tmp";
+    int fd = open(temp.c_str(),O_WRONLY|O_CREAT|O_TRUNC,0644);
+    if (fd < 0)
+        Fail("Cannot write checkpoint",temp,errno);
+
+    std::atomic<int> error(0);
+    if (ftruncate(fd,header.fileBytes) != 0)
+        error = errno;
+    if (!error)
+    {
+        Parallel::For(blocks.size(),Schedule::Dynamic,1,[&](int begin, int end)
+        {
+            for (int i=begin; i<end; ++i)
+            {
+                if (!WriteAll(fd,blocks[i].data,blocks[i].bytes,blocks[i].offset))
+                    error = errno ? errno : EIO;
+            }
+        });
+    }
+    if (!error && fsync(fd) != 0)
+        error = errno;
+    if (close(fd) != 0 && !error)
+        error = errno;
+    if (error)
+    {
+        unlink(temp.c_str());
+        Fail("Cannot write checkpoint",temp,error);
+    }
+
+    // replaces the previous checkpoint only once the new one is complete,
+    // grids that mapped it keep the old file
+    if (rename(temp.c_str(),path.c_str()) != 0)
+    {
+        int renameError = errno;
+        unlink(temp.c_str());
+        Fail("Cannot replace checkpoint",path,renameError);
+    }
+}
+
+ulong Checkpoint::Load(const std::string& path, FluidSimulation& simulation)
+{
+    int fd = open(path.c_str(),O_RDONLY);
+    if (fd < 0)
+        Fail("Cannot open checkpoint",path,errno);
+
+    // the mappings stay valid after the file is closed
+    struct File
+    {
+        int fd;
+        ~File() { close(fd); }
+    } file = { fd };
+
+    struct stat info;
+    if (fstat(fd,&info) != 0)
+        Fail("Cannot read checkpoint",path,errno);
+
+    Header header;
+    if (!ReadAll(fd,reinterpret_cast<char*>(&header),sizeof(header),0) || memcmp(header.magic,Magic,sizeof(Magic)) != 0)
+        throw Exception("'" + path + "' is not a checkpoint.");
+    if (header.byteOrder != ByteOrder)
+        throw Exception("Checkpoint '" + path + "' was written on a machine of another byte order.");
+    if (header.version != Version)
+    {
+        std::ostringstream message;
+        message << "Checkpoint '" << path << "' has version " << header.version << ", expected " << Version << ".";
+        throw Exception(message.str());
+    }
+    if (header.fileBytes > uint64_t(info.st_size))
+        throw Exception("Checkpoint '" + path + "' is truncated.");
+    if (header.width != simulation.water.width() || header.height != simulation.water.height())
+    {
+        std::ostringstream message;
+        message << "Checkpoint '" << path << "' is " << header.width << "x" << header.height
+                << ", the simulation " << simulation.water.width() << "x" << simulation.water.height() << ".";
+        throw Exception(message.str());
+    }
+
+    std::vector<GridEntry> entries(header.gridCount);
+    std::string rain(header.rainBytes,'\0');
+    if (header.rainOffset < sizeof(Header)+entries.size()*sizeof(GridEntry) ||
+        header.rainOffset+header.rainBytes > header.fileBytes ||
+        (!entries.empty() && !ReadAll(fd,reinterpret_cast<char*>(&entries[0]),entries.size()*sizeof(GridEntry),sizeof(Header))) ||
+        (!rain.empty() && !ReadAll(fd,&rain[0],rain.size(),header.rainOffset)))
+        throw Exception("Checkpoint '" + path + "' is truncated.");
+
+    // everything that can fail before the first grid changes
+    GridRestore restore(path,fd,header.fileBytes,header,entries);
+    VisitGrids(simulation,restore);
+    FluidSimulation::setRainState(rain);
+
+    restore.adopt();
+    VisitGrids(simulation,restore);
+
+    simulation.rainPos = glm::vec2(header.rainPos[0],header.rainPos[1]);
+    simulation._maxVelocity = header.maxVelocity;
+    simulation._staggeredFluxes = header.staggeredFluxes != 0;
+    simulation._halfFields = header.halfFields != 0;
+
+    // the tiles and the changed rows are not saved, all are rescanned
+    simulation.activeTiles.invalidate();
+    simulation.invalidateSurfaceNormals();
+
+    return header.step;
+}
@@ -0,0 +1,67 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "platform_includes.h"
+#include "Simulation/FluidSimulation.h"
+
+#include <stdint.h>
+#include <string>
+
+namespace Simulation {
+
+/// Saves and restores the complete state of a FluidSimulation and its
+/// SimulationState, so a restored run continues bit-identically (see
+/// Tests/CheckpointTests.cpp).
+///
+/// The file starts with a header: the version, the step, the flux model,
+/// rainPos, maxVelocity() and the state of the random rain drops, followed
+/// by a table of the grids. Every grid follows at a multiple of Alignment
+/// bytes as its raw storage, halo and row padding included. Grids of a flux
+/// model that is not in use are empty and take no space. Scratch grids
+/// (back buffers, terrain slope) are rebuilt by the passes and not saved.
+///
+/// Save() writes the grids in blocks on all workers (see Parallel) into a
+/// temporary file and renames it over path once it is complete, so a crash
+/// leaves the previous checkpoint intact. Load() maps every grid privately
+/// and lets the grids adopt the mappings (Grid2D::adopt()) without copying:
+/// pages are read when they are first touched and copied when they are
+/// first written. The files use the byte order of the machine.
+///
+/// The options (staggered, halfPrecision, fused, sparse, kernel variants)
+/// are not saved, the restored run has to use the same ones to continue
+/// bit-identically. Other staggered or halfPrecision settings convert the
+/// fluxes in the next step.
+class Checkpoint
+{
+public:
+    static const uint32_t Version = 2;
+
+    /// Offsets of the grids, a multiple of the 4, 16 and 64 KB pages of
+    /// common systems, which mmap() needs.
+    static const size_t Alignment = size_t(64) << 10;
+
+    /// Writes the state of simulation after step steps to path. Throws an
+    /// Exception if the file cannot be written.
+    static void Save(const std::string& path, FluidSimulation& simulation, ulong step);
+
+    /// Restores the state of simulation (and its SimulationState) from path,
+    /// returns the step it was saved after. Throws an Exception if the file
+    /// cannot be read, has another version or another grid size, the
+    /// simulation is unchanged then.
+    static ulong Load(const std::string& path, FluidSimulation& simulation);
+};
+
+} // namespace Simulation
+
+#endif // CHECKPOINT_H
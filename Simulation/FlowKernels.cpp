@@ -0,0 +1,863 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#include "Kernels.h"
+
+#include <algorithm>
+#include <cfloat>
+
+#if defined(KERNELS_X86)
+#include <immintrin.h>
+#endif
+
+using namespace Simulation;
+using namespace Simulation::Kernels;
+
+// Hand vectorized flow and terrain slope kernels, the scalar reference is
+// in Kernels.cpp.
+
+#if defined(KERNELS_X86)
+
+// AVX2
+//////////////////////////////////////////////
+
+namespace {
+
+/// Loads 8 floats, the masked variant only touches lanes set in the mask.
+template<bool MASKED>
+AVX2_TARGET inline __m256 Load8(const float* p, __m256i mask)
+{
+    return MASKED ? _mm256_maskload_ps(p,mask) : _mm256_loadu_ps(p);
+}
+
+template<bool MASKED>
+AVX2_TARGET inline void Store8(float* p, __m256i mask, __m256 v)
+{
+    if (MASKED) _mm256_maskstore_ps(p,mask,v);
+    else _mm256_storeu_ps(p,v);
+}
+
+/// Half precision loads and stores. There are no 16 bit masked loads in
+/// AVX2, the tail goes through a buffer (the mask selects the first lanes).
+template<bool MASKED>
+AVX2_TARGET inline __m256 Load8(const Half* p, __m256i mask)
+{
+    if (!MASKED)
+        return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+    Half buffer[8] = {};
+    std::copy(p,p+__builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(mask))),buffer);
+    return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(buffer)));
+}
+
+template<bool MASKED>
+AVX2_TARGET inline void Store8(Half* p, __m256i mask, __m256 v)
+{
+    __m128i h = _mm256_cvtps_ph(v,_MM_FROUND_TO_NEAREST_INT);
+    if (!MASKED)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p),h);
+        return;
+    }
+    Half buffer[8];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(buffer),h);
+    std::copy(buffer,buffer+__builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(mask))),p);
+}
+
+/// 1/x from the hardware estimate refined by one Newton-Raphson step. x is
+/// clamped to FLT_MIN (also NaN), below it the estimate overflows to inf and
+/// the refinement gives -inf or NaN. Within 1e-6 of 1/x otherwise.
+AVX2_TARGET inline __m256 Reciprocal8(__m256 x)
+{
+    x = _mm256_max_ps(x,_mm256_set1_ps(FLT_MIN));
+    __m256 r = _mm256_rcp_ps(x);
+    return _mm256_mul_ps(r, _mm256_fnmadd_ps(x, r, _mm256_set1_ps(2.0f)));
+}
+
+template<bool MASKED>
+AVX2_TARGET inline void OutflowFlux8(const float* tRow, const float* tRowT, const float* tRowB,
+                                     const float* wRow, const float* wRowT, const float* wRowB,
+                                     float* lRow, float* rRow, float* tRowF, float* bRowF,
+                                     __m256 fluxFactor, __m256 area, __m256 dt, int x, __m256i mask)
+{
+    const __m256 zero = _mm256_setzero_ps();
+
+    __m256 water = Load8<MASKED>(wRow+x,mask);
+    __m256 h0 = _mm256_add_ps(Load8<MASKED>(tRow+x,mask), water);
+
+    __m256 hl = _mm256_add_ps(Load8<MASKED>(tRow+x-1,mask), Load8<MASKED>(wRow+x-1,mask));
+    __m256 hr = _mm256_add_ps(Load8<MASKED>(tRow+x+1,mask), Load8<MASKED>(wRow+x+1,mask));
+    __m256 hb = _mm256_add_ps(Load8<MASKED>(tRowB+x,mask), Load8<MASKED>(wRowB+x,mask));
+    __m256 ht = _mm256_add_ps(Load8<MASKED>(tRowT+x,mask), Load8<MASKED>(wRowT+x,mask));
+
+    __m256 fl = _mm256_max_ps(zero, _mm256_fmadd_ps(fluxFactor, _mm256_sub_ps(h0,hl), Load8<MASKED>(lRow+x,mask)));
+    __m256 fr = _mm256_max_ps(zero, _mm256_fmadd_ps(fluxFactor, _mm256_sub_ps(h0,hr), Load8<MASKED>(rRow+x,mask)));
+    __m256 fb = _mm256_max_ps(zero, _mm256_fmadd_ps(fluxFactor, _mm256_sub_ps(h0,hb), Load8<MASKED>(bRowF+x,mask)));
+    __m256 ft = _mm256_max_ps(zero, _mm256_fmadd_ps(fluxFactor, _mm256_sub_ps(h0,ht), Load8<MASKED>(tRowF+x,mask)));
+
+    // K = min(1, water*dx*dy/(sumFlux*dt)). Without outflow the divisor is
+    // clamped to FLT_MIN, the quotient is far above 1 (or inf) and min caps K
+    // at 1 in a wet cell, a dry cell gets K=0. The fluxes are zero either way.
+    __m256 sumFlux = _mm256_add_ps(_mm256_add_ps(fl,fr),_mm256_add_ps(fb,ft));
+    __m256 K = _mm256_mul_ps(_mm256_mul_ps(water,area), Reciprocal8(_mm256_mul_ps(sumFlux,dt)));
+    K = _mm256_min_ps(K, _mm256_set1_ps(1.0f));
+
+    Store8<MASKED>(lRow+x, mask, _mm256_mul_ps(fl,K));
+    Store8<MASKED>(rRow+x, mask, _mm256_mul_ps(fr,K));
+    Store8<MASKED>(bRowF+x, mask, _mm256_mul_ps(fb,K));
+    Store8<MASKED>(tRowF+x, mask, _mm256_mul_ps(ft,K));
+}
+
+/// Largest of the 8 lanes.
+AVX2_TARGET inline float HorizontalMax8(__m256 v)
+{
+    __m128 m = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v,1));
+    m = _mm_max_ps(m, _mm_movehl_ps(m,m));
+    m = _mm_max_ss(m, _mm_shuffle_ps(m,m,1));
+    return _mm_cvtss_f32(m);
+}
+
+/// Returns max(|u|,|v|) per lane, zero in the lanes outside of the mask.
+template<bool MASKED, typename S>
+AVX2_TARGET inline __m256 WaterVelocity8(const float* lRow, const float* rRow, const float* tRowF, const float* bRowF,
+                                       const float* tRowB, const float* bRowT,
+                                       float* wRow, S* uRow, S* vRow,
+                                       __m256 dt, __m256 invArea, __m256 dx, __m256 dy, int x, __m256i mask)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 half = _mm256_set1_ps(0.5f);
+
+    __m256 rL = Load8<MASKED>(rRow+x-1,mask);     // right outflow of the left neighbour
+    __m256 lR = Load8<MASKED>(lRow+x+1,mask);     // left outflow of the right neighbour
+    __m256 tB = Load8<MASKED>(tRowB+x,mask);
+    __m256 bT = Load8<MASKED>(bRowT+x,mask);
+    __m256 r = Load8<MASKED>(rRow+x,mask);
+    __m256 l = Load8<MASKED>(lRow+x,mask);
+    __m256 t = Load8<MASKED>(tRowF+x,mask);
+    __m256 b = Load8<MASKED>(bRowF+x,mask);
+
+    __m256 inFlow = _mm256_add_ps(_mm256_add_ps(rL,lR),_mm256_add_ps(tB,bT));
+    __m256 outFlow = _mm256_add_ps(_mm256_add_ps(r,l),_mm256_add_ps(t,b));
+    __m256 dV = _mm256_mul_ps(dt,_mm256_sub_ps(inFlow,outFlow));
+
+    __m256 oldWater = Load8<MASKED>(wRow+x,mask);
+    __m256 newWater = _mm256_max_ps(_mm256_fmadd_ps(dV,invArea,oldWater),zero);
+    Store8<MASKED>(wRow+x,mask,newWater);
+
+    __m256 meanWater = _mm256_mul_ps(half,_mm256_add_ps(oldWater,newWater));
+    const __m256 minDepth = _mm256_set1_ps(FLT_MIN);
+
+    __m256 du = _mm256_sub_ps(_mm256_add_ps(rL,r),_mm256_add_ps(l,lR));
+    __m256 dv = _mm256_sub_ps(_mm256_add_ps(tB,t),_mm256_add_ps(b,bT));
+    __m256 uDepth = _mm256_mul_ps(dy,meanWater);
+    __m256 vDepth = _mm256_mul_ps(dx,meanWater);
+    __m256 u = _mm256_mul_ps(_mm256_mul_ps(half,du), Reciprocal8(uDepth));
+    __m256 v = _mm256_mul_ps(_mm256_mul_ps(half,dv), Reciprocal8(vDepth));
+
+    // (near) dry cells have no velocity, as in the scalar kernels
+    u = _mm256_and_ps(u,_mm256_cmp_ps(uDepth,minDepth,_CMP_GE_OQ));
+    v = _mm256_and_ps(v,_mm256_cmp_ps(vDepth,minDepth,_CMP_GE_OQ));
+    Store8<MASKED>(uRow+x,mask,u);
+    Store8<MASKED>(vRow+x,mask,v);
+
+    // masked lanes load zero water and are dry
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    return _mm256_max_ps(_mm256_andnot_ps(sign,u),_mm256_andnot_ps(sign,v));
+}
+
+AVX2_TARGET inline __m256i TailMask8(int remaining)
+{
+    const __m256i lanes = _mm256_setr_epi32(0,1,2,3,4,5,6,7);
+    return _mm256_cmpgt_epi32(_mm256_set1_epi32(remaining),lanes);
+}
+
+AVX2_TARGET inline void OutflowFluxRow8(const Fields& f, const Params& p, int y, int x0, int x1)
+{
+    const float* tRow = f.terrain->row(y);
+    const float* tRowT = f.terrain->row(y+1);
+    const float* tRowB = f.terrain->row(y-1);
+    const float* wRow = f.water->row(y);
+    const float* wRowT = f.water->row(y+1);
+    const float* wRowB = f.water->row(y-1);
+    float* lRow = f.lFlux->row(y);
+    float* rRow = f.rFlux->row(y);
+    float* tRowF = f.tFlux->row(y);
+    float* bRowF = f.bFlux->row(y);
+
+    const __m256 fluxFactor = _mm256_set1_ps(p.fluxFactor);
+    const __m256 area = _mm256_set1_ps(p.dx*p.dy);
+    const __m256 dt = _mm256_set1_ps(float(p.dt));
+    const __m256i all = _mm256_set1_epi32(-1);
+
+    int x = x0;
+    for (; x+8<=x1; x+=8)
+        OutflowFlux8<false>(tRow,tRowT,tRowB,wRow,wRowT,wRowB,lRow,rRow,tRowF,bRowF,fluxFactor,area,dt,x,all);
+    if (x < x1)
+        OutflowFlux8<true>(tRow,tRowT,tRowB,wRow,wRowT,wRowB,lRow,rRow,tRowF,bRowF,fluxFactor,area,dt,x,TailMask8(x1-x));
+}
+
+template<typename S>
+AVX2_TARGET inline float WaterVelocityRow8(const Fields& f, const Params& p, int y, int x0, int x1)
+{
+    const float* lRow = f.lFlux->row(y);
+    const float* rRow = f.rFlux->row(y);
+    const float* tRowF = f.tFlux->row(y);
+    const float* bRowF = f.bFlux->row(y);
+    const float* tRowB = f.tFlux->row(y-1);
+    const float* bRowT = f.bFlux->row(y+1);
+    float* wRow = f.water->row(y);
+    S* uRow = &(*Storage<S>::Pick(f.uVel,f.uVelHalf))(y,0);
+    S* vRow = &(*Storage<S>::Pick(f.vVel,f.vVelHalf))(y,0);
+
+    const __m256 dt = _mm256_set1_ps(float(p.dt));
+    const __m256 invArea = _mm256_set1_ps(1.0f/(p.dx*p.dy));
+    const __m256 dx = _mm256_set1_ps(p.dx);
+    const __m256 dy = _mm256_set1_ps(p.dy);
+    const __m256i all = _mm256_set1_epi32(-1);
+
+    __m256 speed = _mm256_setzero_ps();
+    int x = x0;
+    for (; x+8<=x1; x+=8)
+        speed = _mm256_max_ps(speed,WaterVelocity8<false>(lRow,rRow,tRowF,bRowF,tRowB,bRowT,wRow,uRow,vRow,dt,invArea,dx,dy,x,all));
+    if (x < x1)
+        speed = _mm256_max_ps(speed,WaterVelocity8<true>(lRow,rRow,tRowF,bRowF,tRowB,bRowT,wRow,uRow,vRow,dt,invArea,dx,dy,x,TailMask8(x1-x)));
+    return HorizontalMax8(speed);
+}
+
+} // anonymous namespace
+
+AVX2_TARGET void Kernels::OutflowFluxRowAVX2(const Fields& f, const Params& p, int y, int x0, int x1) { OutflowFluxRow8(f,p,y,x0,x1); }
+AVX2_TARGET float Kernels::WaterVelocityRowAVX2(const Fields& f, const Params& p, int y, int x0, int x1) { return WaterVelocityRow8<float>(f,p,y,x0,x1); }
+AVX2_TARGET float Kernels::WaterVelocityHalfRowAVX2(const Fields& f, const Params& p, int y, int x0, int x1) { return WaterVelocityRow8<Half>(f,p,y,x0,x1); }
+
+namespace {
+
+/// Outflow over an edge before scaling, see EdgeOutflow in Kernels.cpp.
+AVX2_TARGET inline __m256 EdgeOutflow8(__m256 flux, __m256 fluxFactor, __m256 h0, __m256 h1)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    return _mm256_max_ps(zero, _mm256_fmadd_ps(fluxFactor, _mm256_sub_ps(h0,h1), _mm256_max_ps(flux,zero)));
+}
+
+template<bool MASKED>
+AVX2_TARGET inline void EdgeFluxScale8(const float* tRow, const float* tRowT, const float* tRowB,
+                                       const float* wRow, const float* wRowT, const float* wRowB,
+                                       const float* xRow, const float* yRow, const float* yRowB, float* kRow,
+                                       __m256 fluxFactor, __m256 area, __m256 dt, int x, __m256i mask)
+{
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+
+    __m256 water = Load8<MASKED>(wRow+x,mask);
+    __m256 h0 = _mm256_add_ps(Load8<MASKED>(tRow+x,mask), water);
+
+    __m256 hl = _mm256_add_ps(Load8<MASKED>(tRow+x-1,mask), Load8<MASKED>(wRow+x-1,mask));
+    __m256 hr = _mm256_add_ps(Load8<MASKED>(tRow+x+1,mask), Load8<MASKED>(wRow+x+1,mask));
+    __m256 hb = _mm256_add_ps(Load8<MASKED>(tRowB+x,mask), Load8<MASKED>(wRowB+x,mask));
+    __m256 ht = _mm256_add_ps(Load8<MASKED>(tRowT+x,mask), Load8<MASKED>(wRowT+x,mask));
+
+    __m256 fr = EdgeOutflow8(Load8<MASKED>(xRow+x,mask), fluxFactor, h0, hr);
+    __m256 fl = EdgeOutflow8(_mm256_xor_ps(Load8<MASKED>(xRow+x-1,mask),sign), fluxFactor, h0, hl);
+    __m256 ft = EdgeOutflow8(Load8<MASKED>(yRow+x,mask), fluxFactor, h0, ht);
+    __m256 fb = EdgeOutflow8(_mm256_xor_ps(Load8<MASKED>(yRowB+x,mask),sign), fluxFactor, h0, hb);
+
+    // without outflow K is 1 in a wet and 0 in a dry cell, like in OutflowFlux8
+    __m256 sumFlux = _mm256_add_ps(_mm256_add_ps(fl,fr),_mm256_add_ps(fb,ft));
+    __m256 K = _mm256_mul_ps(_mm256_mul_ps(water,area), Reciprocal8(_mm256_mul_ps(sumFlux,dt)));
+    Store8<MASKED>(kRow+x, mask, _mm256_min_ps(K, _mm256_set1_ps(1.0f)));
+}
+
+/// Flux over the edges between the cells x of row 0 and row 1, which are
+/// either the same row shifted by one cell or two neighbouring rows.
+template<bool MASKED>
+AVX2_TARGET inline void EdgeFlux8(const float* tRow0, const float* wRow0, const float* kRow0,
+                                  const float* tRow1, const float* wRow1, const float* kRow1,
+                                  float* fluxRow, __m256 fluxFactor, int x, __m256i mask)
+{
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+
+    __m256 h0 = _mm256_add_ps(Load8<MASKED>(tRow0+x,mask), Load8<MASKED>(wRow0+x,mask));
+    __m256 h1 = _mm256_add_ps(Load8<MASKED>(tRow1+x,mask), Load8<MASKED>(wRow1+x,mask));
+    __m256 flux = Load8<MASKED>(fluxRow+x,mask);
+
+    __m256 out0 = EdgeOutflow8(flux, fluxFactor, h0, h1);
+    __m256 out1 = EdgeOutflow8(_mm256_xor_ps(flux,sign), fluxFactor, h1, h0);
+    Store8<MASKED>(fluxRow+x, mask, _mm256_sub_ps(_mm256_mul_ps(out0,Load8<MASKED>(kRow0+x,mask)),
+                                                  _mm256_mul_ps(out1,Load8<MASKED>(kRow1+x,mask))));
+}
+
+/// Returns max(|u|,|v|) per lane, zero in the lanes outside of the mask.
+template<bool MASKED>
+AVX2_TARGET inline __m256 EdgeWaterVelocity8(const float* xRow, const float* yRow, const float* yRowB,
+                                           float* wRow, float* uRow, float* vRow,
+                                           __m256 dt, __m256 invArea, __m256 dx, __m256 dy, int x, __m256i mask)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 half = _mm256_set1_ps(0.5f);
+
+    __m256 fl = Load8<MASKED>(xRow+x-1,mask);
+    __m256 fr = Load8<MASKED>(xRow+x,mask);
+    __m256 fb = Load8<MASKED>(yRowB+x,mask);
+    __m256 ft = Load8<MASKED>(yRow+x,mask);
+
+    __m256 dV = _mm256_mul_ps(dt,_mm256_add_ps(_mm256_sub_ps(fl,fr),_mm256_sub_ps(fb,ft)));
+
+    __m256 oldWater = Load8<MASKED>(wRow+x,mask);
+    __m256 newWater = _mm256_max_ps(_mm256_fmadd_ps(dV,invArea,oldWater),zero);
+    Store8<MASKED>(wRow+x,mask,newWater);
+
+    __m256 meanWater = _mm256_mul_ps(half,_mm256_add_ps(oldWater,newWater));
+    const __m256 minDepth = _mm256_set1_ps(FLT_MIN);
+
+    __m256 uDepth = _mm256_mul_ps(dy,meanWater);
+    __m256 vDepth = _mm256_mul_ps(dx,meanWater);
+    __m256 u = _mm256_mul_ps(_mm256_mul_ps(half,_mm256_add_ps(fl,fr)), Reciprocal8(uDepth));
+    __m256 v = _mm256_mul_ps(_mm256_mul_ps(half,_mm256_add_ps(fb,ft)), Reciprocal8(vDepth));
+
+    // (near) dry cells have no velocity, as in the scalar kernels
+    u = _mm256_and_ps(u,_mm256_cmp_ps(uDepth,minDepth,_CMP_GE_OQ));
+    v = _mm256_and_ps(v,_mm256_cmp_ps(vDepth,minDepth,_CMP_GE_OQ));
+    Store8<MASKED>(uRow+x,mask,u);
+    Store8<MASKED>(vRow+x,mask,v);
+
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    return _mm256_max_ps(_mm256_andnot_ps(sign,u),_mm256_andnot_ps(sign,v));
+}
+
+} // anonymous namespace
+
+AVX2_TARGET void Kernels::EdgeFluxScaleRowAVX2(const Fields& f, const Params& p, int y, int x0, int x1)
+{
+    const float* tRow = f.terrain->row(y);
+    const float* tRowT = f.terrain->row(y+1);
+    const float* tRowB = f.terrain->row(y-1);
+    const float* wRow = f.water->row(y);
+    const float* wRowT = f.water->row(y+1);
+    const float* wRowB = f.water->row(y-1);
+    const float* xRow = f.xFlux->row(y);
+    const float* yRow = f.yFlux->row(y);
+    const float* yRowB = f.yFlux->row(y-1);
+    float* kRow = &(*f.uVel)(y,0);
+
+    const __m256 fluxFactor = _mm256_set1_ps(p.fluxFactor);
+    const __m256 area = _mm256_set1_ps(p.dx*p.dy);
+    const __m256 dt = _mm256_set1_ps(float(p.dt));
+    const __m256i all = _mm256_set1_epi32(-1);
+
+    int x = x0;
+    for (; x+8<=x1; x+=8)
+        EdgeFluxScale8<false>(tRow,tRowT,tRowB,wRow,wRowT,wRowB,xRow,yRow,yRowB,kRow,fluxFactor,area,dt,x,all);
+    if (x < x1)
+        EdgeFluxScale8<true>(tRow,tRowT,tRowB,wRow,wRowT,wRowB,xRow,yRow,yRowB,kRow,fluxFactor,area,dt,x,TailMask8(x1-x));
+}
+
+AVX2_TARGET void Kernels::EdgeFluxRowAVX2(const Fields& f, const Params& p, int y, int x0, int x1)
+{
+    const int w = f.water->width();
+    const int h = f.water->height();
+
+    const float* tRow = f.terrain->row(y);
+    const float* wRow = f.water->row(y);
+    const float* kRow = &(*f.uVel)(y,0);
+    float* xRow = f.xFlux->row(y);
+
+    const __m256 fluxFactor = _mm256_set1_ps(p.fluxFactor);
+    const __m256i all = _mm256_set1_epi32(-1);
+
+    // right edges, the last column borders the domain
+    const int xEnd = std::min(x1,w-1);
+    int x = x0;
+    for (; x+8<=xEnd; x+=8)
+        EdgeFlux8<false>(tRow,wRow,kRow,tRow+1,wRow+1,kRow+1,xRow,fluxFactor,x,all);
+    if (x < xEnd)
+        EdgeFlux8<true>(tRow,wRow,kRow,tRow+1,wRow+1,kRow+1,xRow,fluxFactor,x,TailMask8(xEnd-x));
+
+    if (y == h-1)
+        return;
+
+    // top edges
+    const float* tRowT = f.terrain->row(y+1);
+    const float* wRowT = f.water->row(y+1);
+    const float* kRowT = &(*f.uVel)(y+1,0);
+    float* yRow = f.yFlux->row(y);
+    for (x=x0; x+8<=x1; x+=8)
+        EdgeFlux8<false>(tRow,wRow,kRow,tRowT,wRowT,kRowT,yRow,fluxFactor,x,all);
+    if (x < x1)
+        EdgeFlux8<true>(tRow,wRow,kRow,tRowT,wRowT,kRowT,yRow,fluxFactor,x,TailMask8(x1-x));
+}
+
+AVX2_TARGET float Kernels::EdgeWaterVelocityRowAVX2(const Fields& f, const Params& p, int y, int x0, int x1)
+{
+    const float* xRow = f.xFlux->row(y);
+    const float* yRow = f.yFlux->row(y);
+    const float* yRowB = f.yFlux->row(y-1);
+    float* wRow = f.water->row(y);
+    float* uRow = &(*f.uVel)(y,0);
+    float* vRow = &(*f.vVel)(y,0);
+
+    const __m256 dt = _mm256_set1_ps(float(p.dt));
+    const __m256 invArea = _mm256_set1_ps(1.0f/(p.dx*p.dy));
+    const __m256 dx = _mm256_set1_ps(p.dx);
+    const __m256 dy = _mm256_set1_ps(p.dy);
+    const __m256i all = _mm256_set1_epi32(-1);
+
+    __m256 speed = _mm256_setzero_ps();
+    int x = x0;
+    for (; x+8<=x1; x+=8)
+        speed = _mm256_max_ps(speed,EdgeWaterVelocity8<false>(xRow,yRow,yRowB,wRow,uRow,vRow,dt,invArea,dx,dy,x,all));
+    if (x < x1)
+        speed = _mm256_max_ps(speed,EdgeWaterVelocity8<true>(xRow,yRow,yRowB,wRow,uRow,vRow,dt,invArea,dx,dy,x,TailMask8(x1-x)));
+    return HorizontalMax8(speed);
+}
+
+namespace {
+
+/// Only exactly rounded operations, so the results match the scalar kernel.
+template<bool MASKED>
+AVX2_TARGET inline void TerrainSlope8(const float* tRow, const float* tRowT, const float* tRowB,
+                                      float* slope, int x, __m256i mask)
+{
+    __m256 gx = _mm256_sub_ps(Load8<MASKED>(tRow+x+1,mask), Load8<MASKED>(tRow+x-1,mask));
+    __m256 gy = _mm256_sub_ps(Load8<MASKED>(tRowT+x,mask), Load8<MASKED>(tRowB+x,mask));
+    __m256 g2 = _mm256_add_ps(_mm256_mul_ps(gx,gx), _mm256_mul_ps(gy,gy));
+    Store8<MASKED>(slope+x, mask, _mm256_sqrt_ps(_mm256_div_ps(g2, _mm256_add_ps(g2,_mm256_set1_ps(4.0f)))));
+}
+
+} // anonymous namespace
+
+AVX2_TARGET void Kernels::TerrainSlopeRowAVX2(const Fields& f, const Params&, int y, int x0, int x1)
+{
+    const float* tRow = f.terrain->row(y);
+    const float* tRowT = f.terrain->row(y+1);
+    const float* tRowB = f.terrain->row(y-1);
+    float* slope = &(*f.slope)(y,0);
+    const __m256i all = _mm256_set1_epi32(-1);
+
+    int x = x0;
+    for (; x+8<=x1; x+=8)
+        TerrainSlope8<false>(tRow,tRowT,tRowB,slope,x,all);
+    if (x < x1)
+        TerrainSlope8<true>(tRow,tRowT,tRowB,slope,x,TailMask8(x1-x));
+}
+
+// AVX-512
+//////////////////////////////////////////////
+
+namespace {
+
+/// Loads 16 floats, the masked variant only touches lanes set in the mask.
+template<bool MASKED>
+AVX512_TARGET inline __m512 Load16(const float* p, __mmask16 m)
+{
+    return MASKED ? _mm512_maskz_loadu_ps(m,p) : _mm512_loadu_ps(p);
+}
+
+template<bool MASKED>
+AVX512_TARGET inline void Store16(float* p, __mmask16 m, __m512 v)
+{
+    if (MASKED) _mm512_mask_storeu_ps(p,m,v);
+    else _mm512_storeu_ps(p,v);
+}
+
+/// Half precision loads and stores, 16 bit masked loads need AVX-512BW, the
+/// tail goes through a buffer like in Load8.
+template<bool MASKED>
+AVX512_TARGET inline __m512 Load16(const Half* p, __mmask16 m)
+{
+    if (!MASKED)
+        return _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+    Half buffer[16] = {};
+    std::copy(p,p+__builtin_popcount(m),buffer);
+    return _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(buffer)));
+}
+
+template<bool MASKED>
+AVX512_TARGET inline void Store16(Half* p, __mmask16 m, __m512 v)
+{
+    __m256i h = _mm512_cvtps_ph(v,_MM_FROUND_TO_NEAREST_INT);
+    if (!MASKED)
+    {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(p),h);
+        return;
+    }
+    Half buffer[16];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(buffer),h);
+    std::copy(buffer,buffer+__builtin_popcount(m),p);
+}
+
+AVX512_TARGET inline __m512 Reciprocal16(__m512 x)
+{
+    x = _mm512_max_ps(x,_mm512_set1_ps(FLT_MIN));
+    __m512 r = _mm512_rcp14_ps(x);
+    return _mm512_mul_ps(r, _mm512_fnmadd_ps(x, r, _mm512_set1_ps(2.0f)));
+}
+
+template<bool MASKED>
+AVX512_TARGET inline void OutflowFlux16(const float* tRow, const float* tRowT, const float* tRowB,
+                                        const float* wRow, const float* wRowT, const float* wRowB,
+                                        float* lRow, float* rRow, float* tRowF, float* bRowF,
+                                        __m512 fluxFactor, __m512 area, __m512 dt, int x, __mmask16 m)
+{
+    const __m512 zero = _mm512_setzero_ps();
+
+    __m512 water = Load16<MASKED>(wRow+x,m);
+    __m512 h0 = _mm512_add_ps(Load16<MASKED>(tRow+x,m), water);
+
+    __m512 hl = _mm512_add_ps(Load16<MASKED>(tRow+x-1,m), Load16<MASKED>(wRow+x-1,m));
+    __m512 hr = _mm512_add_ps(Load16<MASKED>(tRow+x+1,m), Load16<MASKED>(wRow+x+1,m));
+    __m512 hb = _mm512_add_ps(Load16<MASKED>(tRowB+x,m), Load16<MASKED>(wRowB+x,m));
+    __m512 ht = _mm512_add_ps(Load16<MASKED>(tRowT+x,m), Load16<MASKED>(wRowT+x,m));
+
+    __m512 fl = _mm512_max_ps(zero, _mm512_fmadd_ps(fluxFactor, _mm512_sub_ps(h0,hl), Load16<MASKED>(lRow+x,m)));
+    __m512 fr = _mm512_max_ps(zero, _mm512_fmadd_ps(fluxFactor, _mm512_sub_ps(h0,hr), Load16<MASKED>(rRow+x,m)));
+    __m512 fb = _mm512_max_ps(zero, _mm512_fmadd_ps(fluxFactor, _mm512_sub_ps(h0,hb), Load16<MASKED>(bRowF+x,m)));
+    __m512 ft = _mm512_max_ps(zero, _mm512_fmadd_ps(fluxFactor, _mm512_sub_ps(h0,ht), Load16<MASKED>(tRowF+x,m)));
+
+    // K = min(1, water*dx*dy/(sumFlux*dt)), 1 in a wet and 0 in a dry cell
+    // without outflow, see OutflowFlux8
+    __m512 sumFlux = _mm512_add_ps(_mm512_add_ps(fl,fr),_mm512_add_ps(fb,ft));
+    __m512 K = _mm512_mul_ps(_mm512_mul_ps(water,area), Reciprocal16(_mm512_mul_ps(sumFlux,dt)));
+    K = _mm512_min_ps(K, _mm512_set1_ps(1.0f));
+
+    Store16<MASKED>(lRow+x,m,_mm512_mul_ps(fl,K));
+    Store16<MASKED>(rRow+x,m,_mm512_mul_ps(fr,K));
+    Store16<MASKED>(bRowF+x,m,_mm512_mul_ps(fb,K));
+    Store16<MASKED>(tRowF+x,m,_mm512_mul_ps(ft,K));
+}
+
+/// Returns max(|u|,|v|) per lane, zero in the lanes outside of the mask.
+template<bool MASKED, typename S>
+AVX512_TARGET inline __m512 WaterVelocity16(const float* lRow, const float* rRow, const float* tRowF, const float* bRowF,
+                                          const float* tRowB, const float* bRowT,
+                                          float* wRow, S* uRow, S* vRow,
+                                          __m512 dt, __m512 invArea, __m512 dx, __m512 dy, int x, __mmask16 m)
+{
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 half = _mm512_set1_ps(0.5f);
+
+    __m512 rL = Load16<MASKED>(rRow+x-1,m);
+    __m512 lR = Load16<MASKED>(lRow+x+1,m);
+    __m512 tB = Load16<MASKED>(tRowB+x,m);
+    __m512 bT = Load16<MASKED>(bRowT+x,m);
+    __m512 r = Load16<MASKED>(rRow+x,m);
+    __m512 l = Load16<MASKED>(lRow+x,m);
+    __m512 t = Load16<MASKED>(tRowF+x,m);
+    __m512 b = Load16<MASKED>(bRowF+x,m);
+
+    __m512 inFlow = _mm512_add_ps(_mm512_add_ps(rL,lR),_mm512_add_ps(tB,bT));
+    __m512 outFlow = _mm512_add_ps(_mm512_add_ps(r,l),_mm512_add_ps(t,b));
+    __m512 dV = _mm512_mul_ps(dt,_mm512_sub_ps(inFlow,outFlow));
+
+    __m512 oldWater = Load16<MASKED>(wRow+x,m);
+    __m512 newWater = _mm512_max_ps(_mm512_fmadd_ps(dV,invArea,oldWater),zero);
+    Store16<MASKED>(wRow+x,m,newWater);
+
+    __m512 meanWater = _mm512_mul_ps(half,_mm512_add_ps(oldWater,newWater));
+    const __m512 minDepth = _mm512_set1_ps(FLT_MIN);
+
+    __m512 du = _mm512_sub_ps(_mm512_add_ps(rL,r),_mm512_add_ps(l,lR));
+    __m512 dv = _mm512_sub_ps(_mm512_add_ps(tB,t),_mm512_add_ps(b,bT));
+    __m512 uDepth = _mm512_mul_ps(dy,meanWater);
+    __m512 vDepth = _mm512_mul_ps(dx,meanWater);
+    __m512 u = _mm512_mul_ps(_mm512_mul_ps(half,du), Reciprocal16(uDepth));
+    __m512 v = _mm512_mul_ps(_mm512_mul_ps(half,dv), Reciprocal16(vDepth));
+
+    u = _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(uDepth,minDepth,_CMP_GE_OQ),u);
+    v = _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(vDepth,minDepth,_CMP_GE_OQ),v);
+    Store16<MASKED>(uRow+x,m,u);
+    Store16<MASKED>(vRow+x,m,v);
+
+    return _mm512_max_ps(_mm512_abs_ps(u),_mm512_abs_ps(v));
+}
+
+inline __mmask16 TailMask16(int remaining)
+{
+    return __mmask16((1u << remaining) - 1);
+}
+
+AVX512_TARGET inline void OutflowFluxRow16(const Fields& f, const Params& p, int y, int x0, int x1)
+{
+    const float* tRow = f.terrain->row(y);
+    const float* tRowT = f.terrain->row(y+1);
+    const float* tRowB = f.terrain->row(y-1);
+    const float* wRow = f.water->row(y);
+    const float* wRowT = f.water->row(y+1);
+    const float* wRowB = f.water->row(y-1);
+    float* lRow = f.lFlux->row(y);
+    float* rRow = f.rFlux->row(y);
+    float* tRowF = f.tFlux->row(y);
+    float* bRowF = f.bFlux->row(y);
+
+    const __m512 fluxFactor = _mm512_set1_ps(p.fluxFactor);
+    const __m512 area = _mm512_set1_ps(p.dx*p.dy);
+    const __m512 dt = _mm512_set1_ps(float(p.dt));
+
+    int x = x0;
+    for (; x+16<=x1; x+=16)
+        OutflowFlux16<false>(tRow,tRowT,tRowB,wRow,wRowT,wRowB,lRow,rRow,tRowF,bRowF,fluxFactor,area,dt,x,0xFFFF);
+    if (x < x1)
+        OutflowFlux16<true>(tRow,tRowT,tRowB,wRow,wRowT,wRowB,lRow,rRow,tRowF,bRowF,fluxFactor,area,dt,x,TailMask16(x1-x));
+}
+
+template<typename S>
+AVX512_TARGET inline float WaterVelocityRow16(const Fields& f, const Params& p, int y, int x0, int x1)
+{
+    const float* lRow = f.lFlux->row(y);
+    const float* rRow = f.rFlux->row(y);
+    const float* tRowF = f.tFlux->row(y);
+    const float* bRowF = f.bFlux->row(y);
+    const float* tRowB = f.tFlux->row(y-1);
+    const float* bRowT = f.bFlux->row(y+1);
+    float* wRow = f.water->row(y);
+    S* uRow = &(*Storage<S>::Pick(f.uVel,f.uVelHalf))(y,0);
+    S* vRow = &(*Storage<S>::Pick(f.vVel,f.vVelHalf))(y,0);
+
+    const __m512 dt = _mm512_set1_ps(float(p.dt));
+    const __m512 invArea = _mm512_set1_ps(1.0f/(p.dx*p.dy));
+    const __m512 dx = _mm512_set1_ps(p.dx);
+    const __m512 dy = _mm512_set1_ps(p.dy);
+
+    __m512 speed = _mm512_setzero_ps();
+    int x = x0;
+    for (; x+16<=x1; x+=16)
+        speed = _mm512_max_ps(speed,WaterVelocity16<false>(lRow,rRow,tRowF,bRowF,tRowB,bRowT,wRow,uRow,vRow,dt,invArea,dx,dy,x,0xFFFF));
+    if (x < x1)
+        speed = _mm512_max_ps(speed,WaterVelocity16<true>(lRow,rRow,tRowF,bRowF,tRowB,bRowT,wRow,uRow,vRow,dt,invArea,dx,dy,x,TailMask16(x1-x)));
+    return _mm512_reduce_max_ps(speed);
+}
+
+} // anonymous namespace
+
+AVX512_TARGET void Kernels::OutflowFluxRowAVX512(const Fields& f, const Params& p, int y, int x0, int x1) { OutflowFluxRow16(f,p,y,x0,x1); }
+AVX512_TARGET float Kernels::WaterVelocityRowAVX512(const Fields& f, const Params& p, int y, int x0, int x1) { return WaterVelocityRow16<float>(f,p,y,x0,x1); }
+AVX512_TARGET float Kernels::WaterVelocityHalfRowAVX512(const Fields& f, const Params& p, int y, int x0, int x1) { return WaterVelocityRow16<Half>(f,p,y,x0,x1); }
+
+namespace {
+
+/// Outflow over an edge before scaling, see EdgeOutflow in Kernels.cpp.
+AVX512_TARGET inline __m512 EdgeOutflow16(__m512 flux, __m512 fluxFactor, __m512 h0, __m512 h1)
+{
+    const __m512 zero = _mm512_setzero_ps();
+    return _mm512_max_ps(zero, _mm512_fmadd_ps(fluxFactor, _mm512_sub_ps(h0,h1), _mm512_max_ps(flux,zero)));
+}
+
+template<bool MASKED>
+AVX512_TARGET inline void EdgeFluxScale16(const float* tRow, const float* tRowT, const float* tRowB,
+                                       const float* wRow, const float* wRowT, const float* wRowB,
+                                       const float* xRow, const float* yRow, const float* yRowB, float* kRow,
+                                       __m512 fluxFactor, __m512 area, __m512 dt, int x, __mmask16 m)
+{
+    const __m512 zero = _mm512_setzero_ps();
+
+    __m512 water = Load16<MASKED>(wRow+x,m);
+    __m512 h0 = _mm512_add_ps(Load16<MASKED>(tRow+x,m), water);
+
+    __m512 hl = _mm512_add_ps(Load16<MASKED>(tRow+x-1,m), Load16<MASKED>(wRow+x-1,m));
+    __m512 hr = _mm512_add_ps(Load16<MASKED>(tRow+x+1,m), Load16<MASKED>(wRow+x+1,m));
+    __m512 hb = _mm512_add_ps(Load16<MASKED>(tRowB+x,m), Load16<MASKED>(wRowB+x,m));
+    __m512 ht = _mm512_add_ps(Load16<MASKED>(tRowT+x,m), Load16<MASKED>(wRowT+x,m));
+
+    __m512 fr = EdgeOutflow16(Load16<MASKED>(xRow+x,m), fluxFactor, h0, hr);
+    __m512 fl = EdgeOutflow16(_mm512_sub_ps(zero,Load16<MASKED>(xRow+x-1,m)), fluxFactor, h0, hl);
+    __m512 ft = EdgeOutflow16(Load16<MASKED>(yRow+x,m), fluxFactor, h0, ht);
+    __m512 fb = EdgeOutflow16(_mm512_sub_ps(zero,Load16<MASKED>(yRowB+x,m)), fluxFactor, h0, hb);
+
+    // without outflow K is 1 in a wet and 0 in a dry cell, like in OutflowFlux16
+    __m512 sumFlux = _mm512_add_ps(_mm512_add_ps(fl,fr),_mm512_add_ps(fb,ft));
+    __m512 K = _mm512_mul_ps(_mm512_mul_ps(water,area), Reciprocal16(_mm512_mul_ps(sumFlux,dt)));
+    Store16<MASKED>(kRow+x, m, _mm512_min_ps(K, _mm512_set1_ps(1.0f)));
+}
+
+/// Flux over the edges between the cells x of row 0 and row 1, which are
+/// either the same row shifted by one cell or two neighbouring rows.
+template<bool MASKED>
+AVX512_TARGET inline void EdgeFlux16(const float* tRow0, const float* wRow0, const float* kRow0,
+                                  const float* tRow1, const float* wRow1, const float* kRow1,
+                                  float* fluxRow, __m512 fluxFactor, int x, __mmask16 m)
+{
+    const __m512 zero = _mm512_setzero_ps();
+
+    __m512 h0 = _mm512_add_ps(Load16<MASKED>(tRow0+x,m), Load16<MASKED>(wRow0+x,m));
+    __m512 h1 = _mm512_add_ps(Load16<MASKED>(tRow1+x,m), Load16<MASKED>(wRow1+x,m));
+    __m512 flux = Load16<MASKED>(fluxRow+x,m);
+
+    __m512 out0 = EdgeOutflow16(flux, fluxFactor, h0, h1);
+    __m512 out1 = EdgeOutflow16(_mm512_sub_ps(zero,flux), fluxFactor, h1, h0);
+    Store16<MASKED>(fluxRow+x, m, _mm512_sub_ps(_mm512_mul_ps(out0,Load16<MASKED>(kRow0+x,m)),
+                                                  _mm512_mul_ps(out1,Load16<MASKED>(kRow1+x,m))));
+}
+
+/// Returns max(|u|,|v|) per lane, zero in the lanes outside of the mask.
+template<bool MASKED>
+AVX512_TARGET inline __m512 EdgeWaterVelocity16(const float* xRow, const float* yRow, const float* yRowB,
+                                           float* wRow, float* uRow, float* vRow,
+                                           __m512 dt, __m512 invArea, __m512 dx, __m512 dy, int x, __mmask16 m)
+{
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 half = _mm512_set1_ps(0.5f);
+
+    __m512 fl = Load16<MASKED>(xRow+x-1,m);
+    __m512 fr = Load16<MASKED>(xRow+x,m);
+    __m512 fb = Load16<MASKED>(yRowB+x,m);
+    __m512 ft = Load16<MASKED>(yRow+x,m);
+
+    __m512 dV = _mm512_mul_ps(dt,_mm512_add_ps(_mm512_sub_ps(fl,fr),_mm512_sub_ps(fb,ft)));
+
+    __m512 oldWater = Load16<MASKED>(wRow+x,m);
+    __m512 newWater = _mm512_max_ps(_mm512_fmadd_ps(dV,invArea,oldWater),zero);
+    Store16<MASKED>(wRow+x,m,newWater);
+
+    __m512 meanWater = _mm512_mul_ps(half,_mm512_add_ps(oldWater,newWater));
+    const __m512 minDepth = _mm512_set1_ps(FLT_MIN);
+
+    __m512 uDepth = _mm512_mul_ps(dy,meanWater);
+    __m512 vDepth = _mm512_mul_ps(dx,meanWater);
+    __m512 u = _mm512_mul_ps(_mm512_mul_ps(half,_mm512_add_ps(fl,fr)), Reciprocal16(uDepth));
+    __m512 v = _mm512_mul_ps(_mm512_mul_ps(half,_mm512_add_ps(fb,ft)), Reciprocal16(vDepth));
+
+    u = _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(uDepth,minDepth,_CMP_GE_OQ),u);
+    v = _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(vDepth,minDepth,_CMP_GE_OQ),v);
+    Store16<MASKED>(uRow+x,m,u);
+    Store16<MASKED>(vRow+x,m,v);
+
+    return _mm512_max_ps(_mm512_abs_ps(u),_mm512_abs_ps(v));
+}
+
+} // anonymous namespace
+
+AVX512_TARGET void Kernels::EdgeFluxScaleRowAVX512(const Fields& f, const Params& p, int y, int x0, int x1)
+{
+    const float* tRow = f.terrain->row(y);
+    const float* tRowT = f.terrain->row(y+1);
+    const float* tRowB = f.terrain->row(y-1);
+    const float* wRow = f.water->row(y);
+    const float* wRowT = f.water->row(y+1);
+    const float* wRowB = f.water->row(y-1);
+    const float* xRow = f.xFlux->row(y);
+    const float* yRow = f.yFlux->row(y);
+    const float* yRowB = f.yFlux->row(y-1);
+    float* kRow = &(*f.uVel)(y,0);
+
+    const __m512 fluxFactor = _mm512_set1_ps(p.fluxFactor);
+    const __m512 area = _mm512_set1_ps(p.dx*p.dy);
+    const __m512 dt = _mm512_set1_ps(float(p.dt));
+
+    int x = x0;
+    for (; x+16<=x1; x+=16)
+        EdgeFluxScale16<false>(tRow,tRowT,tRowB,wRow,wRowT,wRowB,xRow,yRow,yRowB,kRow,fluxFactor,area,dt,x,0xFFFF);
+    if (x < x1)
+        EdgeFluxScale16<true>(tRow,tRowT,tRowB,wRow,wRowT,wRowB,xRow,yRow,yRowB,kRow,fluxFactor,area,dt,x,TailMask16(x1-x));
+}
+
+AVX512_TARGET void Kernels::EdgeFluxRowAVX512(const Fields& f, const Params& p, int y, int x0, int x1)
+{
+    const int w = f.water->width();
+    const int h = f.water->height();
+
+    const float* tRow = f.terrain->row(y);
+    const float* wRow = f.water->row(y);
+    const float* kRow = &(*f.uVel)(y,0);
+    float* xRow = f.xFlux->row(y);
+
+    const __m512 fluxFactor = _mm512_set1_ps(p.fluxFactor);
+
+    // right edges, the last column borders the domain
+    const int xEnd = std::min(x1,w-1);
+    int x = x0;
+    for (; x+16<=xEnd; x+=16)
+        EdgeFlux16<false>(tRow,wRow,kRow,tRow+1,wRow+1,kRow+1,xRow,fluxFactor,x,0xFFFF);
+    if (x < xEnd)
+        EdgeFlux16<true>(tRow,wRow,kRow,tRow+1,wRow+1,kRow+1,xRow,fluxFactor,x,TailMask16(xEnd-x));
+
+    if (y == h-1)
+        return;
+
+    // top edges
+    const float* tRowT = f.terrain->row(y+1);
+    const float* wRowT = f.water->row(y+1);
+    const float* kRowT = &(*f.uVel)(y+1,0);
+    float* yRow = f.yFlux->row(y);
+    for (x=x0; x+16<=x1; x+=16)
+        EdgeFlux16<false>(tRow,wRow,kRow,tRowT,wRowT,kRowT,yRow,fluxFactor,x,0xFFFF);
+    if (x < x1)
+        EdgeFlux16<true>(tRow,wRow,kRow,tRowT,wRowT,kRowT,yRow,fluxFactor,x,TailMask16(x1-x));
+}
+
+AVX512_TARGET float Kernels::EdgeWaterVelocityRowAVX512(const Fields& f, const Params& p, int y, int x0, int x1)
+{
+    const float* xRow = f.xFlux->row(y);
+    const float* yRow = f.yFlux->row(y);
+    const float* yRowB = f.yFlux->row(y-1);
+    float* wRow = f.water->row(y);
+    float* uRow = &(*f.uVel)(y,0);
+    float* vRow = &(*f.vVel)(y,0);
+
+    const __m512 dt = _mm512_set1_ps(float(p.dt));
+    const __m512 invArea = _mm512_set1_ps(1.0f/(p.dx*p.dy));
+    const __m512 dx = _mm512_set1_ps(p.dx);
+    const __m512 dy = _mm512_set1_ps(p.dy);
+
+    __m512 speed = _mm512_setzero_ps();
+    int x = x0;
+    for (; x+16<=x1; x+=16)
+        speed = _mm512_max_ps(speed,EdgeWaterVelocity16<false>(xRow,yRow,yRowB,wRow,uRow,vRow,dt,invArea,dx,dy,x,0xFFFF));
+    if (x < x1)
+        speed = _mm512_max_ps(speed,EdgeWaterVelocity16<true>(xRow,yRow,yRowB,wRow,uRow,vRow,dt,invArea,dx,dy,x,TailMask16(x1-x)));
+    return _mm512_reduce_max_ps(speed);
+}
+
+namespace {
+
+template<bool MASKED>
+AVX512_TARGET inline void TerrainSlope16(const float* tRow, const float* tRowT, const float* tRowB,
+                                         float* slope, int x, __mmask16 m)
+{
+    __m512 gx = _mm512_sub_ps(Load16<MASKED>(tRow+x+1,m), Load16<MASKED>(tRow+x-1,m));
+    __m512 gy = _mm512_sub_ps(Load16<MASKED>(tRowT+x,m), Load16<MASKED>(tRowB+x,m));
+    __m512 g2 = _mm512_add_ps(_mm512_mul_ps(gx,gx), _mm512_mul_ps(gy,gy));
+    Store16<MASKED>(slope+x, m, _mm512_sqrt_ps(_mm512_div_ps(g2, _mm512_add_ps(g2,_mm512_set1_ps(4.0f)))));
+}
+
+} // anonymous namespace
+
+AVX512_TARGET void Kernels::TerrainSlopeRowAVX512(const Fields& f, const Params&, int y, int x0, int x1)
+{
+    const float* tRow = f.terrain->row(y);
+    const float* tRowT = f.terrain->row(y+1);
+    const float* tRowB = f.terrain->row(y-1);
+    float* slope = &(*f.slope)(y,0);
+
+    int x = x0;
+    for (; x+16<=x1; x+=16)
+        TerrainSlope16<false>(tRow,tRowT,tRowB,slope,x,0xFFFF);
+    if (x < x1)
+        TerrainSlope16<true>(tRow,tRowT,tRowB,slope,x,TailMask16(x1-x));
+}
+
+#else
+
+// No x86 SIMD available, the variants are never selected (see
+// KernelVariantSupported) but keep the symbols for the dispatch.
+
+void Kernels::OutflowFluxRowAVX2(const Fields& f, const Params& p, int y, int x0, int x1) { OutflowFluxRowScalar(f,p,y,x0,x1); }
+float Kernels::WaterVelocityRowAVX2(const Fields& f, const Params& p, int y, int x0, int x1) { return WaterVelocityRowScalar(f,p,y,x0,x1); }
+void Kernels::OutflowFluxRowAVX512(const Fields& f, const Params& p, int y, int x0, int x1) { OutflowFluxRowScalar(f,p,y,x0,x1); }
+float Kernels::WaterVelocityRowAVX512(const Fields& f, const Params& p, int y, int x0, int x1) { return WaterVelocityRowScalar(f,p,y,x0,x1); }
+float Kernels::WaterVelocityHalfRowAVX2(const Fields& f, const Params& p, int y, int x0, int x1) { return WaterVelocityHalfRowScalar(f,p,y,x0,x1); }
+float Kernels::WaterVelocityHalfRowAVX512(const Fields& f, const Params& p, int y, int x0, int x1) { return WaterVelocityHalfRowScalar(f,p,y,x0,x1); }
+void Kernels::EdgeFluxScaleRowAVX2(const Fields& f, const Params& p, int y, int x0, int x1) { EdgeFluxScaleRowScalar(f,p,y,x0,x1); }
+void Kernels::EdgeFluxRowAVX2(const Fields& f, const Params& p, int y, int x0, int x1) { EdgeFluxRowScalar(f,p,y,x0,x1); }
+float Kernels::EdgeWaterVelocityRowAVX2(const Fields& f, const Params& p, int y, int x0, int x1) { return EdgeWaterVelocityRowScalar(f,p,y,x0,x1); }
+void Kernels::EdgeFluxScaleRowAVX512(const Fields& f, const Params& p, int y, int x0, int x1) { EdgeFluxScaleRowScalar(f,p,y,x0,x1); }
+void Kernels::EdgeFluxRowAVX512(const Fields& f, const Params& p, int y, int x0, int x1) { EdgeFluxRowScalar(f,p,y,x0,x1); }
+float Kernels::EdgeWaterVelocityRowAVX512(const Fields& f, const Params& p, int y, int x0, int x1) { return EdgeWaterVelocityRowScalar(f,p,y,x0,x1); }
+void Kernels::TerrainSlopeRowAVX2(const Fields& f, const Params& p, int y, int x0, int x1) { TerrainSlopeRowScalar(f,p,y,x0,x1); }
+void Kernels::TerrainSlopeRowAVX512(const Fields& f, const Params& p, int y, int x0, int x1) { TerrainSlopeRowScalar(f,p,y,x0,x1); }
+
+#endif
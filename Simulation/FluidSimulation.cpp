@@ -10,8 +10,10 @@
 *****************************************************************************/
 
 #include "FluidSimulation.h"
+#include "Exception.h"
 
 #include <random>
+#include <sstream>
 typedef std::mt19937 RANDOM;  // the Mersenne Twister with a popular choice of parameters
 
 #if defined(__GNUG__)
@@ -20,41 +22,71 @@ typedef std::mt19937 RANDOM;  // the Mersenne Twister with a popular choice of p
 #include "MathUtil.h"
 #endif
 
-#if defined(__APPLE__) || defined(__MACH__)
-#include <dispatch/dispatch.h>
-dispatch_queue_t gcdq = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
-#endif
-
 using namespace Simulation;
 using namespace glm;
 using namespace std;
 
+/// Calls fn(i) for i in [0,n) on the configured backend (see Parallel) and
+/// times the workers as stage.
+template<typename FN>
+static void ParallelStage(Profiler& profiler, Stage stage, int n, const FN& fn)
+{
+    Parallel::For(n,[&](int begin, int end)
+    {
+        Profiler::ThreadScope threadScope(profiler,stage);
+        for (int i=begin; i<end; ++i)
+            fn(i);
+    });
+}
+
 FluidSimulation::FluidSimulation(SimulationState& state)
     : state(state),
       water(state.water),
       terrain(state.terrain),
       sediment(state.suspendedSediment),
-      tmpSediment(state.water.width(),state.water.height()),
+      terrainBuffer(terrain),
+      sedimentBuffer(sediment),
       uVel(water.width(), water.height()),
       vVel(water.width(), water.height()),
-      lFlux(water.width(), water.height()),
-      rFlux(water.width(), water.height()),
-      tFlux(water.width(), water.height()),
-      bFlux(water.width(), water.height()),
+      terrainSlope(water.width(), water.height()),
+      lFlux(water.width(), water.height(), 1, BoundaryPolicy::Zero),
+      rFlux(water.width(), water.height(), 1, BoundaryPolicy::Zero),
+      tFlux(water.width(), water.height(), 1, BoundaryPolicy::Zero),
+      bFlux(water.width(), water.height(), 1, BoundaryPolicy::Zero),
+      xFlux(0, 0, 1, BoundaryPolicy::Zero),
+      yFlux(0, 0, 1, BoundaryPolicy::Zero),
       lX(1.0),
       lY(1.0),
-      gravity(9.81)
+      gravity(9.81),
+      pipeLength(1),
+      pipeArea(0.00005),
+      fused(false),
+      sparse(false),
+      activeTiles(water.width(), water.height()),
+      staggered(false),
+      halfPrecision(false),
+      _kernels(),
+      _maxVelocity(0.0f),
+      _staggeredFluxes(false),
+      _halfFields(false),
+      _dirtyRows(water.height(),1)
 {
     assert(water.height() == terrain.height() && water.width() == terrain.width());
 
     // Reset velocity field
-    for (uint i=0; i<uVel.width(); ++i) {
-        for (uint j=0; j<uVel.height(); ++j) {
-            uVel(i,j) = 0;
-            vVel(i,j) = 0;
-            lFlux(i,j) = rFlux(i,j) = tFlux(i,j) = bFlux(i,j) = 0;
+    for (uint y=0; y<uVel.height(); ++y) {
+        for (uint x=0; x<uVel.width(); ++x) {
+            uVel(y,x) = 0;
+            vVel(y,x) = 0;
         }
     }
+
+    // Fluxes are zero everywhere, including the halo which provides the
+    // boundary condition of the water update
+    lFlux.updateHalo(); rFlux.updateHalo();
+    tFlux.updateHalo(); bFlux.updateHalo();
+
+    setKernelVariant(DefaultKernelVariant());
 }
 
 FluidSimulation::~FluidSimulation() {
@@ -64,41 +96,90 @@ FluidSimulation::~FluidSimulation() {
 RANDOM rnd;
 
 void FluidSimulation::makeRain(double dt)
+{
+    Profiler::ScopedStage stageTimer(profiler,Stage::Rain);
+    Profiler::ThreadScope threadScope(profiler,Stage::Rain);
+
+    std::vector<ivec2> drops;
+    nextRainDrops(drops);
+    addRain(drops,ivec2(0,0));
+
+//    std::uniform_real_distribution<float> rndFloat(0.0f,1.0f);
+//    for (uint i=0; i<water.size(); i++)
+//    {
+//        water(i) += 0.01*rndFloat(rnd);
+    //    }
+}
+
+void FluidSimulation::nextRainDrops(std::vector<ivec2>& drops)
 {
     std::uniform_int_distribution<ushort> rndInt(1,water.width()-2);
 
-    for (uint i=0; i<100; i++)
+    drops.resize(100);
+    for (uint i=0; i<drops.size(); i++)
     {
         uint x = rndInt(rnd);
         uint y = rndInt(rnd);
+        drops[i] = ivec2(x,y);
+    }
+}
+
+void FluidSimulation::restartRain()
+{
+    rnd.seed();
+}
+
+std::string FluidSimulation::rainState()
+{
+    std::ostringstream out;
+    out << rnd;
+    return out.str();
+}
+
+void FluidSimulation::setRainState(const std::string& state)
+{
+    std::istringstream in(state);
+    RANDOM restored;
+    if (!(in >> restored))
+        throw Exception("Invalid state of the random rain drops.");
+    rnd = restored;
+}
+
+void FluidSimulation::addRain(const std::vector<ivec2>& drops, const ivec2& origin)
+{
+    int w = water.width();
+    int h = water.height();
+
+    for (const ivec2& drop : drops)
+    {
+        int x = drop.x - origin.x;
+        int y = drop.y - origin.y;
+        activeTiles.touch(x-1,y-1,x+2,y+2);
 
 //        water(y,x) += 1;
-        water(y-1, x-1)  += 1.0/16.0;
-        water(y-1, x)  += 1.0/16.0;
-        water(y-1, x+1)  += 1.0/16.0;
-        water(y, x-1)  += 1.0/16.0;
-        water(y,x)  += 1.0/16.0;
-        water(y, x+1)  += 1.0/16.0;
-        water(y+1, x-1)  += 1.0/16.0;
-        water(y+1, x)  += 1.0/16.0;
-        water(y+1, x+1)  += 1.0/16.0;
+        for (int dy=-1; dy<=1; dy++)
+        {
+            for (int dx=-1; dx<=1; dx++)
+            {
+                if (y+dy >= 0 && y+dy < h && x+dx >= 0 && x+dx < w)
+                    water(y+dy, x+dx) += 1.0/16.0;
+            }
+        }
     }
-
-//    std::uniform_real_distribution<float> rndFloat(0.0f,1.0f);
-//    for (uint i=0; i<water.size(); i++)
-//    {
-//        water(i) += 0.01*rndFloat(rnd);
-    //    }
 }
 
 void FluidSimulation::makeFlood(double dt)
 {
+    Profiler::ScopedStage stageTimer(profiler,Stage::Flood);
+    Profiler::ThreadScope threadScope(profiler,Stage::Flood);
+
     addRainDrop(rainPos,10,dt*0.01*1);
 }
 
 void FluidSimulation::addRainDrop(const vec2 &pos, int rad, float amount)
 {
     int rad2 = rad*rad;
+    activeTiles.touch(int(pos.x)-rad,int(pos.y)-rad,int(pos.x)+rad+1,int(pos.y)+rad+1);
     for (int y= -rad; y<=rad; y++)
     {
         int posY = pos.y + y;
@@ -118,28 +199,31 @@ void FluidSimulation::addRainDrop(const vec2 &pos, int rad, float amount)
     }
 }
 
-//dispatch_queue_t gcdq = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
-//dispatch_apply(elements.size(), gcdq, ^(size_t idx)
-
 void FluidSimulation::smoothTerrain()
 {
+    Profiler::ScopedStage stageTimer(profiler,Stage::Smoothing);
+
     float maxD = 0.2f;
 
-#if defined(__APPLE__) || defined(__MACH__)
-    dispatch_apply(terrain.width(), gcdq, ^(size_t x)
-#else
-    #pragma omp parallel for
-    for (int x=0; x<terrain.width(); ++x)
-#endif
+    terrain.updateHalo();
+    PaddedGrid2D<float>* smoothed = &terrainBuffer.back();
+
+    ParallelStage(profiler,Stage::Smoothing,terrain.height(),[&](int y)
     {
-        for (int y=0; y<terrain.height(); ++y)
+        const float* tRow = terrain.row(y);
+        const float* tRowT = terrain.row(y+1);
+        const float* tRowB = terrain.row(y-1);
+        float* out = smoothed->row(y);
+        bool changed = false;
+
+        for (int x=0; x<terrain.width(); ++x)
         {
-            float h = getTerrain(y,x);
+            float h = tRow[x];
 
-            float hl = getTerrain(y,x-1);
-            float hr = getTerrain(y,x+1);
-            float ht = getTerrain(y+1,x);
-            float hb = getTerrain(y-1,x);
+            float hl = tRow[x-1];
+            float hr = tRow[x+1];
+            float ht = tRowT[x];
+            float hb = tRowB[x];
 
             float dl = h - hl;
             float dr = h - hr;
@@ -147,381 +231,575 @@ void FluidSimulation::smoothTerrain()
             float dt = h - ht;
             float db = h - hb;
 
-            tmpSediment(y,x) = h;
+            bool smoothX = (abs(dl) > maxD || abs(dr) > maxD) && dr*dl > 0.0f;
+            bool smoothY = (abs(dt) > maxD || abs(db) > maxD) && dt*db > 0.0f;
 
-            if ((abs(dl) > maxD || abs(dr) > maxD) && dr*dl > 0.0f)
-            {
-                float avg = (h+hl+hr+ht+hb)/5;
-                tmpSediment(y,x) = avg;
-            }
-            else if ((abs(dt) > maxD || abs(db) > maxD) && dt*db > 0.0f)
-            {
-                float avg = (h+hl+hr+ht+hb)/5;
-                tmpSediment(y,x) = avg;
-            }
+            float avg = (h+hl+hr+ht+hb)/5;
+            out[x] = (smoothX || smoothY) ? avg : h;
+            changed |= smoothX || smoothY;
         }
-    }
-#if defined(__APPLE__) || defined(__MACH__)
-    );
-#endif
+        if (changed)
+            _dirtyRows[y] = 1;
+    });
 
+    terrainBuffer.swap();
+}
 
-#if defined(__APPLE__) || defined(__MACH__)
-    dispatch_apply(terrain.size(), gcdq, ^(size_t i)
-#else
-    #pragma omp parallel for
-    for (uint i=0; i<terrain.size(); ++i)
-#endif
+void FluidSimulation::computeSurfaceNormals()
+{
+    invalidateSurfaceNormals();
+    updateSurfaceNormals();
+}
+
+void FluidSimulation::invalidateSurfaceNormals()
+{
+    std::fill(_dirtyRows.begin(),_dirtyRows.end(),1);
+}
+
+void FluidSimulation::markDirtyRows()
+{
+    if (!sparse || (fused && !staggered))
     {
-        terrain(i) = tmpSediment(i);
+        invalidateSurfaceNormals();
+        return;
     }
+    for (uint i=0; i<activeTiles.count(); i++)
+        std::fill(_dirtyRows.begin()+activeTiles[i].y0,_dirtyRows.begin()+activeTiles[i].y1,1);
+}
 
-#if defined(__APPLE__) || defined(__MACH__)
-    );
-#endif
+void FluidSimulation::updateChangedRows()
+{
+    // the normal of a cell depends on the rows above and below
+    const int h = terrain.height();
+    _normalRows.clear();
+    for (int y=0; y<h; ++y)
+    {
+        if (_dirtyRows[y] || (y > 0 && _dirtyRows[y-1]) || (y+1 < h && _dirtyRows[y+1]))
+            _normalRows.push_back(y);
+    }
+    if (!_normalRows.empty())
+        std::fill(_dirtyRows.begin(),_dirtyRows.end(),0);
 }
 
-void FluidSimulation::computeSurfaceNormals()
+void FluidSimulation::updateSurfaceNormals()
 {
+    updateChangedRows();
+    if (_normalRows.empty())
+        return;
 
-#if defined(__APPLE__) || defined(__MACH__)
-    dispatch_apply(terrain.height(), gcdq, ^(size_t y)
-#else
-    #pragma omp parallel for
-    for (int y=0; y<terrain.height(); ++y)
-#endif
-    {
-        for (int x=0; x<terrain.width(); ++x)
-        {
-            float r,l,t,b;
-            vec3 N;
-            r = getTerrain(y,x+1) + getWater(y,x+1);
-            l = getTerrain(y,x-1) + getWater(y,x-1);
-            t = getTerrain(y+1,x) + getWater(y+1,x);
-            b = getTerrain(y-1,x) + getWater(y-1,x);
+    Profiler::ScopedStage stageTimer(profiler,Stage::SurfaceNormals);
 
-            N = vec3(l-r, t - b, 2 );
-            N = normalize(N);
+    Kernels::Params params = { 0.0, 0.0f, lX, lY };
+    const Kernels::Fields fields = kernelFields();
+    const Kernels::RowFn surfaceNormals = _kernels.surfaceNormals;
+    const int* rows = _normalRows.data();
+    const int count = _normalRows.size();
 
-            state.surfaceNormals(y,x) = N;
-        }
-    }
-#if defined(__APPLE__) || defined(__MACH__)
-    );
-#endif
+    terrain.updateHalo();
+    water.updateHalo();
+
+    const int width = terrain.width();
+    ParallelStage(profiler,Stage::SurfaceNormals,count,[&](int i)
+    {
+        surfaceNormals(fields,params,rows[i],0,width);
+    });
 }
 
 
 
-void FluidSimulation::simulateFlow(double dt)
+// Kernel dispatch
+//////////////////////////////////////////////
+
+// indexed by KernelVariant
+static const Kernels::RowFn OutflowFluxKernels[] = {
+    Kernels::OutflowFluxRowScalar, Kernels::OutflowFluxRowSSE4, Kernels::OutflowFluxRowAVX2, Kernels::OutflowFluxRowAVX512 };
+static const Kernels::MaxRowFn WaterVelocityKernels[] = {
+    Kernels::WaterVelocityRowScalar, Kernels::WaterVelocityRowSSE4, Kernels::WaterVelocityRowAVX2, Kernels::WaterVelocityRowAVX512 };
+static const Kernels::MaxRowFn WaterVelocityHalfKernels[] = {
+    Kernels::WaterVelocityHalfRowScalar, Kernels::WaterVelocityHalfRowSSE4, Kernels::WaterVelocityHalfRowAVX2, Kernels::WaterVelocityHalfRowAVX512 };
+static const Kernels::RowFn EdgeFluxScaleKernels[] = {
+    Kernels::EdgeFluxScaleRowScalar, Kernels::EdgeFluxScaleRowSSE4, Kernels::EdgeFluxScaleRowAVX2, Kernels::EdgeFluxScaleRowAVX512 };
+static const Kernels::RowFn EdgeFluxKernels[] = {
+    Kernels::EdgeFluxRowScalar, Kernels::EdgeFluxRowSSE4, Kernels::EdgeFluxRowAVX2, Kernels::EdgeFluxRowAVX512 };
+static const Kernels::MaxRowFn EdgeWaterVelocityKernels[] = {
+    Kernels::EdgeWaterVelocityRowScalar, Kernels::EdgeWaterVelocityRowSSE4, Kernels::EdgeWaterVelocityRowAVX2, Kernels::EdgeWaterVelocityRowAVX512 };
+static const Kernels::RowFn TerrainSlopeKernels[] = {
+    Kernels::TerrainSlopeRowScalar, Kernels::TerrainSlopeRowSSE4, Kernels::TerrainSlopeRowAVX2, Kernels::TerrainSlopeRowAVX512 };
+static const Kernels::RowFn ErosionKernels[] = {
+    Kernels::ErosionRowScalar, Kernels::ErosionRowSSE4, Kernels::ErosionRowAVX2, Kernels::ErosionRowAVX512 };
+static const Kernels::RowFn ErosionHalfKernels[] = {
+    Kernels::ErosionHalfRowScalar, Kernels::ErosionHalfRowSSE4, Kernels::ErosionHalfRowAVX2, Kernels::ErosionHalfRowAVX512 };
+static const Kernels::RowFn SedimentTransportKernels[] = {
+    Kernels::SedimentTransportRowScalar, Kernels::SedimentTransportRowSSE4, Kernels::SedimentTransportRowAVX2, Kernels::SedimentTransportRowAVX512 };
+static const Kernels::RowFn SedimentTransportHalfKernels[] = {
+    Kernels::SedimentTransportHalfRowScalar, Kernels::SedimentTransportHalfRowSSE4, Kernels::SedimentTransportHalfRowAVX2, Kernels::SedimentTransportHalfRowAVX512 };
+static const Kernels::RowFn EvaporationKernels[] = {
+    Kernels::EvaporationRowScalar, Kernels::EvaporationRowSSE4, Kernels::EvaporationRowAVX2, Kernels::EvaporationRowAVX512 };
+static const Kernels::RowFn SurfaceNormalsKernels[] = {
+    Kernels::SurfaceNormalsRowScalar, Kernels::SurfaceNormalsRowSSE4, Kernels::SurfaceNormalsRowAVX2, Kernels::SurfaceNormalsRowAVX512 };
+
+void FluidSimulation::setKernelVariant(KernelVariant limit)
 {
+    // every stage has all variants, so the best supported one up to the limit
+    uint v = std::min(uint(limit),uint(BestKernelVariant()));
 
-    // Outflux computation settings
-    ////////////////////////////////////////////////////////////
-    float l = 1;
-    float A = 0.00005;
-
-    const float dx = lX;
-    const float dy = lY;
+    const Stage stages[] = { Stage::Flow, Stage::Erosion, Stage::SedimentTransportation,
+                             Stage::Evaporation, Stage::SurfaceNormals };
+    for (Stage stage : stages)
+        setKernelVariant(stage,KernelVariant(v));
+}
 
-    float fluxFactor = dt*A*gravity/l;
+void FluidSimulation::setKernelVariant(Stage stage, KernelVariant variant)
+{
+    if (!KernelVariantSupported(variant))
+        throw Exception(std::string("Kernel variant '") + KernelVariantName(variant) + "' is not supported on this CPU.");
 
+    uint v = uint(variant);
+    switch (stage)
+    {
+    case Stage::Flow:
+        _kernels.outflowFlux = OutflowFluxKernels[v];
+        _kernels.waterVelocity = WaterVelocityKernels[v];
+        _kernels.waterVelocityHalf = WaterVelocityHalfKernels[v];
+        _kernels.edgeFluxScale = EdgeFluxScaleKernels[v];
+        _kernels.edgeFlux = EdgeFluxKernels[v];
+        _kernels.edgeWaterVelocity = EdgeWaterVelocityKernels[v];
+        break;
+    case Stage::Erosion:
+        _kernels.terrainSlope = TerrainSlopeKernels[v];
+        _kernels.erosion = ErosionKernels[v];
+        _kernels.erosionHalf = ErosionHalfKernels[v];
+        break;
+    case Stage::SedimentTransportation:
+        _kernels.sedimentTransport = SedimentTransportKernels[v];
+        _kernels.sedimentTransportHalf = SedimentTransportHalfKernels[v];
+        break;
+    case Stage::Evaporation:
+        _kernels.evaporation = EvaporationKernels[v];
+        break;
+    case Stage::SurfaceNormals:
+        _kernels.surfaceNormals = SurfaceNormalsKernels[v];
+        break;
+    default:
+        throw Exception(std::string("Stage '") + StageName(stage) + "' has no kernel variants.");
+    }
+    _kernels.variant[uint(stage)] = variant;
+}
 
-    // Outflow Flux Computation with boundary conditions
-    ////////////////////////////////////////////////////////////
-#if defined(__APPLE__) || defined(__MACH__)
-    dispatch_apply(uVel.height(), gcdq, ^(size_t y)
-#else
-    #pragma omp parallel for
-    for (uint y=0; y<uVel.height(); ++y)
-#endif
+Kernels::Fields FluidSimulation::kernelFields()
+{
+    // only the grids of the flux model and storage in use
+    Kernels::Fields fields = { &terrain, &water, &sediment, &sedimentBuffer.back(),
+                               &lFlux, &rFlux, &tFlux, &bFlux, 0, 0, &uVel, &vVel, &state.surfaceNormals,
+                               0, 0, &terrainSlope };
+    if (_staggeredFluxes)
     {
-        for (uint x=0; x<uVel.width(); ++x)
-        {
-            float dh;                               // height difference
-            float h0 = terrain(y,x)+water(y,x);     // water height at current cell
-            float newFlux;
+        fields.lFlux = fields.rFlux = fields.tFlux = fields.bFlux = 0;
+        fields.xFlux = &xFlux;
+        fields.yFlux = &yFlux;
+    }
+    else if (_halfFields)
+    {
+        fields.uVel = fields.vVel = 0;
+        fields.uVelHalf = &uVelHalf;
+        fields.vVelHalf = &vVelHalf;
+    }
+    return fields;
+}
 
-            // left outflow
-            if (x > 0)
-            {
-                dh = h0 - (terrain(y,x-1)+water(y,x-1));
-                newFlux = lFlux(y,x) + fluxFactor*dh;
-                lFlux(y,x) = std::max(0.0f,newFlux);
-            }
-            else
-            {
-                lFlux(y,x) = 0.0f; // boundary
-            }
+Kernels::Params FluidSimulation::flowParams(double dt) const
+{
+    Kernels::Params params;
+    params.dt = dt;
+    params.fluxFactor = dt*pipeArea*gravity/pipeLength;
+    params.dx = lX;
+    params.dy = lY;
+    return params;
+}
 
-            // right outflow
-            if (x < water.width()-1) {
-                dh = h0 - (terrain(y,x+1)+water(y,x+1));
-                newFlux = rFlux(y,x) + fluxFactor*dh;
-                rFlux(y,x) = std::max(0.0f,newFlux);
-            }
-            else
-            {
-                rFlux(y,x) = 0.0f; // boundary
-            }
+void FluidSimulation::resize()
+{
+    uint w = water.width();
+    uint h = water.height();
+    assert(terrain.width() == w && terrain.height() == h);
 
-            // bottom outflow
-            if (y > 0)
-            {
-                dh = h0 - (terrain(y-1,x)+water(y-1,x));
-                newFlux = bFlux(y,x) + fluxFactor*dh;
-                bFlux(y,x) = std::max(0.0f,newFlux);
-            }
-            else
-            {
-                bFlux(y,x) = 0.0f; // boundary
-            }
+    terrainBuffer.resize();
+    sedimentBuffer.resize();
+    if (_halfFields)
+    {
+        uVelHalf.resize(w,h); vVelHalf.resize(w,h);
+    }
+    else
+    {
+        uVel.resize(w,h); vVel.resize(w,h);
+    }
+    terrainSlope.resize(w,h);
+    if (_staggeredFluxes)
+    {
+        xFlux.resize(w,h); yFlux.resize(w,h);
+    }
+    else
+    {
+        lFlux.resize(w,h); rFlux.resize(w,h);
+        tFlux.resize(w,h); bFlux.resize(w,h);
+    }
+    activeTiles.resize(w,h);
+    _dirtyRows.assign(h,1);
+}
 
-            // top outflow
-            if (y < water.height()-1) {
-                dh = h0 - (terrain(y+1,x)+water(y+1,x));
-                newFlux = tFlux(y,x) + fluxFactor*dh;
-                tFlux(y,x) = std::max(0.0f,newFlux);
-            }
-            else
-            {
-                tFlux(y,x) = 0.0f; // boundary
-            }
+/// Moves the cells of a grid into a grid of another element type and
+/// releases the source.
+template<typename FROM, typename TO>
+static void MoveConverted(FROM& from, TO& to)
+{
+    const int w = from.width();
+    const int h = from.height();
+    to.resize(w,h);
+    for (int y=0; y<h; ++y)
+    {
+        for (int x=0; x<w; ++x)
+            to(y,x) = from(y,x);
+    }
+    from.resize(0,0);
+}
 
-            // scaling
-            float sumFlux = lFlux(y,x)+rFlux(y,x)+bFlux(y,x)+tFlux(y,x);
-            float K = std::min(1.0f,float((water(y,x)*dx*dy)/(sumFlux*dt)));
-            rFlux(y,x) *= K;
-            lFlux(y,x) *= K;
-            tFlux(y,x) *= K;
-            bFlux(y,x) *= K;
-        }
+void FluidSimulation::applyFluxModel()
+{
+    const bool half = halfPrecision && !staggered;
+    if (staggered == _staggeredFluxes && half == _halfFields)
+        return;
+
+    const int w = water.width();
+    const int h = water.height();
+
+    // conversions go through the single precision outflow grids
+    if (_halfFields)
+    {
+        MoveConverted(uVelHalf,uVel); MoveConverted(vVelHalf,vVel);
+        _halfFields = false;
     }
-#if defined(__APPLE__) || defined(__MACH__)
-    );
-#endif
 
-    // Update water surface and velocity field
-    ////////////////////////////////////////////////////////////
-#if defined(__APPLE__) || defined(__MACH__)
-    dispatch_apply(uVel.height(), gcdq, ^(size_t y)
-#else
-    #pragma omp parallel for
-    for (int y=0; y<uVel.height(); ++y)
-#endif
+    if (staggered != _staggeredFluxes)
     {
-        for (int x=0; x<uVel.width(); ++x)
+        if (staggered)
         {
-            float inFlow = getRFlux(y,x-1) + getLFlux(y,x+1) + getTFlux(y-1,x) + getBFlux(y+1,x);
-            float outFlow = getRFlux(y,x) + getLFlux(y,x) + getTFlux(y,x) + getBFlux(y,x);
-            float dV = dt*(inFlow-outFlow);
-            float oldWater = water(y,x);
-            water(y,x) += dV/(dx*dy);
-            water(y,x) = std::max(water(y,x),0.0f);
-            float meanWater = 0.5*(oldWater+water(y,x));
-
-            if (meanWater == 0.0f)
+            // net flow over every edge, the outflows of both cells may be non-zero
+            xFlux.resize(w,h); yFlux.resize(w,h);
+            for (int y=0; y<h; ++y)
             {
-                uVel(y,x) = vVel(y,x) = 0.0f;
+                for (int x=0; x<w; ++x)
+                {
+                    xFlux(y,x) = rFlux(y,x) - lFlux(y,x+1);
+                    yFlux(y,x) = tFlux(y,x) - bFlux(y+1,x);
+                }
             }
-            else
+            lFlux.resize(0,0); rFlux.resize(0,0);
+            tFlux.resize(0,0); bFlux.resize(0,0);
+        }
+        else
+        {
+            lFlux.resize(w,h); rFlux.resize(w,h);
+            tFlux.resize(w,h); bFlux.resize(w,h);
+            for (int y=0; y<h; ++y)
             {
-                uVel(y,x) = 0.5*(getRFlux(y,x-1)-getLFlux(y,x)-getLFlux(y,x+1)+getRFlux(y,x))/(dy*meanWater);
-                vVel(y,x) = 0.5*(getTFlux(y-1,x)-getBFlux(y,x)-getBFlux(y+1,x)+getTFlux(y,x))/(dx*meanWater);
+                for (int x=0; x<w; ++x)
+                {
+                    rFlux(y,x) = std::max(xFlux(y,x),0.0f);
+                    lFlux(y,x) = std::max(-xFlux(y,x-1),0.0f);
+                    tFlux(y,x) = std::max(yFlux(y,x),0.0f);
+                    bFlux(y,x) = std::max(-yFlux(y-1,x),0.0f);
+                }
             }
+            xFlux.resize(0,0); yFlux.resize(0,0);
         }
+        _staggeredFluxes = staggered;
     }
 
-#if defined(__APPLE__) || defined(__MACH__)
-    );
-#endif
+    if (half)
+    {
+        MoveConverted(uVel,uVelHalf); MoveConverted(vVel,vVelHalf);
+        _halfFields = true;
+    }
+}
 
+/// Copies the transported sediment back, same signature as the kernels.
+static void CopySedimentRow(const Kernels::Fields& f, const Kernels::Params& p, int y, int x0, int x1)
+{
+    std::copy(f.sedimentBack->row(y)+x0, f.sedimentBack->row(y)+x1, f.sediment->row(y)+x0);
 }
 
-// flux acess
-float FluidSimulation::getRFlux(int y, int x) {
-    if (x<0 || x>rFlux.width()-1) {
-        return 0.0f;
-    } else {
-        return rFlux(y,x);
+void FluidSimulation::runKernel(Stage stage, Kernels::RowFn kernel, const Kernels::Fields& fields, const Kernels::Params& params)
+{
+    if (sparse)
+    {
+        const int tiles = activeTiles.count();
+        const ActiveTiles& active = activeTiles;
+        ParallelStage(profiler,stage,tiles,[&](int i)
+        {
+            const ActiveTiles::Tile& tile = active[i];
+            for (int y=tile.y0; y<tile.y1; ++y)
+                kernel(fields,params,y,tile.x0,tile.x1);
+        });
+    }
+    else
+    {
+        const int height = water.height();
+        const int width = water.width();
+        ParallelStage(profiler,stage,height,[&](int y)
+        {
+            kernel(fields,params,y,0,width);
+        });
     }
 }
 
-float FluidSimulation::getLFlux(int y, int x) {
-    if (x<0 || x>lFlux.width()-1) {
-        return 0.0f;
-    } else {
-        return lFlux(y,x);
+float FluidSimulation::runKernelMax(Stage stage, Kernels::MaxRowFn kernel, const Kernels::Fields& fields, const Kernels::Params& params)
+{
+    // one partial result per task, reduced afterwards in a fixed order
+    const int tasks = sparse ? activeTiles.count() : water.height();
+    _partialMax.assign(tasks,0.0f);
+    float* partial = _partialMax.data();
+
+    if (sparse)
+    {
+        const ActiveTiles& active = activeTiles;
+        ParallelStage(profiler,stage,tasks,[&](int i)
+        {
+            const ActiveTiles::Tile& tile = active[i];
+            float m = 0.0f;
+            for (int y=tile.y0; y<tile.y1; ++y)
+                m = std::max(m,kernel(fields,params,y,tile.x0,tile.x1));
+            partial[i] = m;
+        });
+    }
+    else
+    {
+        const int width = water.width();
+        ParallelStage(profiler,stage,tasks,[&](int y)
+        {
+            partial[y] = kernel(fields,params,y,0,width);
+        });
     }
+
+    float result = 0.0f;
+    for (int i=0; i<tasks; ++i)
+        result = std::max(result,partial[i]);
+    return result;
 }
 
-float FluidSimulation::getBFlux(int y, int x) {
-    if (y<0 || y>bFlux.height()-1) {
-        return 0.0f;
-    } else {
-        return bFlux(y,x);
+void FluidSimulation::simulateFlow(double dt)
+{
+    Profiler::ScopedStage stageTimer(profiler,Stage::Flow);
+
+    applyFluxModel();
+
+    const Kernels::Params params = flowParams(dt);
+    const Kernels::Fields fields = kernelFields();
+
+    // The tiles only need to be tracked while the other stages use them
+    if (sparse)
+        activeTiles.update(fields);
+    else
+        activeTiles.invalidate();
+
+    // Outflow Flux Computation with boundary conditions
+    ////////////////////////////////////////////////////////////
+
+    // The clamped halo makes the height difference towards the outside zero,
+    // so the boundary fluxes keep their initial value of zero.
+    terrain.updateHalo();
+    water.updateHalo();
+
+    if (staggered)
+    {
+        simulateStaggeredFlow(fields,params);
+        return;
     }
+
+    runKernel(Stage::Flow,_kernels.outflowFlux,fields,params);
+
+    // Update water surface and velocity field
+    ////////////////////////////////////////////////////////////
+    _maxVelocity = runKernelMax(Stage::Flow,_halfFields ? _kernels.waterVelocityHalf : _kernels.waterVelocity,fields,params);
 }
 
-float FluidSimulation::getTFlux(int y, int x) {
-    if (y<0 || y>tFlux.height()-1) {
-        return 0.0f;
-    } else {
-        return tFlux(y,x);
-    }
+void FluidSimulation::simulateErosion(double dt)
+{
+    Profiler::ScopedStage stageTimer(profiler,Stage::Erosion);
+
+    Kernels::Params params = { dt, 0.0f, lX, lY };
+    const Kernels::RowFn erosion = _halfFields ? _kernels.erosionHalf : _kernels.erosion;
+
+    // the slope of the terrain before the erosion, the cells erode
+    // independently afterwards
+    terrain.updateHalo();
+    const Kernels::Fields fields = kernelFields();
+    runKernel(Stage::Erosion,_kernels.terrainSlope,fields,params);
+    runKernel(Stage::Erosion,erosion,fields,params);
 }
 
-float FluidSimulation::getTerrain(int y, int x) {
-    return terrain(glm::clamp(y,0,(int) terrain.height()-1),glm::clamp(x,0,(int) terrain.width()-1));
+void FluidSimulation::simulateSedimentTransportation(double dt)
+{
+    Profiler::ScopedStage stageTimer(profiler,Stage::SedimentTransportation);
+
+    Kernels::Params params = { dt, 0.0f, lX, lY };
+    const Kernels::Fields fields = kernelFields();
+
+    // semi-lagrangian advection
+    runKernel(Stage::SedimentTransportation,_halfFields ? _kernels.sedimentTransportHalf : _kernels.sedimentTransport,fields,params);
+
+    // The back buffer only holds the new values of the active tiles in sparse
+    // mode, so they are copied. Otherwise it becomes the front buffer.
+    if (sparse)
+        runKernel(Stage::SedimentTransportation,CopySedimentRow,fields,params);
+    else
+        sedimentBuffer.swap();
 }
 
-float FluidSimulation::getWater(int y, int x){
-    return water(glm::clamp(y,0,(int) water.height()-1),glm::clamp(x,0,(int) water.width()-1));
+void FluidSimulation::simulateEvaporation(double dt)
+{
+    Profiler::ScopedStage stageTimer(profiler,Stage::Evaporation);
+
+    Kernels::Params params = { dt, 0.0f, lX, lY };
+
+    runKernel(Stage::Evaporation,_kernels.evaporation,kernelFields(),params);
 }
 
-void FluidSimulation::simulateErosion(double dt)
+// Rows per band of the fused sweep and the staggered flux pass, a band keeps
+// about three rows of every grid in cache while it is processed.
+static const int FusedBandRows = 64;
+
+void FluidSimulation::simulateStaggeredFlow(const Kernels::Fields& fields, const Kernels::Params& params)
 {
-    const float Kc = 25.0f; // sediment capacity constant
-    const float Ks = 0.0001f*12*10; // dissolving constant
-    const float Kd = 0.0001f*12*10; // deposition constant
+    const Kernels::RowFn edgeFluxScale = _kernels.edgeFluxScale;
+    const Kernels::RowFn edgeFlux = _kernels.edgeFlux;
 
-#if defined(__APPLE__) || defined(__MACH__)
-    dispatch_apply(sediment.height(), gcdq, ^(size_t y)
-#else
-    #pragma omp parallel for
-    for (int y=0; y<sediment.height(); ++y)
-#endif
+    if (sparse)
+    {
+        // a tile reads K of its neighbours
+        runKernel(Stage::Flow,edgeFluxScale,fields,params);
+        runKernel(Stage::Flow,edgeFlux,fields,params);
+    }
+    else
     {
-        for (int x=0; x<sediment.width(); ++x)
+        // K of row y+1 reads the old flux over the top edge of row y, so it
+        // is computed right before the edge fluxes of row y are replaced.
+        // K of the first row of every band is computed upfront, it reads
+        // the edge the band above replaces.
+        const int height = water.height();
+        const int width = water.width();
+        const int bands = (height+FusedBandRows-1)/FusedBandRows;
+
+        ParallelStage(profiler,Stage::Flow,bands,[&](int b)
         {
-            // local velocity
-            float uV = uVel(y,x);
-            float vV = vVel(y,x);
-
-            // local terrain normal
-            vec3 normal = vec3(getTerrain(y,x+1) - getTerrain(y,x-1), getTerrain(y+1,x) - getTerrain(y-1,x), 2 );
-            normal = normalize(normal);
-            vec3 up(0,0,1);
-            float cosa = dot(normal,up);
-            float sinAlpha = sin(acos(cosa));
-            sinAlpha = std::max(sinAlpha,0.1f);
-
-            // local sediment capacity of the flow
-            float capacity = Kc * sqrtf(uV*uV+vV*vV)*sinAlpha*(std::min(water(y,x),0.01f)/0.01f) ;
-            float delta = (capacity-sediment(y,x));
-
-            float v = sqrtf(uV*uV+vV*vV);
-            float fctr = (std::min(water(y,x),0.01f)/0.01f);
-
-            if (delta > 0.0f)
-            {
-                float d = Ks*delta;
-                terrain(y,x)  -= d;
-                water(y,x)    += d;
-                sediment(y,x) += d;
-            }
-            // deposit onto ground
-            else if (delta < 0.0f)
+            edgeFluxScale(fields,params,b*FusedBandRows,0,width);
+        });
+
+        ParallelStage(profiler,Stage::Flow,bands,[&](int b)
+        {
+            int first = b*FusedBandRows;
+            int end = std::min(height,first+FusedBandRows);
+            for (int y=first; y<end; ++y)
             {
-                float d = Kd*delta;
-                terrain(y,x)  -= d;
-                water(y,x)    += d;
-                sediment(y,x) += d;
+                if (y+1 < end)
+                    edgeFluxScale(fields,params,y+1,0,width);
+                edgeFlux(fields,params,y,0,width);
             }
-        }
+        });
     }
-#if defined(__APPLE__) || defined(__MACH__)
-    );
-#endif
+
+    // Update water surface and velocity field, replaces K
+    _maxVelocity = runKernelMax(Stage::Flow,_kernels.edgeWaterVelocity,fields,params);
 }
 
-void FluidSimulation::simulateSedimentTransportation(double dt)
+void FluidSimulation::simulateFused(double dt)
 {
-    // semi-lagrangian advection
-#if defined(__APPLE__) || defined(__MACH__)
-    dispatch_apply(sediment.height(), gcdq, ^(size_t y)
-#else
-    #pragma omp parallel for
-    for (uint y=0; y<sediment.height(); ++y)
-#endif
+    // the sweep is built on the outflow fluxes
+    if (staggered)
     {
-        for (uint x=0; x<sediment.width(); ++x)
-        {
-            // local velocity
-            float uV = uVel(y,x);
-            float vV = vVel(y,x);
+        simulateFlow(dt);
+        simulateErosion(dt);
+        simulateEvaporation(dt);
+        return;
+    }
 
-            // position where flow comes from
-            float fromPosX = float(x) - uV*dt;
-            float fromPosY = float(y) - vV*dt;
+    Profiler::ScopedStage stageTimer(profiler,Stage::FlowErosionEvaporation);
 
-            // integer coordinates
-            int x0 = Floor2Int(fromPosX);
-            int y0 = Floor2Int(fromPosY);
-            int x1 = x0+1;
-            int y1 = y0+1;
+    applyFluxModel();
 
-            // interpolation factors
-            float fX = fromPosX - x0;
-            float fY = fromPosY - y0;
+    const Kernels::Params params = flowParams(dt);
+    const Kernels::Fields fields = kernelFields();
+    const Kernels::RowFn outflowFlux = _kernels.outflowFlux;
+    const Kernels::MaxRowFn waterVelocity = _halfFields ? _kernels.waterVelocityHalf : _kernels.waterVelocity;
+    const Kernels::RowFn terrainSlope = _kernels.terrainSlope;
+    const Kernels::RowFn erosion = _halfFields ? _kernels.erosionHalf : _kernels.erosion;
+    const Kernels::RowFn evaporation = _kernels.evaporation;
 
-            // clamp to grid borders
-            x0 = clamp(x0,0,int(sediment.width()-1));
-            x1 = clamp(x1,0,int(sediment.width()-1));
-            y0 = clamp(y0,0,int(sediment.height()-1));
-            y1 = clamp(y1,0,int(sediment.height()-1));
+    const int height = water.height();
+    const int width = water.width();
+    const int bands = (height+FusedBandRows-1)/FusedBandRows;
 
-            float newVal = mix( mix(sediment(y0,x0),sediment(y0,x1),fX), mix(sediment(y1,x0),sediment(y1,x1),fX), fY);
-            tmpSediment(y,x) = newVal;
+    // dense sweep, the tiles are out of date afterwards
+    activeTiles.invalidate();
 
-        }
-    }
-#if defined(__APPLE__) || defined(__MACH__)
-    );
-#endif
+    _partialMax.assign(bands,0.0f);
+    float* partial = _partialMax.data();
 
-    // write back new values
-#if defined(__APPLE__) || defined(__MACH__)
-    dispatch_apply(sediment.size(), gcdq, ^(size_t i)
-#else
-    #pragma omp parallel for
-    for (uint i=0; i<sediment.size(); ++i)
-#endif
-    {
-        sediment(i) = tmpSediment(i);
-    }
-#if defined(__APPLE__) || defined(__MACH__)
-    );
-#endif
-}
+    // erosion reads the same halo as the flux, terrain does not change in between
+    terrain.updateHalo();
+    water.updateHalo();
 
-void FluidSimulation::simulateEvaporation(double dt)
-{
-    const float Ke = 0.00011*0.5; // evaporation constant
-#if defined(__APPLE__) || defined(__MACH__)
-    dispatch_apply(water.height(), gcdq, ^(size_t y)
-#else
-    #pragma omp parallel for
-    for (uint y=0; y<water.height(); ++y)
-#endif
+    // The flux and the terrain slope of row y read the water and terrain of
+    // rows y-1..y+1 before their update, so the first and last row of every
+    // band are computed upfront. Afterwards the bands are independent.
+    ParallelStage(profiler,Stage::FlowErosionEvaporation,bands,[&](int b)
     {
-        for (uint x=0; x<water.width(); ++x)
+        int first = b*FusedBandRows;
+        int last = std::min(height,first+FusedBandRows)-1;
+        outflowFlux(fields,params,first,0,width);
+        terrainSlope(fields,params,first,0,width);
+        if (last != first)
         {
-            water(y,x) = std::max(water(y,x)*(1-Ke*dt),0.0);
+            outflowFlux(fields,params,last,0,width);
+            terrainSlope(fields,params,last,0,width);
+        }
+    });
 
-            if (water(y,x) <0.005f)
+    // Row pipeline: the water update and the terrain slope lag the flux by
+    // one row (they need the flux of its neighbours and the uneroded terrain
+    // above), erosion and evaporation lag by two rows (the flux and slope of
+    // the row above still read the uneroded terrain).
+    ParallelStage(profiler,Stage::FlowErosionEvaporation,bands,[&](int b)
+    {
+        int first = b*FusedBandRows;
+        int end = std::min(height,first+FusedBandRows);
+        float maxVelocity = 0.0f;
+
+        for (int y=first; y<end+2; ++y)
+        {
+            if (y > first && y < end-1)
+                outflowFlux(fields,params,y,0,width);
+            if (y-1 >= first && y-1 < end)
+                maxVelocity = std::max(maxVelocity,waterVelocity(fields,params,y-1,0,width));
+            if (y-1 > first && y-1 < end-1)
+                terrainSlope(fields,params,y-1,0,width);
+            if (y-2 >= first)
             {
-                water(y,x) = 0.0f;
+                erosion(fields,params,y-2,0,width);
+                evaporation(fields,params,y-2,0,width);
             }
         }
-    }
-#if defined(__APPLE__) || defined(__MACH__)
-    );
-#endif
+        partial[b] = maxVelocity;
+    });
+
+    _maxVelocity = 0.0f;
+    for (int b=0; b<bands; ++b)
+        _maxVelocity = std::max(_maxVelocity,partial[b]);
 }
 
 void FluidSimulation::update(double dt, bool rain, bool flood)
 {
+    Profiler::ScopedStep stepTimer(profiler);
+
     // 1. Add water to the system
     if (rain)
         makeRain(dt);
@@ -529,17 +807,27 @@ void FluidSimulation::update(double dt, bool rain, bool flood)
     if (flood)
         makeFlood(dt);
 
-    // 2. Simulate Flow
-    simulateFlow(dt);
-    // 3. Simulate Errosion-deposition
-    simulateErosion(dt);
-    // 4. Advection of suspended sediment
-    simulateSedimentTransportation(dt);
-    // 5. Simulate Evaporation
-    simulateEvaporation(dt);
+    if (fused && !staggered)
+    {
+        // 2., 3. and 5. in one sweep
+        simulateFused(dt);
+        // 4. Advection of suspended sediment
+        simulateSedimentTransportation(dt);
+    }
+    else
+    {
+        // 2. Simulate Flow
+        simulateFlow(dt);
+        // 3. Simulate Errosion-deposition
+        simulateErosion(dt);
+        // 4. Advection of suspended sediment
+        simulateSedimentTransportation(dt);
+        // 5. Simulate Evaporation
+        simulateEvaporation(dt);
+    }
 
+    markDirtyRows();
     smoothTerrain();
-    computeSurfaceNormals();
 
 
 }
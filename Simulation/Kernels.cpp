@@ -0,0 +1,501 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#include "Kernels.h"
+
+#include "Exception.h"
+#include "Math/MathUtil.h"
+
+#include <cfloat>
+#include <stdlib.h>
+#include <iostream>
+
+using namespace Simulation;
+using namespace Simulation::Kernels;
+using namespace glm;
+using namespace std;
+
+// Kernel variants
+//////////////////////////////////////////////
+
+const char* Simulation::KernelVariantName(KernelVariant variant)
+{
+    switch (variant)
+    {
+    case KernelVariant::SSE4:   return "sse4";
+    case KernelVariant::AVX2:   return "avx2";
+    case KernelVariant::AVX512: return "avx512";
+    default:                    return "scalar";
+    }
+}
+
+KernelVariant Simulation::ParseKernelVariant(const std::string& name)
+{
+    if (name == "scalar") return KernelVariant::Scalar;
+    if (name == "sse4") return KernelVariant::SSE4;
+    if (name == "avx2") return KernelVariant::AVX2;
+    if (name == "avx512") return KernelVariant::AVX512;
+    throw Exception("Unknown kernel variant '" + name + "'.");
+}
+
+bool Simulation::KernelVariantSupported(KernelVariant variant)
+{
+    switch (variant)
+    {
+    case KernelVariant::Scalar:
+        return true;
+#if defined(KERNELS_X86)
+    case KernelVariant::SSE4:
+        return __builtin_cpu_supports("sse4.2");
+    case KernelVariant::AVX2:
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c");
+    case KernelVariant::AVX512:
+        return __builtin_cpu_supports("avx512f");
+#endif
+    default:
+        return false;
+    }
+}
+
+KernelVariant Simulation::BestKernelVariant()
+{
+    for (uint v=uint(KernelVariant::Count)-1; v>0; v--)
+    {
+        if (KernelVariantSupported(KernelVariant(v)))
+            return KernelVariant(v);
+    }
+    return KernelVariant::Scalar;
+}
+
+KernelVariant Simulation::DefaultKernelVariant()
+{
+    KernelVariant best = BestKernelVariant();
+
+    const char* limit = getenv("TERRAIN_KERNELS");
+    if (!limit || !*limit)
+        return best;
+
+    try
+    {
+        return KernelVariant(std::min(uint(best),uint(ParseKernelVariant(limit))));
+    }
+    catch (Exception& e)
+    {
+        std::cerr << "TERRAIN_KERNELS ignored: " << e.what() << "\n";
+        return best;
+    }
+}
+
+// Portable kernels
+//////////////////////////////////////////////
+
+// The bodies are force-inlined into one wrapper per instruction set, so the
+// compiler vectorizes each copy for its target. Without -ffast-math it may not
+// reorder floating point operations and Simulation.pri disables FMA
+// contraction, which keeps all copies bit-identical.
+
+#define KERNEL_INLINE static inline __attribute__((always_inline))
+
+// The velocity, erosion and transport kernels are templated on the storage
+// type S of the velocities (float or Half), see Storage.
+
+KERNEL_INLINE void OutflowFluxRow(const Fields& f, const Params& p, int y, int x0, int x1)
+{
+    const float* tRow = f.terrain->row(y);
+    const float* tRowT = f.terrain->row(y+1);
+    const float* tRowB = f.terrain->row(y-1);
+    const float* wRow = f.water->row(y);
+    const float* wRowT = f.water->row(y+1);
+    const float* wRowB = f.water->row(y-1);
+    float* lRow = f.lFlux->row(y);
+    float* rRow = f.rFlux->row(y);
+    float* tRowF = f.tFlux->row(y);
+    float* bRowF = f.bFlux->row(y);
+
+    const float fluxFactor = p.fluxFactor;
+    const float dx = p.dx;
+    const float dy = p.dy;
+    const double dt = p.dt;
+
+    for (int x=x0; x<x1; ++x)
+    {
+        float h0 = tRow[x]+wRow[x];     // water height at current cell
+
+        // outflow to the left, right, bottom and top neighbour
+        float fl = std::max(0.0f, lRow[x] + fluxFactor*(h0 - (tRow[x-1]+wRow[x-1])));
+        float fr = std::max(0.0f, rRow[x] + fluxFactor*(h0 - (tRow[x+1]+wRow[x+1])));
+        float fb = std::max(0.0f, bRowF[x] + fluxFactor*(h0 - (tRowB[x]+wRowB[x])));
+        float ft = std::max(0.0f, tRowF[x] + fluxFactor*(h0 - (tRowT[x]+wRowT[x])));
+
+        // scaling
+        float sumFlux = fl+fr+fb+ft;
+        float K = std::min(1.0f,float((wRow[x]*dx*dy)/(sumFlux*dt)));
+        rRow[x] = fr*K;
+        lRow[x] = fl*K;
+        tRowF[x] = ft*K;
+        bRowF[x] = fb*K;
+    }
+}
+
+template<typename S>
+KERNEL_INLINE float WaterVelocityRow(const Fields& f, const Params& p, int y, int x0, int x1)
+{
+    // the zero halo of the flux grids provides the boundary condition
+    const float* lRow = f.lFlux->row(y);
+    const float* rRow = f.rFlux->row(y);
+    const float* tRowF = f.tFlux->row(y);
+    const float* bRowF = f.bFlux->row(y);
+    const float* tRowB = f.tFlux->row(y-1);   // top outflow of the cell below
+    const float* bRowT = f.bFlux->row(y+1);   // bottom outflow of the cell above
+    float* wRow = f.water->row(y);
+    S* uRow = &(*Storage<S>::Pick(f.uVel,f.uVelHalf))(y,0);
+    S* vRow = &(*Storage<S>::Pick(f.vVel,f.vVelHalf))(y,0);
+
+    const float dx = p.dx;
+    const float dy = p.dy;
+    const double dt = p.dt;
+    float maxSpeed = 0.0f;
+
+    for (int x=x0; x<x1; ++x)
+    {
+        float inFlow = rRow[x-1] + lRow[x+1] + tRowB[x] + bRowT[x];
+        float outFlow = rRow[x] + lRow[x] + tRowF[x] + bRowF[x];
+        float dV = dt*(inFlow-outFlow);
+        float oldWater = wRow[x];
+        float newWater = oldWater + dV/(dx*dy);
+        newWater = std::max(newWater,0.0f);
+        wRow[x] = newWater;
+        float meanWater = 0.5*(oldWater+newWater);
+
+        // (near) dry cells have no velocity, the same test as the SIMD kernels
+        float uDepth = dy*meanWater;
+        float vDepth = dx*meanWater;
+        uRow[x] = uDepth < FLT_MIN ? 0.0f : 0.5*(rRow[x-1]-lRow[x]-lRow[x+1]+rRow[x])/uDepth;
+        vRow[x] = vDepth < FLT_MIN ? 0.0f : 0.5*(tRowB[x]-bRowF[x]-bRowT[x]+tRowF[x])/vDepth;
+        maxSpeed = std::max(maxSpeed,std::max(std::abs(float(uRow[x])),std::abs(float(vRow[x]))));
+    }
+    return maxSpeed;
+}
+
+// The staggered flux xFlux(y,x) is the flow from cell x to x+1 (negative
+// from x+1 to x), yFlux(y,x) from row y to y+1. The flux over the left and
+// bottom edge of a cell is stored by the neighbour, in the zero halo at the
+// domain border.
+//
+// Every edge is updated like the two outflow pipes it replaces: the part of
+// the flux leaving each cell is accelerated by the height difference and
+// clamped at zero, then scaled by the K of the cell it leaves, and the net
+// flow is stored. This equals the outflow model as long as an edge does not
+// carry flow in both directions. Both cells of an edge evaluate its outflows
+// with the same operations.
+
+/// Outflow from the cell with height h0 over an edge with flux towards the
+/// neighbour, before scaling.
+static inline float EdgeOutflow(float flux, float fluxFactor, float h0, float h1)
+{
+    return std::max(0.0f, std::max(flux,0.0f) + fluxFactor*(h0 - h1));
+}
+
+KERNEL_INLINE void EdgeFluxScaleRow(const Fields& f, const Params& p, int y, int x0, int x1)
+{
+    const float* tRow = f.terrain->row(y);
+    const float* tRowT = f.terrain->row(y+1);
+    const float* tRowB = f.terrain->row(y-1);
+    const float* wRow = f.water->row(y);
+    const float* wRowT = f.water->row(y+1);
+    const float* wRowB = f.water->row(y-1);
+    const float* xRow = f.xFlux->row(y);
+    const float* yRow = f.yFlux->row(y);
+    const float* yRowB = f.yFlux->row(y-1);
+    float* kRow = &(*f.uVel)(y,0);
+
+    const float fluxFactor = p.fluxFactor;
+    const float dx = p.dx;
+    const float dy = p.dy;
+    const double dt = p.dt;
+
+    for (int x=x0; x<x1; ++x)
+    {
+        float h0 = tRow[x]+wRow[x];
+
+        // outflow over the right, left, top and bottom edge
+        float fr = EdgeOutflow(xRow[x],fluxFactor,h0,tRow[x+1]+wRow[x+1]);
+        float fl = EdgeOutflow(-xRow[x-1],fluxFactor,h0,tRow[x-1]+wRow[x-1]);
+        float ft = EdgeOutflow(yRow[x],fluxFactor,h0,tRowT[x]+wRowT[x]);
+        float fb = EdgeOutflow(-yRowB[x],fluxFactor,h0,tRowB[x]+wRowB[x]);
+
+        float sumFlux = fl+fr+fb+ft;
+        kRow[x] = std::min(1.0f,float((wRow[x]*dx*dy)/(sumFlux*dt)));
+    }
+}
+
+KERNEL_INLINE void EdgeFluxRow(const Fields& f, const Params& p, int y, int x0, int x1)
+{
+    const int w = f.water->width();
+    const int h = f.water->height();
+
+    const float* tRow = f.terrain->row(y);
+    const float* tRowT = f.terrain->row(y+1);
+    const float* wRow = f.water->row(y);
+    const float* wRowT = f.water->row(y+1);
+    float* xRow = f.xFlux->row(y);
+    float* yRow = f.yFlux->row(y);
+    const float* kRow = &(*f.uVel)(y,0);
+
+    const float fluxFactor = p.fluxFactor;
+
+    // the right edge of the last column and the top edge of the last row are
+    // the closed domain border and stay zero
+    const int xEnd = std::min(x1,w-1);
+    for (int x=x0; x<xEnd; ++x)
+    {
+        float h0 = tRow[x]+wRow[x];
+        float h1 = tRow[x+1]+wRow[x+1];
+        float out0 = EdgeOutflow(xRow[x],fluxFactor,h0,h1);
+        float out1 = EdgeOutflow(-xRow[x],fluxFactor,h1,h0);
+        xRow[x] = out0*kRow[x] - out1*kRow[x+1];
+    }
+
+    if (y == h-1)
+        return;
+
+    const float* kRowT = &(*f.uVel)(y+1,0);
+    for (int x=x0; x<x1; ++x)
+    {
+        float h0 = tRow[x]+wRow[x];
+        float h1 = tRowT[x]+wRowT[x];
+        float out0 = EdgeOutflow(yRow[x],fluxFactor,h0,h1);
+        float out1 = EdgeOutflow(-yRow[x],fluxFactor,h1,h0);
+        yRow[x] = out0*kRow[x] - out1*kRowT[x];
+    }
+}
+
+KERNEL_INLINE float EdgeWaterVelocityRow(const Fields& f, const Params& p, int y, int x0, int x1)
+{
+    const float* xRow = f.xFlux->row(y);
+    const float* yRow = f.yFlux->row(y);
+    const float* yRowB = f.yFlux->row(y-1);
+    float* wRow = f.water->row(y);
+    float* uRow = &(*f.uVel)(y,0);
+    float* vRow = &(*f.vVel)(y,0);
+
+    const float dx = p.dx;
+    const float dy = p.dy;
+    const double dt = p.dt;
+    float maxSpeed = 0.0f;
+
+    for (int x=x0; x<x1; ++x)
+    {
+        float fl = xRow[x-1];
+        float fr = xRow[x];
+        float fb = yRowB[x];
+        float ft = yRow[x];
+
+        float dV = dt*((fl-fr) + (fb-ft));
+        float oldWater = wRow[x];
+        float newWater = oldWater + dV/(dx*dy);
+        newWater = std::max(newWater,0.0f);
+        wRow[x] = newWater;
+        float meanWater = 0.5*(oldWater+newWater);
+
+        float uDepth = dy*meanWater;
+        float vDepth = dx*meanWater;
+        uRow[x] = uDepth < FLT_MIN ? 0.0f : 0.5*(fl+fr)/uDepth;
+        vRow[x] = vDepth < FLT_MIN ? 0.0f : 0.5*(fb+ft)/vDepth;
+        maxSpeed = std::max(maxSpeed,std::max(std::abs(uRow[x]),std::abs(vRow[x])));
+    }
+    return maxSpeed;
+}
+
+KERNEL_INLINE void TerrainSlopeRow(const Fields& f, const Params&, int y, int x0, int x1)
+{
+    const float* tRow = f.terrain->row(y);
+    const float* tRowT = f.terrain->row(y+1);
+    const float* tRowB = f.terrain->row(y-1);
+    float* slope = &(*f.slope)(y,0);
+
+    for (int x=x0; x<x1; ++x)
+    {
+        // the normal is (gx,gy,2) normalized, sin(acos(n.z)) = |g|/|(gx,gy,2)|
+        float gx = tRow[x+1] - tRow[x-1];
+        float gy = tRowT[x] - tRowB[x];
+        float g2 = gx*gx + gy*gy;
+        slope[x] = sqrtf(g2/(g2+4.0f));
+    }
+}
+
+template<typename S>
+KERNEL_INLINE void ErosionRow(const Fields& f, const Params& p, int y, int x0, int x1)
+{
+    // dissolving and deposition are per step of the 60 Hz reference timestep
+    const float rate = float(p.dt/(1000.0/60));
+
+    const float Kc = 25.0f; // sediment capacity constant
+    const float Ks = 0.0001f*12*10*rate; // dissolving constant
+    const float Kd = 0.0001f*12*10*rate; // deposition constant
+
+    float* tRow = f.terrain->row(y);
+    float* wRow = f.water->row(y);
+    float* sRow = f.sediment->row(y);
+    const float* slopeRow = &(*f.slope)(y,0);
+    const S* uRow = &(*Storage<S>::Pick(f.uVel,f.uVelHalf))(y,0);
+    const S* vRow = &(*Storage<S>::Pick(f.vVel,f.vVelHalf))(y,0);
+
+    for (int x=x0; x<x1; ++x)
+    {
+        // local velocity
+        float uV = uRow[x];
+        float vV = vRow[x];
+
+        // local terrain slope
+        float sinAlpha = std::max(slopeRow[x],0.1f);
+
+        // local sediment capacity of the flow
+        float capacity = Kc * sqrtf(uV*uV+vV*vV)*sinAlpha*(std::min(wRow[x],0.01f)/0.01f) ;
+        float delta = (capacity-sRow[x]);
+
+        if (delta > 0.0f)
+        {
+            float d = Ks*delta;
+            tRow[x] -= d;
+            wRow[x] += d;
+            sRow[x] += d;
+        }
+        // deposit onto ground
+        else if (delta < 0.0f)
+        {
+            float d = Kd*delta;
+            tRow[x] -= d;
+            wRow[x] += d;
+            sRow[x] += d;
+        }
+    }
+}
+
+template<typename S>
+KERNEL_INLINE void SedimentTransportRow(const Fields& f, const Params& p, int y, int x0, int x1)
+{
+    const PaddedGrid2D<float>& sediment = *f.sediment;
+    const S* uRow = &(*Storage<S>::Pick(f.uVel,f.uVelHalf))(y,0);
+    const S* vRow = &(*Storage<S>::Pick(f.vVel,f.vVelHalf))(y,0);
+    float* out = f.sedimentBack->row(y);
+    const double dt = p.dt;
+    const int w = sediment.width();
+    const int h = sediment.height();
+
+    for (int x=x0; x<x1; ++x)
+    {
+        // local velocity
+        float uV = uRow[x];
+        float vV = vRow[x];
+
+        // displacement to where the flow comes from, split into cells and
+        // interpolation factors relative to the cell so the result does not
+        // depend on the position of the grid origin (tiles)
+        float dX = -uV*dt;
+        float dY = -vV*dt;
+        int oX = Floor2Int(dX);
+        int oY = Floor2Int(dY);
+        float fX = dX - oX;
+        float fY = dY - oY;
+
+        // integer coordinates
+        int sx0 = x+oX;
+        int sy0 = y+oY;
+        int sx1 = sx0+1;
+        int sy1 = sy0+1;
+
+        // clamp to grid borders
+        sx0 = clamp(sx0,0,w-1);
+        sx1 = clamp(sx1,0,w-1);
+        sy0 = clamp(sy0,0,h-1);
+        sy1 = clamp(sy1,0,h-1);
+
+        out[x] = mix( mix(sediment(sy0,sx0),sediment(sy0,sx1),fX), mix(sediment(sy1,sx0),sediment(sy1,sx1),fX), fY);
+    }
+}
+
+KERNEL_INLINE void EvaporationRow(const Fields& f, const Params& p, int y, int x0, int x1)
+{
+    const float Ke = 0.00011*0.5; // evaporation constant
+
+    float* wRow = f.water->row(y);
+
+    for (int x=x0; x<x1; ++x)
+    {
+        float water = std::max(wRow[x]*(1-Ke*p.dt),0.0);
+        wRow[x] = (water < 0.005f) ? 0.0f : water;
+    }
+}
+
+KERNEL_INLINE void SurfaceNormalsRow(const Fields& f, const Params& p, int y, int x0, int x1)
+{
+    const float* tRow = f.terrain->row(y);
+    const float* tRowT = f.terrain->row(y+1);
+    const float* tRowB = f.terrain->row(y-1);
+    const float* wRow = f.water->row(y);
+    const float* wRowT = f.water->row(y+1);
+    const float* wRowB = f.water->row(y-1);
+    PackedNormal* normals = &(*f.normals)(y,0);
+
+    for (int x=x0; x<x1; ++x)
+    {
+        float r,l,t,b;
+        vec3 N;
+        r = tRow[x+1] + wRow[x+1];
+        l = tRow[x-1] + wRow[x-1];
+        t = tRowT[x] + wRowT[x];
+        b = tRowB[x] + wRowB[x];
+
+        // the encoding normalizes
+        N = vec3(l-r, t - b, 2 );
+
+        normals[x] = PackedNormal::Encode(N);
+    }
+}
+
+/// Defines the Scalar and SSE4 entry points ENTRY##Scalar, ENTRY##SSE4 of a
+/// portable kernel.
+#define PORTABLE_ENTRY(ENTRY,KERNEL) \
+    void Kernels::ENTRY##Scalar(const Fields& f, const Params& p, int y, int x0, int x1) { KERNEL(f,p,y,x0,x1); } \
+    SSE4_TARGET void Kernels::ENTRY##SSE4(const Fields& f, const Params& p, int y, int x0, int x1) { KERNEL(f,p,y,x0,x1); }
+
+/// Additionally defines the AVX2 and AVX-512 entry points.
+#define PORTABLE_ENTRY_ALL(ENTRY,KERNEL) \
+    PORTABLE_ENTRY(ENTRY,KERNEL) \
+    AVX2_TARGET void Kernels::ENTRY##AVX2(const Fields& f, const Params& p, int y, int x0, int x1) { KERNEL(f,p,y,x0,x1); } \
+    AVX512_TARGET void Kernels::ENTRY##AVX512(const Fields& f, const Params& p, int y, int x0, int x1) { KERNEL(f,p,y,x0,x1); }
+
+#define PORTABLE_KERNEL(NAME) PORTABLE_ENTRY(NAME,NAME)
+#define PORTABLE_KERNEL_ALL(NAME) PORTABLE_ENTRY_ALL(NAME,NAME)
+
+// AVX2 and AVX-512 variants of the flow and the terrain slope are in FlowKernels.cpp
+PORTABLE_KERNEL(OutflowFluxRow)
+
+float Kernels::WaterVelocityRowScalar(const Fields& f, const Params& p, int y, int x0, int x1) { return WaterVelocityRow<float>(f,p,y,x0,x1); }
+SSE4_TARGET float Kernels::WaterVelocityRowSSE4(const Fields& f, const Params& p, int y, int x0, int x1) { return WaterVelocityRow<float>(f,p,y,x0,x1); }
+float Kernels::WaterVelocityHalfRowScalar(const Fields& f, const Params& p, int y, int x0, int x1) { return WaterVelocityRow<Half>(f,p,y,x0,x1); }
+SSE4_TARGET float Kernels::WaterVelocityHalfRowSSE4(const Fields& f, const Params& p, int y, int x0, int x1) { return WaterVelocityRow<Half>(f,p,y,x0,x1); }
+
+PORTABLE_KERNEL(EdgeFluxScaleRow)
+PORTABLE_KERNEL(EdgeFluxRow)
+
+float Kernels::EdgeWaterVelocityRowScalar(const Fields& f, const Params& p, int y, int x0, int x1) { return EdgeWaterVelocityRow(f,p,y,x0,x1); }
+SSE4_TARGET float Kernels::EdgeWaterVelocityRowSSE4(const Fields& f, const Params& p, int y, int x0, int x1) { return EdgeWaterVelocityRow(f,p,y,x0,x1); }
+
+PORTABLE_KERNEL(TerrainSlopeRow)
+PORTABLE_ENTRY_ALL(ErosionRow,ErosionRow<float>)
+PORTABLE_ENTRY_ALL(ErosionHalfRow,ErosionRow<Half>)
+PORTABLE_ENTRY_ALL(SedimentTransportRow,SedimentTransportRow<float>)
+PORTABLE_ENTRY_ALL(SedimentTransportHalfRow,SedimentTransportRow<Half>)
+
+PORTABLE_KERNEL_ALL(EvaporationRow)
+PORTABLE_KERNEL_ALL(SurfaceNormalsRow)
@@ -0,0 +1,236 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include "platform_includes.h"
+#include "Grid2D.h"
+#include "PaddedGrid2D.h"
+#include "Half.h"
+#include "PackedNormal.h"
+
+#include <string>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNELS_X86
+#define SSE4_TARGET __attribute__((target("sse4.2")))
+#define AVX2_TARGET __attribute__((target("avx2,fma,f16c")))
+#define AVX512_TARGET __attribute__((target("avx512f")))
+#else
+#define SSE4_TARGET
+#define AVX2_TARGET
+#define AVX512_TARGET
+#endif
+
+namespace Simulation {
+
+/// Instruction set a kernel implementation is compiled for, ordered from
+/// the most portable to the most recent.
+enum class KernelVariant : uint
+{
+    Scalar,     /// portable reference implementation
+    SSE4,       /// SSE4.2
+    AVX2,       /// AVX2 + FMA + F16C
+    AVX512,     /// AVX-512F
+    Count
+};
+
+const char* KernelVariantName(KernelVariant variant);
+
+/// Parses "scalar", "sse4", "avx2" or "avx512", throws an Exception otherwise.
+KernelVariant ParseKernelVariant(const std::string& name);
+
+/// True if the variant was compiled in and the CPU can execute it.
+bool KernelVariantSupported(KernelVariant variant);
+
+/// Most recent variant the CPU supports.
+KernelVariant BestKernelVariant();
+
+/// Variant the simulation starts with: BestKernelVariant(), limited by the
+/// TERRAIN_KERNELS environment variable if it is set (e.g. "sse4" to test
+/// the fallback path on a newer machine). Unknown values are ignored.
+KernelVariant DefaultKernelVariant();
+
+namespace Kernels {
+
+/// Grids read and written by the row kernels.
+struct Fields
+{
+    PaddedGrid2D<float>* terrain;
+    PaddedGrid2D<float>* water;
+    PaddedGrid2D<float>* sediment;
+    PaddedGrid2D<float>* sedimentBack;  /// back buffer of the sediment
+    PaddedGrid2D<float>* lFlux;
+    PaddedGrid2D<float>* rFlux;
+    PaddedGrid2D<float>* tFlux;
+    PaddedGrid2D<float>* bFlux;
+    PaddedGrid2D<float>* xFlux;         /// staggered flux over the right edges
+    PaddedGrid2D<float>* yFlux;         /// staggered flux over the top edges
+    Grid2D<float>* uVel;
+    Grid2D<float>* vVel;
+    Grid2D<PackedNormal>* normals;
+    // velocities in half precision, the *HalfRow kernels use them instead
+    // of the float grids
+    Grid2D<Half>* uVelHalf;
+    Grid2D<Half>* vVelHalf;
+    Grid2D<float>* slope;               /// sin of the terrain slope, see TerrainSlopeRow
+};
+
+/// Picks the float or the Half grid of a field for kernels templated on the
+/// storage type S.
+template<typename S> struct Storage;
+
+template<> struct Storage<float>
+{
+    static Grid2D<float>* Pick(Grid2D<float>* grid, Grid2D<Half>*) { return grid; }
+};
+
+template<> struct Storage<Half>
+{
+    static Grid2D<Half>* Pick(Grid2D<float>*, Grid2D<Half>* grid) { return grid; }
+};
+
+struct Params
+{
+    double dt;
+    float fluxFactor;   /// dt*A*g/l
+    float dx;
+    float dy;
+};
+
+/// Processes the cells [x0,x1) of row y of one stage. Rows of a pass are
+/// independent and may run in parallel unless noted otherwise.
+typedef void (*RowFn)(const Fields& f, const Params& p, int y, int x0, int x1);
+
+/// Row kernel that also returns the largest value of a quantity over the
+/// processed cells, for reductions fused into a pass.
+typedef float (*MaxRowFn)(const Fields& f, const Params& p, int y, int x0, int x1);
+
+// Every kernel is compiled once per KernelVariant. Unless noted otherwise the
+// variants are the same source compiled for the respective instruction set and
+// produce results identical to the scalar reference.
+
+/// Outflow flux (first pass of FluidSimulation::simulateFlow).
+/// Requires the clamped halo of terrain and water to be up to date.
+void OutflowFluxRowScalar(const Fields& f, const Params& p, int y, int x0, int x1);
+void OutflowFluxRowSSE4(const Fields& f, const Params& p, int y, int x0, int x1);
+void OutflowFluxRowAVX2(const Fields& f, const Params& p, int y, int x0, int x1);
+void OutflowFluxRowAVX512(const Fields& f, const Params& p, int y, int x0, int x1);
+
+/// Water height and velocity (second pass of simulateFlow).
+/// Requires all fluxes of rows y-1..y+1 to be computed. Returns the largest
+/// |u| or |v| of the cells, which bounds the stable timestep.
+float WaterVelocityRowScalar(const Fields& f, const Params& p, int y, int x0, int x1);
+float WaterVelocityRowSSE4(const Fields& f, const Params& p, int y, int x0, int x1);
+float WaterVelocityRowAVX2(const Fields& f, const Params& p, int y, int x0, int x1);
+float WaterVelocityRowAVX512(const Fields& f, const Params& p, int y, int x0, int x1);
+
+// The AVX2 and AVX-512 flow kernels are hand vectorized. They replace
+// divisions by a reciprocal estimate with one Newton-Raphson step, use FMA
+// and evaluate in single precision. Divisors below FLT_MIN are clamped to
+// FLT_MIN, where the estimate would overflow, and cells whose mean water
+// depth times dx or dy is below FLT_MIN get zero velocity in every variant.
+// After one step every field differs from the scalar reference by at most
+// VectorizedFlowTolerance times the largest magnitude of that field, also
+// for dry and near-dry cells (Tests/KernelTests.cpp). Pointwise relative
+// errors of values close to zero are larger due to cancellation (e.g.
+// velocities).
+
+/// Bound of the difference of the hand vectorized flow kernels to the
+/// scalar reference after one step, relative to the largest magnitude of
+/// the field.
+const float VectorizedFlowTolerance = 1e-6f;
+
+// Half precision storage (FluidSimulation::halfPrecision): same as the kernels
+// above, except that the velocities are written to and read from the Half
+// grids of Fields. Values are converted in registers, all arithmetic stays in
+// single precision. The outflow fluxes stay in single precision, the flow
+// uses OutflowFluxRow in both modes.
+
+float WaterVelocityHalfRowScalar(const Fields& f, const Params& p, int y, int x0, int x1);
+float WaterVelocityHalfRowSSE4(const Fields& f, const Params& p, int y, int x0, int x1);
+float WaterVelocityHalfRowAVX2(const Fields& f, const Params& p, int y, int x0, int x1);
+float WaterVelocityHalfRowAVX512(const Fields& f, const Params& p, int y, int x0, int x1);
+
+// Staggered flow: one signed flux per cell edge instead of four outflows per
+// cell (FluidSimulation::staggered). The AVX2 and AVX-512 variants are hand
+// vectorized with the same approximations as the flow kernels above.
+
+/// Outflow scaling K of the staggered flow (first pass of the staggered
+/// simulateFlow). Stores K in uVel, which the velocity pass overwrites.
+/// Requires the clamped halo of terrain and water.
+void EdgeFluxScaleRowScalar(const Fields& f, const Params& p, int y, int x0, int x1);
+void EdgeFluxScaleRowSSE4(const Fields& f, const Params& p, int y, int x0, int x1);
+void EdgeFluxScaleRowAVX2(const Fields& f, const Params& p, int y, int x0, int x1);
+void EdgeFluxScaleRowAVX512(const Fields& f, const Params& p, int y, int x0, int x1);
+
+/// Staggered flux over the right and top edge of each cell, scaled by the K
+/// of the cell it flows out of. Requires K of rows y and y+1. Overwrites the
+/// previous flux, which EdgeFluxScaleRow of row y+1 reads.
+void EdgeFluxRowScalar(const Fields& f, const Params& p, int y, int x0, int x1);
+void EdgeFluxRowSSE4(const Fields& f, const Params& p, int y, int x0, int x1);
+void EdgeFluxRowAVX2(const Fields& f, const Params& p, int y, int x0, int x1);
+void EdgeFluxRowAVX512(const Fields& f, const Params& p, int y, int x0, int x1);
+
+/// Water height and velocity from the staggered fluxes, requires the fluxes
+/// of rows y-1 and y. Returns the largest |u| or |v| like WaterVelocityRow.
+float EdgeWaterVelocityRowScalar(const Fields& f, const Params& p, int y, int x0, int x1);
+float EdgeWaterVelocityRowSSE4(const Fields& f, const Params& p, int y, int x0, int x1);
+float EdgeWaterVelocityRowAVX2(const Fields& f, const Params& p, int y, int x0, int x1);
+float EdgeWaterVelocityRowAVX512(const Fields& f, const Params& p, int y, int x0, int x1);
+
+/// Sine of the slope of the terrain, from the central differences of rows
+/// y-1..y+1. Requires the terrain halo. Every variant gives identical results.
+void TerrainSlopeRowScalar(const Fields& f, const Params& p, int y, int x0, int x1);
+void TerrainSlopeRowSSE4(const Fields& f, const Params& p, int y, int x0, int x1);
+void TerrainSlopeRowAVX2(const Fields& f, const Params& p, int y, int x0, int x1);
+void TerrainSlopeRowAVX512(const Fields& f, const Params& p, int y, int x0, int x1);
+
+/// Erosion and deposition, reads the slope of the terrain before the erosion
+/// (TerrainSlopeRow) and otherwise only cell x, so the rows and cells can be
+/// processed in any order. The rates scale with p.dt.
+void ErosionRowScalar(const Fields& f, const Params& p, int y, int x0, int x1);
+void ErosionRowSSE4(const Fields& f, const Params& p, int y, int x0, int x1);
+void ErosionRowAVX2(const Fields& f, const Params& p, int y, int x0, int x1);
+void ErosionRowAVX512(const Fields& f, const Params& p, int y, int x0, int x1);
+
+/// Semi-lagrangian advection of the sediment into sedimentBack.
+void SedimentTransportRowScalar(const Fields& f, const Params& p, int y, int x0, int x1);
+void SedimentTransportRowSSE4(const Fields& f, const Params& p, int y, int x0, int x1);
+void SedimentTransportRowAVX2(const Fields& f, const Params& p, int y, int x0, int x1);
+void SedimentTransportRowAVX512(const Fields& f, const Params& p, int y, int x0, int x1);
+
+/// ErosionRow and SedimentTransportRow with the half precision velocities.
+void ErosionHalfRowScalar(const Fields& f, const Params& p, int y, int x0, int x1);
+void ErosionHalfRowSSE4(const Fields& f, const Params& p, int y, int x0, int x1);
+void ErosionHalfRowAVX2(const Fields& f, const Params& p, int y, int x0, int x1);
+void ErosionHalfRowAVX512(const Fields& f, const Params& p, int y, int x0, int x1);
+void SedimentTransportHalfRowScalar(const Fields& f, const Params& p, int y, int x0, int x1);
+void SedimentTransportHalfRowSSE4(const Fields& f, const Params& p, int y, int x0, int x1);
+void SedimentTransportHalfRowAVX2(const Fields& f, const Params& p, int y, int x0, int x1);
+void SedimentTransportHalfRowAVX512(const Fields& f, const Params& p, int y, int x0, int x1);
+
+void EvaporationRowScalar(const Fields& f, const Params& p, int y, int x0, int x1);
+void EvaporationRowSSE4(const Fields& f, const Params& p, int y, int x0, int x1);
+void EvaporationRowAVX2(const Fields& f, const Params& p, int y, int x0, int x1);
+void EvaporationRowAVX512(const Fields& f, const Params& p, int y, int x0, int x1);
+
+/// Normals of the water surface, requires the halo of terrain and water.
+void SurfaceNormalsRowScalar(const Fields& f, const Params& p, int y, int x0, int x1);
+void SurfaceNormalsRowSSE4(const Fields& f, const Params& p, int y, int x0, int x1);
+void SurfaceNormalsRowAVX2(const Fields& f, const Params& p, int y, int x0, int x1);
+void SurfaceNormalsRowAVX512(const Fields& f, const Params& p, int y, int x0, int x1);
+
+} // namespace Kernels
+} // namespace Simulation
+
+#endif // KERNELS_H
@@ -0,0 +1,462 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#include "Parallel.h"
+#include "Exception.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__APPLE__) || defined(__MACH__)
+#include <dispatch/dispatch.h>
+#endif
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace Simulation;
+
+const char* Simulation::ParallelBackendName(ParallelBackend backend)
+{
+    switch (backend)
+    {
+    case ParallelBackend::OpenMP:     return "omp";
+    case ParallelBackend::ThreadPool: return "pool";
+    case ParallelBackend::GCD:        return "gcd";
+    case ParallelBackend::Host:       return "host";
+    default:                          return "serial";
+    }
+}
+
+ParallelBackend Simulation::ParseParallelBackend(const std::string& name)
+{
+    if (name == "serial") return ParallelBackend::Serial;
+    if (name == "omp") return ParallelBackend::OpenMP;
+    if (name == "pool") return ParallelBackend::ThreadPool;
+    if (name == "gcd") return ParallelBackend::GCD;
+    if (name == "host") return ParallelBackend::Host;
+    throw Exception("Unknown parallel backend '" + name + "'.");
+}
+
+bool Simulation::ParallelBackendSupported(ParallelBackend backend)
+{
+    switch (backend)
+    {
+    case ParallelBackend::Serial:
+    case ParallelBackend::ThreadPool:
+    case ParallelBackend::Host:
+        return true;
+#if defined(_OPENMP)
+    case ParallelBackend::OpenMP:
+        return true;
+#endif
+#if defined(__APPLE__) || defined(__MACH__)
+    case ParallelBackend::GCD:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+const char* Simulation::ScheduleName(Schedule schedule)
+{
+    return schedule == Schedule::Dynamic ? "dynamic" : "static";
+}
+
+Schedule Simulation::ParseSchedule(const std::string& name)
+{
+    if (name == "static") return Schedule::Static;
+    if (name == "dynamic") return Schedule::Dynamic;
+    throw Exception("Unknown schedule '" + name + "'.");
+}
+
+ParallelSettings::ParallelSettings()
+    : threads(0),
+      schedule(Schedule::Static),
+      grain(0),
+      pin(false)
+{
+#if defined(__APPLE__) || defined(__MACH__)
+    backend = ParallelBackend::GCD;
+#elif defined(_OPENMP)
+    backend = ParallelBackend::OpenMP;
+#else
+    backend = ParallelBackend::ThreadPool;
+#endif
+
+    const char* name = getenv("TERRAIN_PARALLEL");
+    if (!name || !*name)
+        return;
+
+    try
+    {
+        ParallelBackend b = ParseParallelBackend(name);
+        if (!ParallelBackendSupported(b) || b == ParallelBackend::Host)
+            throw Exception(std::string("Backend '") + name + "' is not available.");
+        backend = b;
+    }
+    catch (Exception& e)
+    {
+        std::cerr << "TERRAIN_PARALLEL ignored: " << e.what() << "\n";
+    }
+}
+
+// Work distribution
+//////////////////////////////////////////////
+
+/// Worker of the calling thread, and whether it runs inside of a loop.
+static thread_local uint CurrentWorker = 0;
+static thread_local bool InsideLoop = false;
+static thread_local bool Pinned = false;
+
+/// Pins the calling thread to one hardware thread, once.
+static void PinThread(uint worker)
+{
+    if (Pinned) return;
+    Pinned = true;
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(worker % std::max(1u,std::thread::hardware_concurrency()),&set);
+    pthread_setaffinity_np(pthread_self(),sizeof(set),&set);
+#else
+    (void)worker;
+#endif
+}
+
+namespace {
+
+/// Iterations of one worker that nobody took yet.
+struct Range
+{
+    std::mutex mutex;
+    int begin;
+    int end;
+    char padding[64]; // avoid false sharing between workers
+};
+
+/// One loop, split into a range per worker. A worker takes its own
+/// iterations first and steals from the others afterwards, so the loop
+/// completes however many workers actually run.
+class Job
+{
+public:
+    Job(int n, uint workers, Schedule schedule, uint grain, const Parallel::RangeFn& body)
+        : _ranges(new Range[workers]),
+          _workers(workers),
+          _dynamic(schedule == Schedule::Dynamic),
+          _grain(grain ? int(grain) : std::max(1,n/int(8*workers))),
+          _body(body)
+    {
+        for (uint w=0; w<workers; w++)
+        {
+            _ranges[w].begin = int(long(n)*w/workers);
+            _ranges[w].end = int(long(n)*(w+1)/workers);
+        }
+    }
+
+    void run(uint worker)
+    {
+        uint outerWorker = CurrentWorker;
+        CurrentWorker = worker;
+        InsideLoop = true;
+
+        int begin, end;
+        for (;;)
+        {
+            if (take(worker,begin,end))
+                _body(begin,end);
+            else if (!steal(worker))
+                break;
+        }
+
+        InsideLoop = false;
+        CurrentWorker = outerWorker;
+    }
+
+protected:
+    /// The whole range in the static schedule, the next chunk otherwise.
+    bool take(uint worker, int& begin, int& end)
+    {
+        Range& own = _ranges[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (own.begin >= own.end)
+            return false;
+        begin = own.begin;
+        end = _dynamic ? std::min(own.end,own.begin+_grain) : own.end;
+        own.begin = end;
+        return true;
+    }
+
+    /// Moves the upper half of the iterations left to another worker into
+    /// the (empty) range of the thief. The static schedule takes whole blocks,
+    /// which only leaves blocks nobody started, these are moved entirely.
+    bool steal(uint thief)
+    {
+        for (uint i=1; i<_workers; i++)
+        {
+            Range& victim = _ranges[(thief+i)%_workers];
+            int begin, end;
+            {
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                int left = victim.end-victim.begin;
+                if (left <= 0)
+                    continue;
+                begin = victim.begin + (_dynamic && left > _grain ? left/2 : 0);
+                end = victim.end;
+                victim.end = begin;
+            }
+            Range& own = _ranges[thief];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            own.begin = begin;
+            own.end = end;
+            return true;
+        }
+        return false;
+    }
+
+    std::unique_ptr<Range[]> _ranges;
+    const uint _workers;
+    const bool _dynamic;
+    const int _grain;
+    const Parallel::RangeFn& _body;
+};
+
+/// Persistent workers 1 to threads-1, the thread starting a loop is worker 0.
+/// The workers sleep between loops.
+class ThreadPool
+{
+public:
+    ThreadPool(uint threads, bool pin)
+        : _pin(pin),
+          _job(0),
+          _generation(0),
+          _pending(0),
+          _stop(false)
+    {
+        for (uint i=1; i<threads; i++)
+            _threads.push_back(std::thread(&ThreadPool::work,this,i));
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _start.notify_all();
+        for (std::thread& t : _threads)
+            t.join();
+    }
+
+    void run(Job& job)
+    {
+        // one loop at a time if several threads start loops
+        std::lock_guard<std::mutex> runLock(_runMutex);
+        if (_pin)
+            PinThread(0);
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _job = &job;
+            _generation++;
+            _pending = _threads.size();
+        }
+        _start.notify_all();
+
+        job.run(0);
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done.wait(lock,[this]{ return _pending == 0; });
+        _job = 0;
+    }
+
+protected:
+    void work(uint worker)
+    {
+        if (_pin)
+            PinThread(worker);
+
+        ulong seen = 0;
+        for (;;)
+        {
+            Job* job;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _start.wait(lock,[&]{ return _stop || _generation != seen; });
+                if (_stop)
+                    return;
+                seen = _generation;
+                job = _job;
+            }
+
+            job->run(worker);
+
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (--_pending == 0)
+                _done.notify_one();
+        }
+    }
+
+    const bool _pin;
+    std::vector<std::thread> _threads;
+    std::mutex _runMutex;
+    std::mutex _mutex;
+    std::condition_variable _start;
+    std::condition_variable _done;
+    Job* _job;
+    ulong _generation;
+    uint _pending;
+    bool _stop;
+};
+
+} // namespace
+
+// Loops
+//////////////////////////////////////////////
+
+static ParallelSettings& CurrentSettings()
+{
+    static ParallelSettings settings;
+    return settings;
+}
+
+static std::mutex PoolMutex;
+static std::unique_ptr<ThreadPool> Pool;
+
+void Parallel::Configure(const ParallelSettings& settings)
+{
+    if (!ParallelBackendSupported(settings.backend))
+        throw Exception(std::string("Parallel backend '") + ParallelBackendName(settings.backend) + "' is not available.");
+    if (settings.backend == ParallelBackend::Host && !settings.host)
+        throw Exception("The host parallel backend needs ParallelSettings::host.");
+
+    std::lock_guard<std::mutex> lock(PoolMutex);
+    Pool.reset();
+    CurrentSettings() = settings;
+}
+
+const ParallelSettings& Parallel::Settings()
+{
+    return CurrentSettings();
+}
+
+uint Parallel::Threads()
+{
+    const ParallelSettings& settings = Settings();
+    if (settings.backend == ParallelBackend::Serial)
+        return 1;
+    if (settings.threads)
+        return settings.threads;
+#if defined(_OPENMP)
+    if (settings.backend == ParallelBackend::OpenMP)
+        return omp_get_max_threads();
+#endif
+    return std::max(1u,std::thread::hardware_concurrency());
+}
+
+uint Parallel::ThreadIndex()
+{
+    return CurrentWorker;
+}
+
+void Parallel::For(int n, const RangeFn& body)
+{
+    const ParallelSettings& settings = Settings();
+    For(n,settings.schedule,settings.grain,body);
+}
+
+void Parallel::For(int n, Schedule schedule, uint grain, const RangeFn& body)
+{
+    if (n <= 0)
+        return;
+
+    const ParallelSettings& settings = Settings();
+    const uint workers = Threads();
+
+    // nested loops run on the worker that started them
+    if (InsideLoop || workers == 1 || n == 1)
+    {
+        body(0,n);
+        return;
+    }
+
+    Job job(n,workers,schedule,grain,body);
+
+    switch (settings.backend)
+    {
+#if defined(_OPENMP)
+    case ParallelBackend::OpenMP:
+        #pragma omp parallel num_threads(workers)
+        {
+            if (settings.pin)
+                PinThread(omp_get_thread_num());
+            job.run(omp_get_thread_num());
+        }
+        break;
+#endif
+#if defined(__APPLE__) || defined(__MACH__)
+    case ParallelBackend::GCD:
+    {
+        Job* j = &job;
+        dispatch_apply(workers, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t i)
+        {
+            j->run(i);
+        });
+        break;
+    }
+#endif
+    case ParallelBackend::Host:
+        settings.host(workers,[&job](uint worker){ job.run(worker); });
+        break;
+    default:
+    {
+        ThreadPool* pool;
+        {
+            std::lock_guard<std::mutex> lock(PoolMutex);
+            if (!Pool)
+                Pool.reset(new ThreadPool(workers,settings.pin));
+            pool = Pool.get();
+        }
+        pool->run(job);
+        break;
+    }
+    }
+}
+
+void Parallel::For2D(glm::ivec2 size, glm::ivec2 block, Schedule schedule, uint grain, const BlockFn& fn)
+{
+    if (size.x <= 0 || size.y <= 0)
+        return;
+
+    const int blocksX = (size.x+block.x-1)/block.x;
+    const int blocksY = (size.y+block.y-1)/block.y;
+    For(blocksX*blocksY,schedule,grain,[&](int begin, int end)
+    {
+        for (int i=begin; i<end; ++i)
+        {
+            glm::ivec2 first(i%blocksX*block.x,i/blocksX*block.y);
+            glm::ivec2 last(std::min(first.x+block.x,size.x),std::min(first.y+block.y,size.y));
+            fn(first,last);
+        }
+    });
+}
@@ -0,0 +1,132 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "platform_includes.h"
+
+#include <functional>
+#include <string>
+
+namespace Simulation {
+
+/// Threads that run the parallel loops of the simulation, see Parallel::For().
+enum class ParallelBackend : uint
+{
+    Serial,         /// the calling thread only
+    OpenMP,         /// the OpenMP thread team
+    ThreadPool,     /// persistent std::thread pool, the calling thread is worker 0
+    GCD,            /// libdispatch global queue (macOS)
+    Host,           /// thread pool of the embedding application, see ParallelSettings::host
+    Count
+};
+
+const char* ParallelBackendName(ParallelBackend backend);
+
+/// Parses "serial", "omp", "pool", "gcd" or "host", throws an Exception otherwise.
+ParallelBackend ParseParallelBackend(const std::string& name);
+
+/// True if the backend was compiled in.
+bool ParallelBackendSupported(ParallelBackend backend);
+
+/// How the iterations of a loop are distributed over the workers.
+enum class Schedule : uint
+{
+    Static,     /// one contiguous block per worker, like omp schedule(static)
+    Dynamic,    /// chunks of grain iterations, idle workers steal half of the rest of a busy one
+    Count
+};
+
+const char* ScheduleName(Schedule schedule);
+
+/// Parses "static" or "dynamic", throws an Exception otherwise.
+Schedule ParseSchedule(const std::string& name);
+
+/// Runs worker(0) to worker(workers-1) and returns once all of them returned.
+/// The calls may run concurrently or one after another: a worker that starts
+/// late finds its iterations taken by the others.
+typedef std::function<void(uint workers, const std::function<void(uint worker)>& worker)> HostDispatch;
+
+struct ParallelSettings
+{
+    /// OpenMP if compiled in, GCD on macOS, the thread pool otherwise,
+    /// overridden by the TERRAIN_PARALLEL environment variable (e.g. "pool").
+    ParallelSettings();
+
+    ParallelBackend backend;
+
+    /// Workers per loop, 0 for the default: omp_get_max_threads() with
+    /// OpenMP, all hardware threads otherwise.
+    uint threads;
+
+    Schedule schedule;
+
+    /// Iterations per chunk of the dynamic schedule, 0 picks about eight
+    /// chunks per worker.
+    uint grain;
+
+    /// Pins worker i to hardware thread i (Linux, OpenMP and thread pool).
+    bool pin;
+
+    /// Runs the workers of the Host backend.
+    HostDispatch host;
+};
+
+/// Parallel loops of the simulation over pluggable backends.
+///
+/// The kernels write disjoint cells and reduce into one partial result per
+/// iteration, so the results do not depend on the backend, the schedule or
+/// the thread count (Tests/SimulationTests.cpp). Loops started from within a
+/// loop run serially on the calling worker.
+namespace Parallel {
+
+/// Replaces the settings, starts or stops the pool threads. Not to be called
+/// while a loop is running. Throws an Exception if the backend is missing.
+void Configure(const ParallelSettings& settings);
+
+const ParallelSettings& Settings();
+
+/// Workers of a loop, ThreadIndex() is below this.
+uint Threads();
+
+/// Worker running the calling thread, 0 outside of loops.
+uint ThreadIndex();
+
+typedef std::function<void(int begin, int end)> RangeFn;
+typedef std::function<void(glm::ivec2 begin, glm::ivec2 end)> BlockFn;
+
+/// Calls body(begin,end) for disjoint ranges covering [0,n).
+void For(int n, Schedule schedule, uint grain, const RangeFn& body);
+
+/// For() with the configured schedule.
+void For(int n, const RangeFn& body);
+
+/// Calls fn(i) for every i in [0,n).
+template<typename FN>
+inline void ForEach(int n, const FN& fn)
+{
+    For(n,[&fn](int begin, int end)
+    {
+        for (int i=begin; i<end; ++i)
+            fn(i);
+    });
+}
+
+/// Splits [0,size) into blocks of at most block cells and calls
+/// fn(begin,end) for every block. The grain counts blocks.
+void For2D(glm::ivec2 size, glm::ivec2 block, Schedule schedule, uint grain, const BlockFn& fn);
+
+} // namespace Parallel
+
+} // namespace Simulation
+
+#endif // PARALLEL_H
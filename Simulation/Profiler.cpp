@@ -0,0 +1,232 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#include "Profiler.h"
+#include "Parallel.h"
+
+#include <cmath>
+#include <limits>
+
+using namespace Simulation;
+using namespace std::chrono;
+
+const char* Simulation::StageName(Stage stage)
+{
+    switch (stage)
+    {
+    case Stage::Rain:                   return "rain";
+    case Stage::Flood:                  return "flood";
+    case Stage::Flow:                   return "flow";
+    case Stage::Erosion:                return "erosion";
+    case Stage::SedimentTransportation: return "transport";
+    case Stage::Evaporation:            return "evaporation";
+    case Stage::Smoothing:              return "smoothing";
+    case Stage::SurfaceNormals:         return "normals";
+    case Stage::FlowErosionEvaporation: return "fused";
+    case Stage::TemporalBlocking:       return "blocked";
+    default:                            return "unknown";
+    }
+}
+
+// LatencyHistogram
+//////////////////////////////////////////////
+
+LatencyHistogram::LatencyHistogram()
+    : _buckets(BucketCount,0)
+{
+    reset();
+}
+
+void LatencyHistogram::add(double seconds)
+{
+    double us = seconds*1e6;
+    int bucket = 0;
+    if (us > 1.0)
+        bucket = std::min(BucketCount-1, int(std::log2(us)*SubBuckets));
+
+    _buckets[bucket]++;
+    _count++;
+    _sum += seconds;
+    _min = std::min(_min,seconds);
+    _max = std::max(_max,seconds);
+}
+
+void LatencyHistogram::reset()
+{
+    std::fill(_buckets.begin(),_buckets.end(),0);
+    _count = 0;
+    _sum = 0.0;
+    _min = std::numeric_limits<double>::max();
+    _max = 0.0;
+}
+
+double LatencyHistogram::percentile(double p) const
+{
+    if (_count == 0) return 0.0;
+
+    ulong rank = ulong(std::ceil(p*_count));
+    rank = std::max(rank,ulong(1));
+
+    ulong seen = 0;
+    for (int i=0; i<BucketCount; i++)
+    {
+        seen += _buckets[i];
+        if (seen >= rank)
+        {
+            // geometric center of the bucket, limited to the observed range
+            double us = std::pow(2.0,(i+0.5)/SubBuckets);
+            return std::min(std::max(us*1e-6,min()),_max);
+        }
+    }
+    return _max;
+}
+
+// Profiler
+//////////////////////////////////////////////
+
+Profiler::Profiler()
+    : enabled(true),
+      _stages(uint(Stage::Count)),
+      _threadCount(0)
+{
+    prepareThreads();
+}
+
+void Profiler::prepareThreads()
+{
+    uint threads = Parallel::Threads();
+    if (threads <= _threadCount) return;
+
+    _threadCount = threads;
+    for (StageStats& s : _stages)
+    {
+        ThreadTime zero = {};
+        s.threads.resize(_threadCount,zero);
+    }
+}
+
+void Profiler::reset()
+{
+    for (StageStats& s : _stages)
+    {
+        s.latency.reset();
+        for (ThreadTime& t : s.threads)
+            t.busy = 0.0;
+    }
+    _step.reset();
+}
+
+Profiler::ScopedStage::ScopedStage(Profiler& profiler, Stage stage)
+    : _profiler(profiler), _stage(stage)
+{
+    if (_profiler.enabled)
+    {
+        // thread count may change between stages (Parallel::Configure)
+        _profiler.prepareThreads();
+        _start = Clock::now();
+    }
+}
+
+Profiler::ScopedStage::~ScopedStage()
+{
+    if (_profiler.enabled)
+    {
+        double s = duration_cast<duration<double>>(Clock::now()-_start).count();
+        _profiler._stages[uint(_stage)].latency.add(s);
+    }
+}
+
+Profiler::ThreadScope::ThreadScope(Profiler& profiler, Stage stage)
+    : _profiler(profiler), _stage(stage)
+{
+    if (_profiler.enabled)
+        _start = Clock::now();
+}
+
+Profiler::ThreadScope::~ThreadScope()
+{
+    if (!_profiler.enabled) return;
+
+    uint thread = Parallel::ThreadIndex();
+    std::vector<ThreadTime>& threads = _profiler._stages[uint(_stage)].threads;
+    if (thread < threads.size())
+        threads[thread].busy += duration_cast<duration<double>>(Clock::now()-_start).count();
+}
+
+Profiler::ScopedStep::ScopedStep(Profiler& profiler)
+    : _profiler(profiler)
+{
+    if (_profiler.enabled)
+        _start = Clock::now();
+}
+
+Profiler::ScopedStep::~ScopedStep()
+{
+    if (_profiler.enabled)
+        _profiler._step.add(duration_cast<duration<double>>(Clock::now()-_start).count());
+}
+
+// Output
+//////////////////////////////////////////////
+
+static void WriteHistogramJson(std::ostream& out, const LatencyHistogram& h)
+{
+    out << "\"count\": " << h.count()
+        << ", \"total_s\": " << h.total()
+        << ", \"mean_s\": " << h.mean()
+        << ", \"min_s\": " << h.min()
+        << ", \"p50_s\": " << h.percentile(0.5)
+        << ", \"p99_s\": " << h.percentile(0.99)
+        << ", \"max_s\": " << h.max();
+}
+
+void Profiler::writeJson(std::ostream& out) const
+{
+    out << "{\n  \"threads\": " << _threadCount << ",\n";
+    out << "  \"step\": { ";
+    WriteHistogramJson(out,_step);
+    out << " },\n  \"stages\": {\n";
+
+    for (uint i=0; i<_stages.size(); i++)
+    {
+        const StageStats& s = _stages[i];
+        out << "    \"" << StageName(Stage(i)) << "\": { ";
+        WriteHistogramJson(out,s.latency);
+        out << ",\n      \"thread_busy_s\": [";
+        for (uint t=0; t<_threadCount; t++)
+            out << (t ? ", " : "") << s.busy(t);
+        out << "],\n      \"thread_idle_s\": [";
+        for (uint t=0; t<_threadCount; t++)
+            out << (t ? ", " : "") << s.idle(t);
+        out << "] }" << (i+1 < _stages.size() ? "," : "") << "\n";
+    }
+    out << "  }\n}\n";
+}
+
+void Profiler::writeCsv(std::ostream& out) const
+{
+    out << "stage,thread,count,total_s,mean_s,p50_s,p99_s,max_s,busy_s,idle_s\n";
+
+    out << "step,,"  << _step.count() << "," << _step.total() << "," << _step.mean() << ","
+        << _step.percentile(0.5) << "," << _step.percentile(0.99) << "," << _step.max() << ",,\n";
+
+    for (uint i=0; i<_stages.size(); i++)
+    {
+        const StageStats& s = _stages[i];
+        const LatencyHistogram& h = s.latency;
+        for (uint t=0; t<_threadCount; t++)
+        {
+            out << StageName(Stage(i)) << "," << t << "," << h.count() << "," << h.total() << ","
+                << h.mean() << "," << h.percentile(0.5) << "," << h.percentile(0.99) << ","
+                << h.max() << "," << s.busy(t) << "," << s.idle(t) << "\n";
+        }
+    }
+}
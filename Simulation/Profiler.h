@@ -0,0 +1,158 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "platform_includes.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <ostream>
+
+namespace Simulation {
+
+/// Stages of FluidSimulation::update() that are timed individually.
+enum class Stage : uint
+{
+    Rain,
+    Flood,
+    Flow,
+    Erosion,
+    SedimentTransportation,
+    Evaporation,
+    Smoothing,
+    SurfaceNormals,
+    FlowErosionEvaporation,     /// fused sweep, see FluidSimulation::simulateFused()
+    TemporalBlocking,           /// several steps per tile, see TemporalBlocking
+    Count
+};
+
+const char* StageName(Stage stage);
+
+/// Log-scale latency histogram (8 buckets per power of two microseconds).
+/// Percentiles are accurate to roughly 9%, insertion is O(1).
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void add(double seconds);
+    void reset();
+
+    ulong count() const { return _count; }
+    double total() const { return _sum; }
+    double mean() const { return _count ? _sum/_count : 0.0; }
+    double min() const { return _count ? _min : 0.0; }
+    double max() const { return _max; }
+
+    /// Approximate percentile in seconds, p in [0,1].
+    double percentile(double p) const;
+
+protected:
+    static const int SubBuckets = 8;
+    static const int BucketCount = 32*SubBuckets;
+
+    std::vector<ulong> _buckets;
+    ulong _count;
+    double _sum;
+    double _min;
+    double _max;
+};
+
+/// Low overhead timing instrumentation of the simulation stages.
+///
+/// Each stage records its wall time into a histogram. Inside parallel loops
+/// every worker additionally records the time it spent working, the
+/// difference to the stage wall time is reported as idle (imbalance) time.
+class Profiler
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    struct ThreadTime
+    {
+        double busy;
+        char padding[64-sizeof(double)]; // avoid false sharing between threads
+    };
+
+    struct StageStats
+    {
+        LatencyHistogram latency;
+        std::vector<ThreadTime> threads;
+
+        double busy(uint thread) const { return thread < threads.size() ? threads[thread].busy : 0.0; }
+        double idle(uint thread) const { return std::max(0.0, latency.total() - busy(thread)); }
+    };
+
+    Profiler();
+
+    bool enabled;
+
+    /// Measures the wall time of a stage.
+    class ScopedStage
+    {
+    public:
+        ScopedStage(Profiler& profiler, Stage stage);
+        ~ScopedStage();
+    protected:
+        Profiler& _profiler;
+        Stage _stage;
+        Clock::time_point _start;
+    };
+
+    /// Measures the busy time of the calling thread within a parallel region.
+    class ThreadScope
+    {
+    public:
+        ThreadScope(Profiler& profiler, Stage stage);
+        ~ThreadScope();
+    protected:
+        Profiler& _profiler;
+        Stage _stage;
+        Clock::time_point _start;
+    };
+
+    /// Measures the wall time of a whole simulation step.
+    class ScopedStep
+    {
+    public:
+        ScopedStep(Profiler& profiler);
+        ~ScopedStep();
+    protected:
+        Profiler& _profiler;
+        Clock::time_point _start;
+    };
+
+    const StageStats& stage(Stage s) const { return _stages[uint(s)]; }
+    const LatencyHistogram& stepLatency() const { return _step; }
+    uint threadCount() const { return _threadCount; }
+
+    void reset();
+
+    /// Writes all statistics as a JSON object.
+    void writeJson(std::ostream& out) const;
+
+    /// Writes one CSV line per stage and thread.
+    void writeCsv(std::ostream& out) const;
+
+protected:
+    void prepareThreads();
+
+    std::vector<StageStats> _stages;
+    LatencyHistogram _step;
+    uint _threadCount;
+};
+
+} // namespace Simulation
+
+#endif // PROFILER_H
@@ -0,0 +1,48 @@
+# Simulation core shared by the interactive, headless and library builds.
+# Does not depend on GLFW, GLEW or OpenGL.
+
+INCLUDEPATH += $$PWD/.. $$PWD/../external
+
+SOURCES += \
+    $$PWD/FluidSimulation.cpp \
+    $$PWD/BatchRunner.cpp \
+    $$PWD/Profiler.cpp \
+    $$PWD/Parallel.cpp \
+    $$PWD/Kernels.cpp \
+    $$PWD/FlowKernels.cpp \
+    $$PWD/TemporalBlocking.cpp \
+    $$PWD/ActiveTiles.cpp \
+    $$PWD/AdaptiveStepper.cpp \
+    $$PWD/Checkpoint.cpp \
+    $$PWD/../Math/PerlinNoise.cpp
+
+HEADERS += \
+    $$PWD/FluidSimulation.h \
+    $$PWD/BatchRunner.h \
+    $$PWD/Profiler.h \
+    $$PWD/Parallel.h \
+    $$PWD/Kernels.h \
+    $$PWD/TemporalBlocking.h \
+    $$PWD/ActiveTiles.h \
+    $$PWD/AdaptiveStepper.h \
+    $$PWD/Checkpoint.h \
+    $$PWD/../SimulationState.h \
+    $$PWD/../Grid2D.h \
+    $$PWD/../PaddedGrid2D.h \
+    $$PWD/../DoubleBuffer.h \
+    $$PWD/../GridAllocator.h \
+    $$PWD/../GridLayout.h \
+    $$PWD/../Half.h \
+    $$PWD/../PackedNormal.h \
+    $$PWD/../Exception.h \
+    $$PWD/../Math/MathUtil.h \
+    $$PWD/../Math/PerlinNoise.h
+
+# Keeps the kernel variants in Kernels.cpp bit-identical, otherwise the compiler
+# contracts a*b+c to FMA in the AVX2 and AVX-512 copies only.
+unix: QMAKE_CXXFLAGS += -ffp-contract=off
+
+unix:!mac {
+    QMAKE_CXXFLAGS += -fopenmp -pthread
+    QMAKE_LFLAGS += -fopenmp -pthread
+}
@@ -0,0 +1,16 @@
+# Static library containing the simulation without any rendering dependencies.
+
+TEMPLATE = lib
+CONFIG += staticlib
+CONFIG -= qt
+TARGET = TerrainSimulation
+
+DEFINES += HEADLESS_BUILD
+QMAKE_CXXFLAGS += -std=c++11
+
+include(Simulation.pri)
+
+mac {
+    INCLUDEPATH += /usr/local/include
+    QMAKE_CXXFLAGS += -stdlib=libc++
+}
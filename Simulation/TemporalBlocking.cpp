@@ -0,0 +1,268 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#include "TemporalBlocking.h"
+
+#include <cmath>
+
+using namespace Simulation;
+using namespace glm;
+
+static const Stage DispatchedStages[] = { Stage::Flow, Stage::Erosion, Stage::SedimentTransportation,
+                                          Stage::Evaporation, Stage::SurfaceNormals };
+
+/// Copies the rectangle [begin,end) of src, shifted by offset, into dst.
+template<typename SRC, typename DST>
+static void CopyRect(const SRC& src, DST& dst, ivec2 begin, ivec2 end, ivec2 offset)
+{
+    for (int y=begin.y; y<end.y; y++)
+    {
+        const auto* from = &src(y,begin.x);
+        std::copy(from, from+(end.x-begin.x), &dst(y+offset.y,begin.x+offset.x));
+    }
+}
+
+TemporalBlocking::TemporalBlocking(FluidSimulation& simulation)
+    : steps(4),
+      tileSize(256),
+      maxDisplacement(2.0f),
+      fallbacks(0),
+      _simulation(simulation)
+{
+    uint w = simulation.water.width();
+    uint h = simulation.water.height();
+    _terrain = PaddedGrid2D<float>(w,h,1,simulation.terrain.policy());
+    _water = PaddedGrid2D<float>(w,h,1,simulation.water.policy());
+    _sediment = PaddedGrid2D<float>(w,h,1,simulation.sediment.policy());
+    _lFlux = PaddedGrid2D<float>(0,0,1,BoundaryPolicy::Zero);
+    _rFlux = PaddedGrid2D<float>(0,0,1,BoundaryPolicy::Zero);
+    _tFlux = PaddedGrid2D<float>(0,0,1,BoundaryPolicy::Zero);
+    _bFlux = PaddedGrid2D<float>(0,0,1,BoundaryPolicy::Zero);
+    _xFlux = PaddedGrid2D<float>(0,0,1,BoundaryPolicy::Zero);
+    _yFlux = PaddedGrid2D<float>(0,0,1,BoundaryPolicy::Zero);
+    _uVel.resize(w,h);
+    _vVel.resize(w,h);
+}
+
+TemporalBlocking::~TemporalBlocking()
+{
+}
+
+/// Gives output the shape of the grid it is swapped with.
+static void MatchShape(PaddedGrid2D<float>& output, const PaddedGrid2D<float>& grid)
+{
+    if (output.width() != grid.width() || output.height() != grid.height())
+        output.resize(grid.width(),grid.height());
+}
+
+uint TemporalBlocking::stepRadius() const
+{
+    // flux and water update 2, erosion 1, advection (bilinear) ceil(d)+1, smoothing 1
+    return 5 + uint(std::ceil(maxDisplacement));
+}
+
+bool TemporalBlocking::advance(double dt, const std::vector<bool>& rain, const std::vector<bool>& flood)
+{
+    Profiler::ScopedStage stageTimer(_simulation.profiler,Stage::TemporalBlocking);
+
+    // all tiles have to see the same drops
+    _drops.resize(rain.size());
+    for (uint i=0; i<rain.size(); i++)
+    {
+        _drops[i].clear();
+        if (rain[i])
+            _simulation.nextRainDrops(_drops[i]);
+    }
+
+    // the tiles copy single precision fluxes and velocities, half precision
+    // grids are advanced by the regular update
+    _simulation.applyFluxModel();
+    if (_simulation.halfPrecision && !_simulation.staggered)
+    {
+        for (uint i=0; i<rain.size(); i++)
+        {
+            _simulation.addRain(_drops[i],ivec2(0,0));
+            _simulation.update(dt,false,flood[i]);
+        }
+        return true;
+    }
+
+    // the simulation may have been resized since the last block, the outputs
+    // for the fluxes of the model in use follow it and the others stay empty
+    MatchShape(_terrain,_simulation.terrain);
+    MatchShape(_water,_simulation.water);
+    MatchShape(_sediment,_simulation.sediment);
+    _uVel.resize(_simulation.uVel.width(),_simulation.uVel.height());
+    _vVel.resize(_simulation.vVel.width(),_simulation.vVel.height());
+    MatchShape(_lFlux,_simulation.lFlux);
+    MatchShape(_rFlux,_simulation.rFlux);
+    MatchShape(_tFlux,_simulation.tFlux);
+    MatchShape(_bFlux,_simulation.bFlux);
+    MatchShape(_xFlux,_simulation.xFlux);
+    MatchShape(_yFlux,_simulation.yFlux);
+
+    // one private simulation per worker, the thread count may have changed
+    while (_workers.size() < Parallel::Threads())
+        _workers.push_back(std::unique_ptr<Worker>(new Worker()));
+    for (auto& worker : _workers)
+        worker->maxVelocity = 0.0f;
+
+    // Tiles take very different times (dry tiles are cheap, and a tile
+    // stops once the bound is exceeded), so idle workers steal them.
+    _exceeded = false;
+    const ivec2 size(_simulation.water.width(),_simulation.water.height());
+    Parallel::For2D(size,ivec2(tileSize,tileSize),Schedule::Dynamic,1,[&](ivec2 begin, ivec2 end)
+    {
+        Profiler::ThreadScope threadScope(_simulation.profiler,Stage::TemporalBlocking);
+        Tile tile = { begin, end };
+        if (!_exceeded && !runTile(*_workers[Parallel::ThreadIndex()],tile,dt,flood))
+            _exceeded = true;
+    });
+
+    if (_exceeded)
+    {
+        // the input is still untouched, redo the steps with the staged update
+        fallbacks++;
+        for (uint i=0; i<rain.size(); i++)
+        {
+            _simulation.addRain(_drops[i],ivec2(0,0));
+            _simulation.update(dt,false,flood[i]);
+        }
+        return false;
+    }
+
+    // the maximum the velocity pass of the last step reduces
+    _simulation._maxVelocity = 0.0f;
+    for (auto& worker : _workers)
+        _simulation._maxVelocity = std::max(_simulation._maxVelocity,worker->maxVelocity);
+
+    swapOutput();
+    return true;
+}
+
+bool TemporalBlocking::runTile(Worker& worker, const Tile& tile, double dt, const std::vector<bool>& flood)
+{
+    const FluidSimulation& global = _simulation;
+    FluidSimulation& local = worker.simulation;
+
+    int w = global.water.width();
+    int h = global.water.height();
+    int halo = this->halo(flood.size());
+    int radius = stepRadius();
+
+    // tile with halo, clipped to the domain
+    ivec2 begin(std::max(0,tile.begin.x-halo), std::max(0,tile.begin.y-halo));
+    ivec2 end(std::min(w,tile.end.x+halo), std::min(h,tile.end.y+halo));
+    ivec2 size(end.x-begin.x, end.y-begin.y);
+    ivec2 origin(-begin.x,-begin.y);
+
+    local.staggered = global.staggered;
+    local.applyFluxModel();
+    if (int(local.water.width()) != size.x || int(local.water.height()) != size.y)
+    {
+        worker.state.resize(size.x,size.y);
+        local.resize();
+    }
+
+    CopyRect(global.terrain,local.terrain,begin,end,origin);
+    CopyRect(global.water,local.water,begin,end,origin);
+    CopyRect(global.sediment,local.sediment,begin,end,origin);
+    if (global.staggered)
+    {
+        CopyRect(global.xFlux,local.xFlux,begin,end,origin);
+        CopyRect(global.yFlux,local.yFlux,begin,end,origin);
+    }
+    else
+    {
+        CopyRect(global.lFlux,local.lFlux,begin,end,origin);
+        CopyRect(global.rFlux,local.rFlux,begin,end,origin);
+        CopyRect(global.tFlux,local.tFlux,begin,end,origin);
+        CopyRect(global.bFlux,local.bFlux,begin,end,origin);
+    }
+
+    local.rainPos = global.rainPos - vec2(begin.x,begin.y);
+    local.fused = global.fused;
+    local.profiler.enabled = false;
+    for (Stage stage : DispatchedStages)
+        local.setKernelVariant(stage,global.kernelVariant(stage));
+
+    // Cells at the domain border are exact, the others lose radius cells
+    // per step. The velocities of the exact cells have to obey the CFL bound.
+    ivec2 shrinkBegin(begin.x > 0 ? 1 : 0, begin.y > 0 ? 1 : 0);
+    ivec2 shrinkEnd(end.x < w ? 1 : 0, end.y < h ? 1 : 0);
+
+    for (uint i=0; i<flood.size(); i++)
+    {
+        local.addRain(_drops[i],begin);
+        local.update(dt,false,flood[i]);
+
+        int lost = (i+1)*radius;
+        int x0 = shrinkBegin.x*lost, y0 = shrinkBegin.y*lost;
+        int x1 = size.x - shrinkEnd.x*lost, y1 = size.y - shrinkEnd.y*lost;
+        float maxVelocity = 0.0f;
+        for (int y=y0; y<y1; y++)
+        {
+            for (int x=x0; x<x1; x++)
+            {
+                maxVelocity = std::max(maxVelocity,std::abs(local.uVel(y,x)));
+                maxVelocity = std::max(maxVelocity,std::abs(local.vVel(y,x)));
+            }
+        }
+        if (maxVelocity*dt > maxDisplacement)
+            return false;
+    }
+
+    ivec2 localBegin(tile.begin.x-begin.x, tile.begin.y-begin.y);
+    ivec2 localEnd(tile.end.x-begin.x, tile.end.y-begin.y);
+    CopyRect(local.terrain,_terrain,localBegin,localEnd,begin);
+    CopyRect(local.water,_water,localBegin,localEnd,begin);
+    CopyRect(local.sediment,_sediment,localBegin,localEnd,begin);
+    if (global.staggered)
+    {
+        CopyRect(local.xFlux,_xFlux,localBegin,localEnd,begin);
+        CopyRect(local.yFlux,_yFlux,localBegin,localEnd,begin);
+    }
+    else
+    {
+        CopyRect(local.lFlux,_lFlux,localBegin,localEnd,begin);
+        CopyRect(local.rFlux,_rFlux,localBegin,localEnd,begin);
+        CopyRect(local.tFlux,_tFlux,localBegin,localEnd,begin);
+        CopyRect(local.bFlux,_bFlux,localBegin,localEnd,begin);
+    }
+    CopyRect(local.uVel,_uVel,localBegin,localEnd,begin);
+    CopyRect(local.vVel,_vVel,localBegin,localEnd,begin);
+    for (int y=localBegin.y; y<localEnd.y; y++)
+    {
+        for (int x=localBegin.x; x<localEnd.x; x++)
+        {
+            worker.maxVelocity = std::max(worker.maxVelocity,std::abs(local.uVel(y,x)));
+            worker.maxVelocity = std::max(worker.maxVelocity,std::abs(local.vVel(y,x)));
+        }
+    }
+    return true;
+}
+
+void TemporalBlocking::swapOutput()
+{
+    _simulation.terrain.swap(_terrain);
+    _simulation.water.swap(_water);
+    _simulation.sediment.swap(_sediment);
+    _simulation.lFlux.swap(_lFlux);
+    _simulation.rFlux.swap(_rFlux);
+    _simulation.tFlux.swap(_tFlux);
+    _simulation.bFlux.swap(_bFlux);
+    _simulation.xFlux.swap(_xFlux);
+    _simulation.yFlux.swap(_yFlux);
+    _simulation.uVel.swap(_uVel);
+    _simulation.vVel.swap(_vVel);
+    _simulation.activeTiles.invalidate();
+    _simulation.invalidateSurfaceNormals();
+}
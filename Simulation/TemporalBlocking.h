@@ -0,0 +1,124 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#ifndef TEMPORALBLOCKING_H
+#define TEMPORALBLOCKING_H
+
+#include "platform_includes.h"
+#include "Grid2D.h"
+#include "PaddedGrid2D.h"
+#include "SimulationState.h"
+#include "Simulation/FluidSimulation.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace Simulation {
+
+/// Advances a FluidSimulation by several steps per tile before moving on to
+/// the next tile (temporal blocking), so a tile stays in cache for all steps.
+///
+/// Every tile is extended by a halo that is large enough for the steps to
+/// not depend on anything outside of it (overlapped trapezoid tiling): a step
+/// depends on cells up to stepRadius() away. The halo is recomputed by the
+/// neighbouring tiles as well. The sediment advection has no such bound by
+/// itself, so the halo assumes a largest displacement (CFL bound). If the
+/// velocities exceed it, the tiled result is discarded and the steps are
+/// recomputed by FluidSimulation::update().
+///
+/// Each tile is computed by one worker, see Parallel. No kernel depends on the order in
+/// which cells are visited, so the results are identical to the staged
+/// update.
+///
+/// FluidSimulation::halfPrecision is not supported, advance() then runs the
+/// regular update.
+class TemporalBlocking
+{
+public:
+    TemporalBlocking(FluidSimulation& simulation);
+    ~TemporalBlocking();
+
+    /// Steps advanced per tile, used by BatchRunner to group the steps.
+    uint steps;
+
+    /// Edge length of a tile without halo in cells.
+    uint tileSize;
+
+    /// Largest displacement of the sediment advection in cells per step.
+    float maxDisplacement;
+
+    /// Number of advance() calls that exceeded maxDisplacement.
+    ulong fallbacks;
+
+    /// Distance in cells a single step depends on.
+    uint stepRadius() const;
+
+    /// Halo of a tile advanced by the given number of steps.
+    uint halo(uint steps) const { return steps*stepRadius()+1; }
+
+    /// Advances by rain.size() steps, rain[i] and flood[i] are the arguments
+    /// of the i-th FluidSimulation::update(). Returns false if the CFL bound
+    /// was exceeded and the steps were computed by update() instead.
+    bool advance(double dt, const std::vector<bool>& rain, const std::vector<bool>& flood);
+
+protected:
+    /// Private simulation of a tile and its halo.
+    struct Worker
+    {
+        Worker() : state(0,0), simulation(state), maxVelocity(0.0f) {}
+
+        SimulationState state;
+        FluidSimulation simulation;
+
+        /// Largest |u| or |v| of the tile interiors the worker wrote.
+        float maxVelocity;
+    };
+
+    struct Tile
+    {
+        glm::ivec2 begin;   /// first interior cell
+        glm::ivec2 end;     /// one past the last interior cell
+    };
+
+    /// Runs the steps on one tile and writes its interior to the output
+    /// grids. Returns false if the CFL bound was exceeded.
+    bool runTile(Worker& worker, const Tile& tile, double dt, const std::vector<bool>& flood);
+
+    /// Swaps the output grids with the grids of the simulation.
+    void swapOutput();
+
+    FluidSimulation& _simulation;
+    std::vector< std::unique_ptr<Worker> > _workers;
+
+    /// Drops of every step, drawn upfront so all tiles see the same rain.
+    std::vector< std::vector<glm::ivec2> > _drops;
+
+    /// Set by the first tile that exceeds the CFL bound.
+    std::atomic<bool> _exceeded;
+
+    // output of the tiles, swapped with the simulation after a block
+    PaddedGrid2D<float> _terrain;
+    PaddedGrid2D<float> _water;
+    PaddedGrid2D<float> _sediment;
+    PaddedGrid2D<float> _lFlux;
+    PaddedGrid2D<float> _rFlux;
+    PaddedGrid2D<float> _tFlux;
+    PaddedGrid2D<float> _bFlux;
+    PaddedGrid2D<float> _xFlux;
+    PaddedGrid2D<float> _yFlux;
+    Grid2D<float> _uVel;
+    Grid2D<float> _vVel;
+};
+
+} // namespace Simulation
+
+#endif // TEMPORALBLOCKING_H
@@ -13,6 +13,8 @@
 #define STATE_H
 
 #include "Grid2D.h"
+#include "PaddedGrid2D.h"
+#include "PackedNormal.h"
 #include "platform_includes.h"
 
 #include "Math/PerlinNoise.h"
@@ -22,11 +24,14 @@ using namespace glm;
 class SimulationState
 {
 public:
-    Grid2D<float> water;
-    Grid2D<float> terrain;
-    Grid2D<float> suspendedSediment;
-
-    Grid2D<vec3> surfaceNormals;
+    // padded with a clamped halo for the stencil kernels
+    PaddedGrid2D<float> water;
+    PaddedGrid2D<float> terrain;
+    PaddedGrid2D<float> suspendedSediment;
+
+    // octahedral normals of the water surface, computed for the renderer by
+    // FluidSimulation::updateSurfaceNormals()
+    Grid2D<PackedNormal> surfaceNormals;
 public:
 
     SimulationState(uint w, uint h)
@@ -48,6 +53,15 @@ public:
 
     }
 
+    /// Resizes all grids, the contents are zero afterwards.
+    void resize(uint w, uint h)
+    {
+        water.resize(w,h);
+        terrain.resize(w,h);
+        suspendedSediment.resize(w,h);
+        surfaceNormals.resize(w,h);
+    }
+
     void createPerlinTerrain()
     {
         PerlinNoise perlin;
@@ -0,0 +1,41 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#ifndef SURFACETEXEL_H
+#define SURFACETEXEL_H
+
+#include "platform_includes.h"
+#include "Half.h"
+
+/// Terrain height, water depth and suspended sediment of a cell in 8 bytes,
+/// a texel of the RG32UI surface texture the viewer draws from.
+///
+/// The terrain keeps full precision, normals and positions are derived from
+/// it. Water depth and sediment only color the surface and are stored as
+/// 16 bit floats in the second component, the water in the low half.
+/// lambert_v.glsl unpacks them.
+struct SurfaceTexel
+{
+    float terrain;
+    Half water;
+    Half sediment;
+
+    static SurfaceTexel Pack(float terrain, float water, float sediment)
+    {
+        SurfaceTexel texel = { terrain, Half(water), Half(sediment) };
+        return texel;
+    }
+
+    /// Height of the water surface.
+    float surface() const { return terrain + float(water); }
+};
+
+#endif // SURFACETEXEL_H
@@ -0,0 +1,253 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#include "TerrainChunks.h"
+#include "Simulation/Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Frustum
+///////////////////////////////////////////////
+
+Frustum::Frustum(const glm::mat4& m)
+{
+    // rows of the matrix, glm stores columns
+    glm::vec4 r[4];
+    for (int i=0; i<4; i++)
+        r[i] = glm::vec4(m[0][i],m[1][i],m[2][i],m[3][i]);
+
+    planes[0] = r[3]+r[0];              // left
+    planes[1] = r[3]+r[0]*-1.0f;        // right
+    planes[2] = r[3]+r[1];              // bottom
+    planes[3] = r[3]+r[1]*-1.0f;        // top
+    planes[4] = r[3]+r[2];              // near
+    planes[5] = r[3]+r[2]*-1.0f;        // far
+}
+
+bool Frustum::intersects(const glm::vec3& min, const glm::vec3& max) const
+{
+    for (int i=0; i<6; i++)
+    {
+        // the corner furthest along the normal
+        const glm::vec4& p = planes[i];
+        float x = p.x >= 0 ? max.x : min.x;
+        float y = p.y >= 0 ? max.y : min.y;
+        float z = p.z >= 0 ? max.z : min.z;
+        if (p.x*x + p.y*y + p.z*z + p.w < 0)
+            return false;
+    }
+    return true;
+}
+
+// TerrainChunks
+///////////////////////////////////////////////
+
+TerrainChunks::TerrainChunks()
+    : scale(0.01f),
+      lodDistance(1.0f),
+      _width(0),
+      _height(0),
+      _countX(0),
+      _countY(0)
+{
+    for (uint level=0; level<Levels; level++)
+    {
+        for (uint stitch=0; stitch<StitchCount; stitch++)
+            makePattern(level,stitch);
+    }
+}
+
+void TerrainChunks::makePattern(uint level, uint stitch)
+{
+    const uint step = 1u << level;
+    Pattern pattern = { uint(_indices.size()), 0 };
+
+    // moves every second vertex of a stitched edge onto the one before it
+    auto vertex = [&](uint x, uint y) -> ushort
+    {
+        const bool oddX = (x/step) % 2 == 1;
+        const bool oddY = (y/step) % 2 == 1;
+        if (oddY && ((x == 0 && (stitch & StitchLeft)) || (x == Size && (stitch & StitchRight))))
+            y -= step;
+        if (oddX && ((y == 0 && (stitch & StitchBottom)) || (y == Size && (stitch & StitchTop))))
+            x -= step;
+        return ushort(y*(Size+1)+x);
+    };
+    auto triangle = [&](ushort a, ushort b, ushort c)
+    {
+        if (a == b || b == c || a == c)
+            return;
+        _indices.push_back(a); _indices.push_back(b); _indices.push_back(c);
+    };
+
+    // the faces of Grid2DHelper::MakeGridIndices(), a quad per step
+    for (uint y=0; y<Size; y+=step)
+    {
+        for (uint x=0; x<Size; x+=step)
+        {
+            ushort p00 = vertex(x,y);
+            ushort p10 = vertex(x+step,y);
+            ushort p01 = vertex(x,y+step);
+            ushort p11 = vertex(x+step,y+step);
+            triangle(p00,p11,p10);
+            triangle(p00,p01,p11);
+        }
+    }
+
+    pattern.count = _indices.size()-pattern.first;
+    _patterns.push_back(pattern);
+}
+
+void TerrainChunks::resize(uint width, uint height)
+{
+    _width = width;
+    _height = height;
+    _countX = std::max(1u,(width+Size-2)/Size);
+    _countY = std::max(1u,(height+Size-2)/Size);
+    _levels.assign(count(),0);
+}
+
+void TerrainChunks::markRows(const std::vector<uint8_t>& rows, std::vector<uint8_t>& chunks) const
+{
+    chunks.assign(count(),0);
+    std::vector<uint8_t> chunkRows(_countY,0);
+    for (uint y=0; y<_height; y++)
+    {
+        if (!rows[y]) continue;
+        // a row on a chunk edge belongs to the chunks on both sides
+        uint cy = y/Size;
+        if (cy < _countY) chunkRows[cy] = 1;
+        if (y%Size == 0 && cy > 0) chunkRows[cy-1] = 1;
+    }
+    for (uint cy=0; cy<_countY; cy++)
+    {
+        if (chunkRows[cy])
+            std::fill(chunks.begin()+cy*_countX,chunks.begin()+(cy+1)*_countX,1);
+    }
+}
+
+void TerrainChunks::heightRanges(const Grid2D<SurfaceTexel>& surface, const std::vector<uint8_t>& flags,
+                                 std::vector<glm::vec2>& ranges) const
+{
+    ranges.resize(count());
+    Simulation::Parallel::ForEach(count(),[&](int i)
+    {
+        if (!flags[i]) return;
+        const uint x0 = i%_countX*Size;
+        const uint y0 = i/_countX*Size;
+        const uint x1 = std::min(x0+Size,_width-1);
+        const uint y1 = std::min(y0+Size,_height-1);
+        float lo = surface(y0,x0).surface();
+        float hi = lo;
+        for (uint y=y0; y<=y1; y++)
+        {
+            const SurfaceTexel* row = &surface(y,0);
+            for (uint x=x0; x<=x1; x++)
+            {
+                float h = row[x].surface();
+                lo = std::min(lo,h);
+                hi = std::max(hi,h);
+            }
+        }
+        ranges[i] = glm::vec2(lo,hi);
+    });
+}
+
+void TerrainChunks::bounds(uint chunk, glm::vec2 range, glm::vec3& min, glm::vec3& max) const
+{
+    // lambert_v.glsl: ((x/(width-1) - 0.5)*width, height, (y/(height-1) - 0.5)*width)*scale
+    const uint x0 = chunk%_countX*Size;
+    const uint y0 = chunk/_countX*Size;
+    const uint x1 = std::min(x0+Size,_width-1);
+    const uint y1 = std::min(y0+Size,_height-1);
+    const float sx = float(_width)*scale/std::max(1u,_width-1);
+    const float sy = float(_width)*scale/std::max(1u,_height-1);
+    const float ox = -0.5f*_width*scale;
+    min = glm::vec3(ox+x0*sx, range.x*scale, ox+y0*sy);
+    max = glm::vec3(ox+x1*sx, range.y*scale, ox+y1*sy);
+}
+
+void TerrainChunks::select(const glm::mat4& proj, const glm::mat4& view, const std::vector<glm::vec2>& ranges,
+                           std::vector<Draw>& draws)
+{
+    draws.clear();
+    const Frustum frustum(proj*view);
+
+    // the camera position of a rigid view matrix, -R^T*t
+    const glm::vec4& t = view[3];
+    auto column = [&](int i) { return -(view[i].x*t.x + view[i].y*t.y + view[i].z*t.z); };
+    const glm::vec3 eye(column(0),column(1),column(2));
+
+    // levels by the distance of the nearest point of a chunk to the camera,
+    // for all chunks so the stitching does not depend on the culling
+    for (uint i=0; i<count(); i++)
+    {
+        glm::vec3 min, max;
+        bounds(i,ranges[i],min,max);
+        float dx = std::max(0.0f,std::max(min.x-eye.x,eye.x-max.x));
+        float dy = std::max(0.0f,std::max(min.y-eye.y,eye.y-max.y));
+        float dz = std::max(0.0f,std::max(min.z-eye.z,eye.z-max.z));
+        float distance = std::sqrt(dx*dx+dy*dy+dz*dz);
+        uint level = 0;
+        if (lodDistance > 0)
+        {
+            while (level+1 < Levels && distance >= lodDistance*float(1u << level))
+                level++;
+        }
+        _levels[i] = level;
+    }
+
+    // neighbours at most one level apart, refines the coarser side
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (uint cy=0; cy<_countY; cy++)
+        {
+            for (uint cx=0; cx<_countX; cx++)
+            {
+                uint8_t& level = _levels[cy*_countX+cx];
+                uint8_t limit = level;
+                if (cx > 0)         limit = std::min<uint8_t>(limit,_levels[cy*_countX+cx-1]+1);
+                if (cx+1 < _countX) limit = std::min<uint8_t>(limit,_levels[cy*_countX+cx+1]+1);
+                if (cy > 0)         limit = std::min<uint8_t>(limit,_levels[(cy-1)*_countX+cx]+1);
+                if (cy+1 < _countY) limit = std::min<uint8_t>(limit,_levels[(cy+1)*_countX+cx]+1);
+                if (limit < level)
+                {
+                    level = limit;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    for (uint cy=0; cy<_countY; cy++)
+    {
+        for (uint cx=0; cx<_countX; cx++)
+        {
+            const uint i = cy*_countX+cx;
+            glm::vec3 min, max;
+            bounds(i,ranges[i],min,max);
+            if (!frustum.intersects(min,max))
+                continue;
+
+            const uint level = _levels[i];
+            uint stitch = 0;
+            if (cx > 0         && _levels[i-1] > level)       stitch |= StitchLeft;
+            if (cx+1 < _countX && _levels[i+1] > level)       stitch |= StitchRight;
+            if (cy > 0         && _levels[i-_countX] > level) stitch |= StitchBottom;
+            if (cy+1 < _countY && _levels[i+_countX] > level) stitch |= StitchTop;
+            Draw draw = { i, level, stitch };
+            draws.push_back(draw);
+        }
+    }
+}
@@ -0,0 +1,137 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#ifndef TERRAINCHUNKS_H
+#define TERRAINCHUNKS_H
+
+#include "platform_includes.h"
+#include "Grid2D.h"
+#include "SurfaceTexel.h"
+
+#include <stdint.h>
+#include <vector>
+
+/// Plane equations of a view frustum, extracted from projection*view.
+/// Normals point inwards.
+struct Frustum
+{
+    explicit Frustum(const glm::mat4& viewProj);
+
+    /// False if the axis aligned box lies entirely outside of a plane.
+    bool intersects(const glm::vec3& min, const glm::vec3& max) const;
+
+    glm::vec4 planes[6];
+};
+
+/// Splits the terrain mesh into square chunks of Size cells for culling and
+/// level of detail. No OpenGL calls, selection and index patterns work
+/// without a GPU and are tested in Tests/TerrainChunksTests.cpp.
+///
+/// Chunk i owns the (Size+1)^2 vertices of its cells, including the edges it
+/// shares with its neighbours, numbered i*Vertices + y*(Size+1) + x. There
+/// are no vertex attributes, lambert_v.glsl derives the cell from the vertex
+/// number and clamps it, so chunks reaching over the border of the grid
+/// repeat the last row and column, which only adds degenerate triangles. The
+/// vertices of a chunk are addressed with 16 bit indices relative to the
+/// first one.
+///
+/// A chunk of level L is drawn with a vertex every 2^L cells. select() picks
+/// the level from the distance to the camera, keeps neighbours at most one
+/// level apart and stitches the edge towards a coarser neighbour by
+/// collapsing every second edge vertex, so the meshes meet without cracks.
+class TerrainChunks
+{
+public:
+    static const uint Size = 64;                        /// cells per chunk side
+    static const uint Vertices = (Size+1)*(Size+1);     /// vertices per chunk
+    static const uint Levels = 5;                       /// a vertex every 1, 2, 4, 8 or 16 cells
+
+    /// Edges of a chunk whose neighbour has the next coarser level.
+    enum Stitch : uint
+    {
+        StitchLeft   = 1,   /// x = 0
+        StitchRight  = 2,   /// x = Size
+        StitchBottom = 4,   /// y = 0
+        StitchTop    = 8,   /// y = Size
+        StitchCount  = 16
+    };
+
+    /// Range of indices().
+    struct Pattern
+    {
+        uint first;
+        uint count;
+    };
+
+    /// A chunk to draw and its index pattern.
+    struct Draw
+    {
+        uint chunk;
+        uint level;
+        uint stitch;
+    };
+
+    /// Index patterns for all levels and stitches.
+    TerrainChunks();
+
+    /// Sets the size of the vertex grid.
+    void resize(uint width, uint height);
+
+    uint width() const { return _width; }
+    uint height() const { return _height; }
+
+    uint countX() const { return _countX; }
+    uint countY() const { return _countY; }
+    uint count() const { return _countX*_countY; }
+
+    /// Flags the chunks containing vertices of the grid rows y with rows[y] != 0.
+    void markRows(const std::vector<uint8_t>& rows, std::vector<uint8_t>& chunks) const;
+
+    /// Lowest and highest water surface over the vertices of every flagged chunk.
+    void heightRanges(const Grid2D<SurfaceTexel>& surface, const std::vector<uint8_t>& flags,
+                      std::vector<glm::vec2>& ranges) const;
+
+    /// World space bounding box of a chunk whose heights lie in range.
+    void bounds(uint chunk, glm::vec2 range, glm::vec3& min, glm::vec3& max) const;
+
+    /// All index patterns, to be drawn with the first vertex of a chunk as base.
+    const std::vector<ushort>& indices() const { return _indices; }
+    const Pattern& pattern(uint level, uint stitch) const { return _patterns[level*StitchCount+stitch]; }
+
+    /// Chunks inside of the view frustum with their level and stitching,
+    /// ranges holds the heights of every chunk (heightRanges()).
+    void select(const glm::mat4& proj, const glm::mat4& view, const std::vector<glm::vec2>& ranges,
+                std::vector<Draw>& draws);
+
+    /// World units per cell and per unit of height, as in lambert_v.glsl.
+    float scale;
+
+    /// Camera distance (world units) from which chunks use level 1, the
+    /// distance doubles for every further level. 0 draws all at level 0.
+    float lodDistance;
+
+protected:
+    /// Triangles of a chunk with a vertex every 2^level cells.
+    void makePattern(uint level, uint stitch);
+
+    uint _width;
+    uint _height;
+    uint _countX;
+    uint _countY;
+
+    std::vector<ushort> _indices;
+    std::vector<Pattern> _patterns;
+
+    /// Level of every chunk in the last select().
+    std::vector<uint8_t> _levels;
+};
+
+#endif // TERRAINCHUNKS_H
@@ -5,24 +5,20 @@ CONFIG -= qt
 INCLUDEPATH += external/
 QMAKE_CXXFLAGS += -std=c++11
 
+include(Simulation/Simulation.pri)
+
 SOURCES += *.cpp \
     Graphics/Shader.cpp \
     Graphics/GLWrapper.cpp \
-    Simulation/FluidSimulation.cpp \
-    Graphics/IndexBuffer.cpp \
-    Math/PerlinNoise.cpp
+    Graphics/IndexBuffer.cpp
 HEADERS += *.h \
     Graphics/Shader.h \
     Graphics/GLWrapper.h \
-    Simulation/FluidSimulation.h \
-    SimulationState.h \
     Graphics/VertexBuffer.h \
     Graphics/IndexBuffer.h \
     Camera.h \
-    Math/MathUtil.h \
     Graphics/Texture2D.h \
     Graphics/Mesh.h \
-    Math/PerlinNoise.h \
     external/tclap/CmdLine.h
 
 OTHER_FILES += \
@@ -48,8 +44,6 @@ mac {
     package_media.path = Contents/Resources
     QMAKE_BUNDLE_DATA += package_media
 } else:unix {
-    QMAKE_CXXFLAGS += -fopenmp
-    QMAKE_LFLAGS += -fopenmp
     CONFIG    += link_pkgconfig
     PKGCONFIG += libglfw
     LIBS+=-lboost_system
@@ -11,8 +11,10 @@
 
 #include "TerrainFluidSimulation.h"
 
+#include <algorithm>
 #include <chrono>
 #include <iostream>
+#include <sstream>
 
 #include "platform_includes.h"
 
@@ -21,11 +23,17 @@ using namespace Graphics;
 
 
 TerrainFluidSimulation::TerrainFluidSimulation(uint dim)
-    : _simulationState(dim,dim),
-      _simulation(_simulationState),
+    : _finished(false),
       _rain(false),
+      _flood(false),
+      _rainX(dim/2),
+      _rainY(dim/2),
       _rainPos(dim/2,dim/2),
-      _flood(false)
+      _timeWarp(1.0),
+      _simulationState(dim,dim),
+      _simulation(_simulationState),
+      _stepper(_simulation),
+      _uploadedStep(0)
 {}
 
 void TerrainFluidSimulation::Run()
@@ -39,48 +47,43 @@ void TerrainFluidSimulation::Stop()
     _finished = true;
 }
 
+void TerrainFluidSimulation::SetTimeWarp(double warp)
+{
+    _timeWarp = std::max(warp,1.0/64);
+}
+
+// Steps of one batch of the simulation thread: a batch ends after this many
+// steps or this much wall clock time, whatever comes first, and is followed
+// by a snapshot. Simulated time that falls behind by more than MaxLagSteps
+// steps is dropped, so a simulation slower than the wall clock (or the time
+// warp) slows down instead of accumulating ever longer batches.
+static const uint MaxBatchSteps = 1000;
+static const double MaxBatchSeconds = 1.0/30;
+static const double MaxLagSteps = 1000;
+
 void TerrainFluidSimulation::runMainloop()
 {
     using namespace std::chrono;
 
-    // Settings
-    double dt = 1000.0/(60); // 60 fps physics simulation
-
     // Setup
     high_resolution_clock clock;
-    high_resolution_clock::time_point currentTime, newTime;
-    high_resolution_clock::duration frameTime;
-    high_resolution_clock::duration accumulator(0);
-
-    // count number of simulation steps
-    ulong counterSim = 0;
+    high_resolution_clock::time_point frameStart, lastFrame, reportTime;
+    Simulation::LatencyHistogram frameLatency;
 
     _finished = false;
-    currentTime = clock.now();
+    _warpKeys[0] = _warpKeys[1] = false;
+    _simulationThread = std::thread(&TerrainFluidSimulation::runSimulation,this);
+
+    reportTime = lastFrame = clock.now();
     while(!_finished)
     {
-        newTime = clock.now();
-        frameTime = newTime - currentTime;
-        currentTime = newTime;
-        accumulator += frameTime;
-
-        // physics simulation
-        updatePhysics(dt);
+        frameStart = clock.now();
+        double frameMs = duration_cast<duration<double,std::milli>>(frameStart-lastFrame).count();
+        lastFrame = frameStart;
 
         // check for input events
         glfwPollEvents();
-        cameraMovement(dt);
-
-        // timing info
-        counterSim++;
-        if (counterSim%100 == 0)
-        {
-            double ms = std::chrono::duration_cast<milliseconds>(accumulator).count()/100.0;
-            std::cout << 1000.0 /ms << " FPS\n";
-            accumulator = high_resolution_clock::duration(0);
-            counterSim = 0;
-        }
-
+        cameraMovement(std::min(frameMs,100.0));
 
         // input handling
         checkInput();
@@ -91,10 +94,96 @@ void TerrainFluidSimulation::runMainloop()
 #else
         _shaderManager.Update();
 #endif
-        // rendering
+        // rendering of the latest simulation step
+        uploadSnapshot();
         render();
+
+        // timing info
+        frameLatency.add(duration_cast<duration<double>>(clock.now()-frameStart).count());
+        if (frameLatency.count() == 100)
+        {
+            double seconds = duration_cast<duration<double>>(clock.now()-reportTime).count();
+            std::ostringstream report;
+            report << 100/seconds << " FPS, frame p50 " << frameLatency.percentile(0.5)*1e3
+                   << " ms, p99 " << frameLatency.percentile(0.99)*1e3 << " ms\n";
+            std::cout << report.str();
+            frameLatency.reset();
+            reportTime = clock.now();
+        }
     }
 
+    _simulationThread.join();
+}
+
+void TerrainFluidSimulation::runSimulation()
+{
+    using namespace std::chrono;
+
+    // Settings
+    double dt = 1000.0/(60); // 60 fps physics simulation
+
+    // Setup
+    high_resolution_clock clock;
+    high_resolution_clock::time_point stepStart, batchStart, lastTick, reportTime;
+    Simulation::LatencyHistogram stepLatency;
+    double accumulator = 0.0; // simulated milliseconds not yet stepped
+    ulong step = 0;
+    ulong reportStep = 0;
+
+    reportTime = lastTick = clock.now();
+    while(!_finished)
+    {
+        // fixed steps for the wall clock time since the last batch
+        batchStart = clock.now();
+        double warp = _timeWarp;
+        accumulator += duration_cast<duration<double,std::milli>>(batchStart-lastTick).count()*warp;
+        accumulator = std::min(accumulator,MaxLagSteps*dt);
+        lastTick = batchStart;
+
+        uint steps = 0;
+        while (accumulator >= dt && steps < MaxBatchSteps && !_finished)
+        {
+            stepStart = clock.now();
+            if (duration_cast<duration<double>>(stepStart-batchStart).count() >= MaxBatchSeconds)
+                break;
+
+            // physics simulation
+            updatePhysics(dt);
+            accumulator -= dt;
+            steps++;
+            step++;
+
+            stepLatency.add(duration_cast<duration<double>>(clock.now()-stepStart).count());
+        }
+
+        // one snapshot per batch, the renderer uploads at most one per frame
+        if (steps > 0)
+        {
+            _simulation.updateChangedRows();
+            publishSnapshot(step);
+        }
+
+        // timing info
+        if (step-reportStep >= 100)
+        {
+            double seconds = duration_cast<duration<double>>(clock.now()-reportTime).count();
+            std::ostringstream report;
+            report << (step-reportStep)/seconds << " steps/s (time warp " << warp << "), step p50 "
+                   << stepLatency.percentile(0.5)*1e3 << " ms, p99 " << stepLatency.percentile(0.99)*1e3 << " ms\n";
+            std::cout << report.str();
+            stepLatency.reset();
+            reportTime = clock.now();
+            reportStep = step;
+        }
+
+        // wait until the next step is due, or at most one step to see
+        // changes of the time warp
+        if (accumulator < dt)
+        {
+            double waitMs = std::min((dt-accumulator)/warp,dt);
+            std::this_thread::sleep_for(duration<double,std::milli>(waitMs));
+        }
+    }
 }
 
 void TerrainFluidSimulation::checkInput()
@@ -119,7 +208,16 @@ void TerrainFluidSimulation::checkInput()
     if (glfwGetKey(GLFW_KEY_RIGHT)) _rainPos.x += d;
     if (glfwGetKey(GLFW_KEY_LEFT)) _rainPos.x -= d;
 
-    _simulation.rainPos = _rainPos;
+    _rainX = _rainPos.x;
+    _rainY = _rainPos.y;
+
+    // time warp, once per key press
+    bool slower = glfwGetKey('N');
+    bool faster = glfwGetKey('M');
+    if (slower && !_warpKeys[0]) SetTimeWarp(_timeWarp/2);
+    if (faster && !_warpKeys[1]) SetTimeWarp(_timeWarp*2);
+    _warpKeys[0] = slower;
+    _warpKeys[1] = faster;
 }
 
 void TerrainFluidSimulation::cameraMovement(double dt)
@@ -151,15 +249,65 @@ void TerrainFluidSimulation::cameraMovement(double dt)
 
 void TerrainFluidSimulation::updatePhysics(double dt)
 {
-    // Run simulation
-    _simulation.update(dt,_rain,_flood);
+    _simulation.rainPos = vec2(_rainX,_rainY);
+
+    // Run simulation, in as many substeps as dt needs to stay stable
+    _stepper.advance(dt,_rain,_flood);
+}
 
-    // Copy data to GPU
-    _terrainHeightBuffer.SetData(_simulationState.terrain);
-    _waterHeightBuffer.SetData(_simulationState.water);
-    _sedimentBuffer.SetData(_simulationState.suspendedSediment);
-    _normalBuffer.SetData(_simulationState.surfaceNormals);
+void TerrainFluidSimulation::publishSnapshot(ulong step)
+{
+    Snapshot& snapshot = _snapshots.back();
+    const SimulationState& state = _simulationState;
+    const std::vector<int>& rows = _simulation.updatedRows();
 
+    // every snapshot misses the rows changed since it was written
+    for (uint i=0; i<3; i++)
+    {
+        std::vector<uint8_t>& stale = _snapshots.slot(i).stale;
+        for (int y : rows)
+            stale[y] = 1;
+    }
+
+    const std::vector<uint8_t>& stale = snapshot.stale;
+    const uint width = state.terrain.width();
+    Simulation::Parallel::ForEach(state.terrain.height(),[&](int y)
+    {
+        if (!stale[y]) return;
+        const float* terrain = state.terrain.row(y);
+        const float* water = state.water.row(y);
+        const float* sediment = state.suspendedSediment.row(y);
+        SurfaceTexel* surface = &snapshot.surface(y,0);
+        for (uint x=0; x<width; x++)
+            surface[x] = SurfaceTexel::Pack(terrain[x],water[x],sediment[x]);
+    });
+    _chunks.markRows(snapshot.stale,_changedChunks);
+    _chunks.heightRanges(snapshot.surface,_changedChunks,snapshot.heights);
+    std::fill(snapshot.stale.begin(),snapshot.stale.end(),0);
+    snapshot.step = step;
+
+    // the render thread only reads the slot it holds, the steps of all rows
+    // go along with every snapshot
+    for (int y : rows)
+        _changed[y] = step;
+    snapshot.changed = _changed;
+
+    _snapshots.publish();
+}
+
+void TerrainFluidSimulation::uploadSnapshot()
+{
+    // the GPU still holds the last snapshot
+    if (!_snapshots.update())
+        return;
+
+    // Stream the rows changed since the snapshot on the GPU, also those of
+    // the snapshots that were skipped
+    const Snapshot& snapshot = _snapshots.front();
+    for (uint y=0; y<_uploadRows.size(); y++)
+        _uploadRows[y] = snapshot.changed[y] > _uploadedStep;
+    _surfaceTexture.SetRows(snapshot.surface,_uploadRows);
+    _uploadedStep = snapshot.step;
 }
 
 void TerrainFluidSimulation::render()
@@ -191,24 +339,40 @@ void TerrainFluidSimulation::render()
     _testShader->Bind();
 
     auto viewMatrix = _cam.ViewMatrix();
+    const Snapshot& snapshot = _snapshots.front();
     _testShader->SetUniform("uProjMatrix", _cam.ProjMatrix());
     _testShader->SetUniform("uViewMatrix",viewMatrix);
     _testShader->SetUniform("uViewMatrixNormal", transpose(inverse(viewMatrix)) );
-    _testShader->SetUniform("uGridSize",(int)_simulationState.terrain.width());
+    _testShader->SetUniform("uGridSize",(int)_chunks.width());
+    _testShader->SetUniform("uGridHeight",(int)_chunks.height());
+    _testShader->SetUniform("uChunksX",(int)_chunks.countX());
 
-    // bind data
-    _gridCoordBuffer.MapData(_testShader->AttributeLocation("inGridCoord"));
-    _terrainHeightBuffer.MapData(_testShader->AttributeLocation("inTerrainHeight"));
-    _waterHeightBuffer.MapData(_testShader->AttributeLocation("inWaterHeight"));
-    _sedimentBuffer.MapData(_testShader->AttributeLocation("inSediment"));
-    _normalBuffer.MapData(_testShader->AttributeLocation("inNormal"));
+    // bind data, the vertex shader reads all of it from the surface texture
+    _surfaceTexture.Map(0);
+    _testShader->SetUniform("uSurface",_surfaceTexture);
 
     _gridIndexBuffer.Bind();
 
     // render terrain
     _testShader->SetUniform("uColor", vec4(242.0/255.0,224.0/255.0,201.0/255.0,1));
     _testShader->SetUniform("uIsWater",false);
-    glDrawElements(GL_TRIANGLES, _gridIndexBuffer.IndexCount(), _gridIndexBuffer.IndexType(),0);
+
+    // the visible chunks, 16 bit indices relative to the first vertex of a
+    // chunk, the vertex shader finds the cell from the vertex number
+    _chunks.select(_cam.ProjMatrix(),viewMatrix,snapshot.heights,_draws);
+    _drawCounts.clear();
+    _drawOffsets.clear();
+    _drawBaseVertices.clear();
+    for (const TerrainChunks::Draw& draw : _draws)
+    {
+        const TerrainChunks::Pattern& pattern = _chunks.pattern(draw.level,draw.stitch);
+        _drawCounts.push_back(pattern.count);
+        _drawOffsets.push_back((GLvoid*)(pattern.first*sizeof(ushort)));
+        _drawBaseVertices.push_back(draw.chunk*TerrainChunks::Vertices);
+    }
+    if (!_draws.empty())
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, &_drawCounts[0], GL_UNSIGNED_SHORT, &_drawOffsets[0],
+                                      _draws.size(), &_drawBaseVertices[0]);
 
     // unbind shader
     _testShader->UnBind();
@@ -231,31 +395,15 @@ void TerrainFluidSimulation::init()
     glGenVertexArrays(1, &vao);
     glBindVertexArray(vao);
 
-    // Create some data
-    Grid2D<vec2> gridCoords;
-    std::vector<uint> gridIndices;
-
     uint dimX = _simulationState.terrain.width();
     uint dimY = _simulationState.terrain.height();
 
-    Grid2DHelper::MakeGridIndices(gridIndices,dimX,dimY);
-    Grid2DHelper::MakeUniformGrid(gridCoords,dimX,dimY);
-
-    // Send data to the GPU
-    _gridIndexBuffer.SetData(gridIndices);
-    _gridCoordBuffer.SetData(gridCoords);
-
-    _terrainHeightBuffer.SetData(_simulationState.terrain);
-    _waterHeightBuffer.SetData(_simulationState.water);
-    _sedimentBuffer.SetData(_simulationState.suspendedSediment);
+    // Send data to the GPU, there are no vertex attributes
+    _chunks.resize(dimX,dimY);
+    _gridIndexBuffer.SetData(_chunks.indices());
 
     // Load and configure shaders
     _testShader = _shaderManager.LoadShader(resourcePath+"lambert_v.glsl",resourcePath+"lambert_f.glsl");
-    _testShader->MapAttribute("inGridCoord",0);
-    _testShader->MapAttribute("inTerrainHeight",1);
-    _testShader->MapAttribute("inWaterHeight",2);
-    _testShader->MapAttribute("inSediment",3);
-    _testShader->MapAttribute("inNormal",7);
 
     // position camera
     _cam.TranslateGlobal(vec3(0.0f,0.2,2));
@@ -267,11 +415,24 @@ void TerrainFluidSimulation::init()
 //    glFrontFace(GL_CW); // clockwise
 //    glPolygonMode(GL_FRONT_AND_BACK,GL_LINE);
     
-    _terrainHeightBuffer.SetData(_simulationState.terrain);
-    _waterHeightBuffer.SetData(_simulationState.water);
-    _sedimentBuffer.SetData(_simulationState.suspendedSediment);
-    _normalBuffer.SetData(_simulationState.surfaceNormals);
-    
+    // the initial state, before the simulation thread starts
+    for (uint i=0; i<3; i++)
+    {
+        Snapshot& snapshot = _snapshots.slot(i);
+        snapshot.surface.resize(dimX,dimY);
+        snapshot.step = 0;
+        snapshot.changed.assign(dimY,0);
+        snapshot.stale.assign(dimY,1);
+    }
+    // the first upload sends the whole texture (Texture2D::SetRows)
+    _changed.assign(dimY,0);
+    _uploadRows.assign(dimY,0);
+    _uploadedStep = 0;
+    _simulation.invalidateSurfaceNormals();
+    _simulation.updateChangedRows();
+    publishSnapshot(0);
+    uploadSnapshot();
+
 }
 
 
@@ -13,21 +13,26 @@
 #define TERRAINFLUIDSIMULATION_H
 
 #include "Simulation/FluidSimulation.h"
+#include "Simulation/AdaptiveStepper.h"
 
 #include "Graphics/Shader.h"
-#include "Graphics/VertexBuffer.h"
 #include "Graphics/IndexBuffer.h"
 #include "Graphics/Texture2D.h"
 
 #include "Camera.h"
 
 #include "SimulationState.h"
+#include "SurfaceTexel.h"
+#include "TerrainChunks.h"
+#include "TripleBuffer.h"
 
 #if defined(__APPLE__) || defined(__MACH__)
 #include "osx_bundle.h"
 #endif
 
+#include <atomic>
 #include <memory>
+#include <thread>
 
 class TerrainFluidSimulation
 {
@@ -38,17 +43,54 @@ public:
 
     void Stop();
 
-protected:
+    /// Simulated time per wall clock time, e.g. 100 to fast-forward. Keys
+    /// N and M halve and double it while running.
+    void SetTimeWarp(double warp);
 
-    /// Starts simulation main loop.
+protected:
+    /// Copy of the fields the renderer draws, taken after a simulation step.
+    /// The renderer derives vertex positions and normals from it on the GPU.
+    struct Snapshot
+    {
+        Grid2D<SurfaceTexel> surface;
+        ulong step;
+
+        /// Lowest and highest water surface of every chunk, for culling.
+        std::vector<glm::vec2> heights;
+
+        /// Step of the last change of every row up to this snapshot. The
+        /// renderer streams the rows that changed after the snapshot it
+        /// uploaded before, whichever snapshots it skipped in between.
+        std::vector<ulong> changed;
+
+        /// Rows that changed since this snapshot was written, only used by
+        /// the simulation thread.
+        std::vector<uint8_t> stale;
+    };
+
+    /// Starts the simulation thread and runs the render loop on the calling
+    /// thread, which owns the OpenGL context.
     void runMainloop();
 
+    /// Loop of the simulation thread: runs as many fixed steps as the
+    /// elapsed wall clock time (times the time warp) demands and publishes a
+    /// snapshot after every batch, never waits for rendering.
+    void runSimulation();
+
     /// Checks and handles input events.
     void checkInput();
 
-    /// Advances physics by timestep dt (in milliseconds).
+    /// Advances physics by timestep dt (in milliseconds), on the simulation thread.
     void updatePhysics(double dt);
 
+    /// Copies the rows the back snapshot misses into it, stamps the rows the
+    /// last updateChangedRows() collected with step and publishes it.
+    void publishSnapshot(ulong step);
+
+    /// Uploads the rows of the latest snapshot that changed since the last
+    /// upload, if there is a new one.
+    void uploadSnapshot();
+
     /// Renders the simulation
     void render();
 
@@ -57,26 +99,38 @@ protected:
     void init();
 
 protected:
-    bool _finished;
+    std::atomic<bool> _finished;
 
-    bool _rain;
-    bool _flood;
+    // input, read by the simulation thread before every step
+    std::atomic<bool> _rain;
+    std::atomic<bool> _flood;
+    std::atomic<float> _rainX;
+    std::atomic<float> _rainY;
     glm::vec2 _rainPos;
+    std::atomic<double> _timeWarp;
+    bool _warpKeys[2];  /// N and M were down in the last frame
 
     SimulationState _simulationState;
     Simulation::FluidSimulation _simulation;
+    Simulation::AdaptiveStepper _stepper;
 
+    std::thread _simulationThread;
+    TripleBuffer<Snapshot> _snapshots;
+    std::vector<ulong> _changed;        /// Snapshot::changed of the next snapshot, simulation thread
+    std::vector<uint8_t> _uploadRows;   /// rows the last upload streamed, render thread
+    ulong _uploadedStep;                /// step of the snapshot on the GPU, render thread
 
     Graphics::ShaderManager             _shaderManager;
-    Graphics::VertexBuffer<float>       _terrainHeightBuffer;
-    Graphics::VertexBuffer<float>       _waterHeightBuffer;
-    Graphics::VertexBuffer<glm::vec2>   _gridCoordBuffer;
     Graphics::IndexBuffer               _gridIndexBuffer;
-    Graphics::VertexBuffer<float>       _sedimentBuffer;
-    Graphics::VertexBuffer<glm::vec3>   _normalBuffer;
-
-
-    Graphics::Texture2D<float,Graphics::TextureFormat::Float,32> _waterHeightTexture;
+    Graphics::Texture2D<SurfaceTexel,Graphics::TextureFormat::UnsignedInteger,32> _surfaceTexture;
+
+    // chunked mesh, the simulation thread measures, the render thread selects
+    TerrainChunks _chunks;
+    std::vector<uint8_t> _changedChunks;
+    std::vector<TerrainChunks::Draw> _draws;
+    std::vector<GLsizei> _drawCounts;
+    std::vector<GLvoid*> _drawOffsets;
+    std::vector<GLint> _drawBaseVertices;
 
     Camera _cam;
 
@@ -0,0 +1,122 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+
+#include "Test.h"
+#include "Simulation/AdaptiveStepper.h"
+
+#include <cfloat>
+
+using namespace Simulation;
+
+// AdaptiveStepper splits an interval into equal substeps. With the advection
+// limit out of the way, the wave limit is the same for every substep and the
+// split is known upfront.
+
+static const uint Width = 96;
+static const uint Height = 80;
+static const int Frames = 5;
+
+/// A fresh simulation of the wet scene.
+struct Scene
+{
+    SimulationState state;
+    FluidSimulation simulation;
+
+    Scene()
+        : state(Width,Height),
+          simulation(state)
+    {
+        Tests::MakeWetScene(state);
+        FluidSimulation::restartRain();
+    }
+};
+
+TEST(AdaptiveStepperSplitsIntoEqualSubsteps)
+{
+    Scene scene;
+    AdaptiveStepper stepper(scene.simulation);
+    stepper.maxDisplacement = FLT_MAX;
+
+    // three and a half wave limits give four substeps, the last one the
+    // remainder of the others
+    const double limit = stepper.stableDt();
+    const double interval = 3.5*limit;
+    ulong total = 0;
+    for (int i=0; i<Frames; i++)
+    {
+        uint steps = stepper.advance(interval);
+        total += steps;
+        CHECK(steps == 4);
+        CHECK(stepper.steps == steps);
+        CHECK(stepper.dt <= limit);
+        CHECK_MESSAGE(std::abs(stepper.steps*stepper.dt-interval) < 1e-9*interval,
+                      stepper.steps << " substeps of " << stepper.dt << " ms for " << interval << " ms");
+    }
+    CHECK(stepper.totalSteps == total);
+    CHECK(stepper.limited == 0);
+    CHECK(Tests::AllFinite(scene.simulation.water));
+    CHECK(scene.simulation.maxVelocity() > 0.0f);
+}
+
+TEST(AdaptiveStepperTakesRemainderStep)
+{
+    Scene scene;
+    AdaptiveStepper stepper(scene.simulation);
+    stepper.maxDisplacement = FLT_MAX;
+
+    // an interval just within the limit is a single step of the interval
+    const double limit = stepper.stableDt();
+    CHECK(stepper.advance(limit) == 1);
+    CHECK(stepper.dt == limit);
+
+    // just above it, two equal halves
+    CHECK(stepper.advance(1.5*limit) == 2);
+    CHECK(std::abs(2.0*stepper.dt-1.5*limit) < 1e-9*limit);
+}
+
+TEST(AdaptiveStepperClampsToMaxSubsteps)
+{
+    Scene scene;
+    AdaptiveStepper stepper(scene.simulation);
+    stepper.maxDisplacement = FLT_MAX;
+    stepper.maxSubsteps = 2;
+
+    const double interval = 8.0*stepper.stableDt();
+    CHECK(stepper.advance(interval) == 2);
+    CHECK(stepper.dt == interval/2);
+    CHECK(stepper.limited == 1);
+
+    // within the limit again, not counted
+    CHECK(stepper.advance(stepper.stableDt()) == 1);
+    CHECK(stepper.limited == 1);
+}
+
+TEST(AdaptiveStepperMatchesFixedStep)
+{
+    // the wave limit at the 60 Hz step of the viewer, where the erosion
+    // rates are those of the fixed step
+    Scene adaptive;
+    AdaptiveStepper stepper(adaptive.simulation);
+    stepper.maxDisplacement = FLT_MAX;
+    stepper.courant *= Tests::StepDt/stepper.stableDt()*(1.0+1e-9);
+
+    for (int i=0; i<Frames; i++)
+    {
+        CHECK(stepper.advance(Tests::StepDt) == 1);
+        CHECK(stepper.dt == Tests::StepDt);
+    }
+
+    // after the adaptive run, both draw the same rain
+    Scene fixed;
+    Tests::RunSteps(fixed.simulation,Frames);
+    Tests::CheckIdenticalSimulations(fixed.simulation,adaptive.simulation);
+}
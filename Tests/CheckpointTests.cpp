@@ -0,0 +1,130 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+
+#include "Test.h"
+#include "Simulation/Checkpoint.h"
+#include "Exception.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace Simulation;
+
+static const uint Width = 150;
+static const uint Height = 122;
+static const int StepsBefore = 20;
+static const int StepsAfter = 15;
+
+/// A file in the temporary directory, removed at the end of the test.
+struct TempFile
+{
+    std::string path;
+
+    explicit TempFile(const char* name)
+    {
+        const char* dir = getenv("TMPDIR");
+        path = std::string(dir && *dir ? dir : "/tmp") + "/" + name;
+    }
+
+    ~TempFile() { unlink(path.c_str()); }
+};
+
+/// Runs steps with rain and flood without restarting the rain.
+static void ContinueSteps(FluidSimulation& simulation, int steps)
+{
+    for (int i=0; i<steps; i++)
+        simulation.update(Tests::StepDt,true,true);
+}
+
+/// Saves a run after StepsBefore steps, continues it for StepsAfter steps
+/// and compares it to a fresh simulation that continues from the file.
+static void CheckRoundTrip(const char* file, bool staggered, bool half, bool sparse)
+{
+    TempFile checkpoint(file);
+
+    SimulationState state(Width,Height);
+    Tests::MakeWetScene(state);
+    FluidSimulation simulation(state);
+    simulation.staggered = staggered;
+    simulation.halfPrecision = half;
+    simulation.sparse = sparse;
+    simulation.rainPos = glm::vec2(40.0f,70.0f);
+
+    FluidSimulation::restartRain();
+    ContinueSteps(simulation,StepsBefore);
+    Checkpoint::Save(checkpoint.path,simulation,StepsBefore);
+    ContinueSteps(simulation,StepsAfter);
+    const std::string rain = FluidSimulation::rainState();
+
+    // another scene, which the restore has to replace completely
+    SimulationState restoredState(Width,Height);
+    FluidSimulation restored(restoredState);
+    restored.staggered = staggered;
+    restored.halfPrecision = half;
+    restored.sparse = sparse;
+    restored.rainPos = glm::vec2(1.0f,1.0f);
+
+    CHECK(Checkpoint::Load(checkpoint.path,restored) == ulong(StepsBefore));
+    CHECK(restored.rainPos == glm::vec2(40.0f,70.0f));
+    ContinueSteps(restored,StepsAfter);
+
+    Tests::CheckIdenticalSimulations(simulation,restored);
+    CHECK(restored.rainPos == simulation.rainPos);
+    CHECK(FluidSimulation::rainState() == rain);
+}
+
+TEST(CheckpointRoundTrip)
+{
+    CheckRoundTrip("TerrainFluidTests-roundtrip.ck",false,false,false);
+}
+
+TEST(CheckpointRoundTripSparse)
+{
+    CheckRoundTrip("TerrainFluidTests-sparse.ck",false,false,true);
+}
+
+TEST(CheckpointRoundTripStaggered)
+{
+    CheckRoundTrip("TerrainFluidTests-staggered.ck",true,false,false);
+}
+
+TEST(CheckpointRoundTripHalfPrecision)
+{
+    CheckRoundTrip("TerrainFluidTests-half.ck",false,true,false);
+}
+
+TEST(CheckpointRejectsOtherSize)
+{
+    TempFile checkpoint("TerrainFluidTests-size.ck");
+
+    SimulationState state(Width,Height);
+    Tests::MakeWetScene(state);
+    FluidSimulation simulation(state);
+    Checkpoint::Save(checkpoint.path,simulation,0);
+
+    SimulationState otherState(Width+1,Height);
+    FluidSimulation other(otherState);
+    const SimulationState before(otherState);
+    bool thrown = false;
+    try
+    {
+        Checkpoint::Load(checkpoint.path,other);
+    }
+    catch (Exception&)
+    {
+        thrown = true;
+    }
+    CHECK(thrown);
+    // unchanged after the failed load
+    CHECK_IDENTICAL(otherState.terrain,before.terrain);
+    CHECK_IDENTICAL(otherState.water,before.water);
+}
@@ -0,0 +1,193 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+
+#include "Test.h"
+#include "Grid2D.h"
+#include "GridLayout.h"
+
+#include <vector>
+
+// Storage layouts of Grid2D, on sizes that are powers of two, multiples of
+// the tile size, neither, and degenerate.
+
+struct Size
+{
+    uint w;
+    uint h;
+};
+
+static const Size Sizes[] = { {1,1}, {7,100}, {37,53}, {64,64}, {96,33}, {128,1} };
+
+/// Every cell maps to its own index within the storage.
+template<typename LAYOUT>
+static void CheckIndices(const Size& size)
+{
+    LAYOUT layout;
+    layout.resize(size.w,size.h);
+    CHECK(layout.storage() >= size_t(size.w)*size.h);
+
+    std::vector<int> used(layout.storage(),0);
+    for (uint y=0; y<size.h; y++)
+    {
+        for (uint x=0; x<size.w; x++)
+        {
+            size_t i = layout.index(y,x);
+            CHECK_MESSAGE(i < used.size(), "cell " << y << "," << x << " of " << size.w << "x" << size.h << " at " << i);
+            if (i < used.size())
+                used[i]++;
+        }
+    }
+    for (size_t i=0; i<used.size(); i++)
+        CHECK_MESSAGE(used[i] <= 1, "index " << i << " used " << used[i] << " times in " << size.w << "x" << size.h);
+}
+
+/// forEachTile() visits every cell once, the tiles are contiguous blocks
+/// of the storage and follow each other in storage order.
+template<typename LAYOUT>
+static void CheckTiles(const Size& size)
+{
+    LAYOUT layout;
+    layout.resize(size.w,size.h);
+
+    std::vector<int> visited(size_t(size.w)*size.h,0);
+    size_t previousEnd = 0;
+    bool ordered = true;
+    bool contiguous = true;
+    layout.forEachTile([&](uint x0, uint y0, uint x1, uint y1)
+    {
+        size_t first = layout.index(y0,x0);
+        size_t last = first;
+        for (uint y=y0; y<y1; y++)
+        {
+            for (uint x=x0; x<x1; x++)
+            {
+                visited[size_t(y)*size.w+x]++;
+                first = std::min(first,layout.index(y,x));
+                last = std::max(last,layout.index(y,x));
+            }
+        }
+        // a tile occupies one block of TileSize^2 elements, partial tiles
+        // leave padding in it
+        contiguous &= last-first < size_t(LAYOUT::TileSize)*LAYOUT::TileSize;
+        ordered &= first >= previousEnd;
+        previousEnd = last+1;
+    });
+
+    for (size_t i=0; i<visited.size(); i++)
+        CHECK_MESSAGE(visited[i] == 1, "cell " << i << " of " << size.w << "x" << size.h << " visited " << visited[i] << " times");
+    CHECK(ordered);
+    CHECK(contiguous);
+}
+
+TEST(GridLayoutIndices)
+{
+    for (const Size& size : Sizes)
+    {
+        CheckIndices<RowMajorLayout>(size);
+        CheckIndices< TiledLayout<32> >(size);
+        CheckIndices< TiledLayout<8> >(size);
+        CheckIndices<MortonLayout>(size);
+    }
+
+    // row-major is the layout of the kernels and the renderer
+    RowMajorLayout rows;
+    rows.resize(37,53);
+    CHECK(rows.index(5,7) == 5*37+7);
+    CHECK(rows.storage() == 37*53);
+}
+
+TEST(GridLayoutMortonRoundTrip)
+{
+    for (uint v : { 0u, 1u, 2u, 3u, 1000u, 65535u, 65536u, 0x7fffffffu, 0xffffffffu })
+        CHECK_MESSAGE(MortonLayout::Compact(MortonLayout::Spread(v)) == v, "value " << v);
+
+    MortonLayout layout;
+    layout.resize(37,53);
+    CHECK(layout.storage() == 64*64);
+    for (uint y=0; y<53; y++)
+    {
+        for (uint x=0; x<37; x++)
+        {
+            size_t i = layout.index(y,x);
+            CHECK(MortonLayout::Compact(i) == x && MortonLayout::Compact(i >> 1) == y);
+        }
+    }
+}
+
+TEST(GridLayoutTileCoverage)
+{
+    for (const Size& size : Sizes)
+    {
+        CheckTiles< TiledLayout<32> >(size);
+        CheckTiles< TiledLayout<8> >(size);
+        CheckTiles<MortonLayout>(size);
+    }
+
+    // rows for the row-major layout
+    RowMajorLayout rows;
+    rows.resize(37,53);
+    uint count = 0;
+    bool wholeRows = true;
+    rows.forEachTile([&](uint x0, uint y0, uint x1, uint y1)
+    {
+        wholeRows &= x0 == 0 && x1 == 37 && y0 == count && y1 == count+1;
+        count++;
+    });
+    CHECK(wholeRows && count == 53);
+}
+
+/// Value of a cell, distinct for every cell.
+static float CellValue(uint y, uint x)
+{
+    return float(y)*1000.0f + float(x);
+}
+
+TEST(GridLayoutCopyFrom)
+{
+    for (const Size& size : Sizes)
+    {
+        Grid2D<float> rows(size.w,size.h);
+        for (uint y=0; y<size.h; y++)
+            for (uint x=0; x<size.w; x++)
+                rows(y,x) = CellValue(y,x);
+
+        Grid2D< float,TiledLayout<32> > tiled;
+        tiled.copyFrom(rows);
+        Grid2D<float,MortonLayout> morton;
+        morton.copyFrom(tiled);
+        Grid2D<float> back;
+        back.copyFrom(morton);
+
+        CHECK(tiled.width() == size.w && tiled.height() == size.h);
+        CHECK(morton.width() == size.w && morton.height() == size.h);
+        CHECK(tiled.storageSize() >= tiled.size() && morton.storageSize() >= morton.size());
+        CHECK_IDENTICAL(back,rows);
+
+        bool same = true;
+        for (uint y=0; y<size.h; y++)
+        {
+            for (uint x=0; x<size.w; x++)
+                same &= tiled(y,x) == CellValue(y,x) && morton(y,x) == CellValue(y,x);
+        }
+        CHECK_MESSAGE(same, size.w << "x" << size.h);
+
+        // forEach visits every cell with its value
+        size_t visits = 0;
+        bool values = true;
+        morton.forEach([&](uint y, uint x, float& value)
+        {
+            values &= value == CellValue(y,x);
+            visits++;
+        });
+        CHECK(values && visits == morton.size());
+    }
+}
@@ -0,0 +1,62 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+
+#include "Test.h"
+
+using namespace Simulation;
+
+// Half precision storage rounds the stored velocities, so it is compared
+// against the single precision run with the bound of the documentation of
+// FluidSimulation::halfPrecision.
+
+static const uint Width = 161;
+static const uint Height = 139;
+static const int Steps = 10;
+
+/// Bound of FluidSimulation::halfPrecision after Steps steps.
+static const double Tolerance = 1e-4;
+
+static void CheckHalfPrecision(bool fused)
+{
+    SimulationState singleState(Width,Height);
+    Tests::MakeWetScene(singleState);
+    SimulationState halfState(singleState);
+
+    FluidSimulation single(singleState);
+    FluidSimulation half(halfState);
+    single.fused = half.fused = fused;
+    half.halfPrecision = true;
+    Tests::RunSteps(single,Steps);
+    Tests::RunSteps(half,Steps);
+
+    const PaddedGrid2D<float>* singleFields[] = { &singleState.terrain, &singleState.water, &singleState.suspendedSediment };
+    const PaddedGrid2D<float>* halfFields[] = { &halfState.terrain, &halfState.water, &halfState.suspendedSediment };
+    const char* names[] = { "terrain", "water", "sediment" };
+    for (int f=0; f<3; f++)
+    {
+        CHECK_MESSAGE(Tests::AllFinite(*halfFields[f]), names[f] << " not finite");
+        const double difference = Tests::MaxDifference(*singleFields[f],*halfFields[f]);
+        CHECK_MESSAGE(difference <= Tolerance, names[f] << " differs by " << difference << ", bound " << Tolerance);
+    }
+    // the scene has to erode
+    CHECK(Tests::MaxMagnitude(singleState.suspendedSediment) > 0.0);
+}
+
+TEST(HalfPrecisionMatchesSingle)
+{
+    CheckHalfPrecision(false);
+}
+
+TEST(HalfPrecisionMatchesSingleFused)
+{
+    CheckHalfPrecision(true);
+}
@@ -0,0 +1,153 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+
+#include "Test.h"
+#include "Simulation/Kernels.h"
+
+#include <cfloat>
+
+using namespace Simulation;
+
+static const uint Width = 133;
+static const uint Height = 71;
+
+/// Water depths of near-dry cells: subnormal, around FLT_MIN and small but
+/// normal.
+static const float NearDry[] = { 1e-44f, 1e-40f, FLT_MIN*0.5f, FLT_MIN, FLT_MIN*3.0f, 1e-35f, 1e-20f, 1e-8f };
+
+/// Outflow fluxes of near-dry cells, subnormal ones make sumFlux*dt
+/// subnormal.
+static const float TinyFlux[] = { 0.0f, 1e-45f, 1e-42f, 1e-39f, FLT_MIN, 1e-30f };
+
+/// A wet scene after a few steps, with dry columns and near-dry cells with
+/// tiny fluxes in the middle of the rows, so every SIMD lane sees them.
+static void MakeNearDryScene(SimulationState& state, FluidSimulation& simulation)
+{
+    Tests::MakeWetScene(state);
+    Tests::RunSteps(simulation,5);
+
+    for (uint y=0; y<Height; y++)
+    {
+        for (uint x=0; x<Width; x++)
+        {
+            if (x%17 == 3)
+            {
+                state.water(y,x) = 0.0f;
+            }
+            else if (x%5 == 1)
+            {
+                const uint i = x+y;
+                state.water(y,x) = NearDry[i%8];
+                PaddedGrid2D<float>* fluxes[] = { &simulation.lFlux, &simulation.rFlux, &simulation.tFlux, &simulation.bFlux };
+                for (uint f=0; f<4; f++)
+                    (*fluxes[f])(y,x) = TinyFlux[(i+f)%6];
+            }
+        }
+    }
+}
+
+/// Runs one simulateFlow() from the same start with the scalar reference
+/// and with variant, and compares water, fluxes and velocities.
+static void CheckFlowVariant(KernelVariant variant, bool staggered)
+{
+    if (!KernelVariantSupported(variant))
+    {
+        std::cout << "  " << KernelVariantName(variant) << " not supported, skipped" << std::endl;
+        return;
+    }
+
+    SimulationState state(Width,Height);
+    FluidSimulation start(state);
+    MakeNearDryScene(state,start);
+    start.staggered = staggered;
+    start.applyFluxModel();
+
+    SimulationState referenceState(state);
+    FluidSimulation reference(referenceState);
+    SimulationState vectorState(state);
+    FluidSimulation vector(vectorState);
+    for (FluidSimulation* s : { &reference, &vector })
+    {
+        s->staggered = staggered;
+        s->applyFluxModel();
+        s->lFlux = start.lFlux; s->rFlux = start.rFlux;
+        s->tFlux = start.tFlux; s->bFlux = start.bFlux;
+        s->xFlux = start.xFlux; s->yFlux = start.yFlux;
+    }
+
+    reference.setKernelVariant(Stage::Flow,KernelVariant::Scalar);
+    vector.setKernelVariant(Stage::Flow,variant);
+    reference.simulateFlow(Tests::StepDt);
+    vector.simulateFlow(Tests::StepDt);
+
+    struct Field
+    {
+        const char* name;
+        const PaddedGrid2D<float>* reference;
+        const PaddedGrid2D<float>* vector;
+    };
+    const Field padded[] = {
+        { "water", &reference.water, &vector.water },
+        { "lFlux", &reference.lFlux, &vector.lFlux }, { "rFlux", &reference.rFlux, &vector.rFlux },
+        { "tFlux", &reference.tFlux, &vector.tFlux }, { "bFlux", &reference.bFlux, &vector.bFlux },
+        { "xFlux", &reference.xFlux, &vector.xFlux }, { "yFlux", &reference.yFlux, &vector.yFlux } };
+    for (const Field& field : padded)
+    {
+        CHECK_MESSAGE(Tests::AllFinite(*field.reference), field.name << " of the scalar reference not finite");
+        CHECK_MESSAGE(Tests::AllFinite(*field.vector), field.name << " of " << KernelVariantName(variant) << " not finite");
+        const double bound = Kernels::VectorizedFlowTolerance*Tests::MaxMagnitude(*field.reference);
+        const double difference = Tests::MaxDifference(*field.reference,*field.vector);
+        CHECK_MESSAGE(difference <= bound, field.name << " of " << KernelVariantName(variant) << " differs by "
+                      << difference << ", bound " << bound);
+    }
+
+    const Grid2D<float>* velocities[][2] = { { &reference.uVel, &vector.uVel }, { &reference.vVel, &vector.vVel } };
+    for (uint v=0; v<2; v++)
+    {
+        const char* name = v == 0 ? "uVel" : "vVel";
+        CHECK_MESSAGE(Tests::AllFinite(*velocities[v][0]), name << " of the scalar reference not finite");
+        CHECK_MESSAGE(Tests::AllFinite(*velocities[v][1]), name << " of " << KernelVariantName(variant) << " not finite");
+        const double bound = Kernels::VectorizedFlowTolerance*Tests::MaxMagnitude(*velocities[v][0]);
+        const double difference = Tests::MaxDifference(*velocities[v][0],*velocities[v][1]);
+        CHECK_MESSAGE(difference <= bound, name << " of " << KernelVariantName(variant) << " differs by "
+                      << difference << ", bound " << bound);
+    }
+    CHECK(std::isfinite(vector.maxVelocity()));
+    CHECK(std::abs(vector.maxVelocity()-reference.maxVelocity()) <= Kernels::VectorizedFlowTolerance*reference.maxVelocity());
+}
+
+TEST(VectorizedFlowMatchesScalar)
+{
+    CheckFlowVariant(KernelVariant::AVX2,false);
+    CheckFlowVariant(KernelVariant::AVX512,false);
+}
+
+TEST(VectorizedStaggeredFlowMatchesScalar)
+{
+    CheckFlowVariant(KernelVariant::AVX2,true);
+    CheckFlowVariant(KernelVariant::AVX512,true);
+}
+
+TEST(PortableKernelsIdentical)
+{
+    // the other stages and variants are the same source, bit for bit
+    SimulationState referenceState(Width,Height);
+    Tests::MakeWetScene(referenceState);
+    SimulationState sse4State(referenceState);
+    FluidSimulation reference(referenceState);
+    FluidSimulation sse4(sse4State);
+    reference.setKernelVariant(KernelVariant::Scalar);
+    sse4.setKernelVariant(KernelVariant::SSE4);
+    Tests::RunSteps(reference,10);
+    Tests::RunSteps(sse4,10);
+    Tests::CheckIdenticalSimulations(reference,sse4);
+}
@@ -0,0 +1,95 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+
+#include "Test.h"
+#include "Simulation/Profiler.h"
+
+#include <cstdlib>
+#include <sstream>
+
+using namespace Simulation;
+
+/// Width of a histogram bucket relative to its lower bound, 8 buckets per
+/// power of two.
+static const double BucketWidth = std::pow(2.0,1.0/8)-1.0;
+
+TEST(LatencyHistogramPercentiles)
+{
+    // 10, 20, ..., 1000 microseconds
+    LatencyHistogram h;
+    for (int i=1; i<=100; i++)
+        h.add(i*10e-6);
+
+    CHECK(h.count() == 100);
+    CHECK(std::abs(h.total()-50500e-6) < 1e-12);
+    CHECK(h.min() == 10e-6);
+    CHECK(h.max() == 1000e-6);
+
+    const double p50 = h.percentile(0.5);
+    const double p99 = h.percentile(0.99);
+    CHECK_MESSAGE(std::abs(p50/500e-6-1.0) <= BucketWidth, "p50 " << p50);
+    CHECK_MESSAGE(std::abs(p99/990e-6-1.0) <= BucketWidth, "p99 " << p99);
+
+    // limited to the observed range
+    CHECK(h.percentile(1.0) <= h.max());
+    CHECK(h.percentile(0.0) >= h.min());
+
+    h.reset();
+    CHECK(h.count() == 0);
+    CHECK(h.percentile(0.5) == 0.0);
+}
+
+TEST(ProfilerBusyAndIdleAddUp)
+{
+    SimulationState state(96,80);
+    FluidSimulation simulation(state);
+    Tests::MakeWetScene(state);
+    Tests::RunSteps(simulation,5);
+
+    const Profiler& profiler = simulation.profiler;
+    const Profiler::StageStats& flow = profiler.stage(Stage::Flow);
+    const double total = flow.latency.total();
+    CHECK(flow.latency.count() == 5);
+    CHECK(total > 0.0);
+
+    // the workers only record time spent inside the stage
+    double busy = 0.0;
+    for (uint t=0; t<profiler.threadCount(); t++)
+    {
+        CHECK(flow.busy(t) <= total);
+        CHECK(std::abs(flow.busy(t)+flow.idle(t)-total) <= 1e-12*total);
+        busy += flow.busy(t);
+    }
+    CHECK(busy > 0.0);
+
+    // the same split in the CSV, written with 6 significant digits
+    std::stringstream csv;
+    profiler.writeCsv(csv);
+    std::string line;
+    int rows = 0;
+    while (std::getline(csv,line))
+    {
+        if (line.compare(0,5,"flow,") != 0)
+            continue;
+        std::vector<double> values;
+        std::stringstream ls(line.substr(5));
+        std::string item;
+        while (std::getline(ls,item,','))
+            values.push_back(std::atof(item.c_str()));
+        // thread,count,total_s,mean_s,p50_s,p99_s,max_s,busy_s,idle_s
+        CHECK(values.size() == 9);
+        if (values.size() == 9)
+            CHECK(std::abs(values[7]+values[8]-values[2]) <= 1e-5*values[2]);
+        rows++;
+    }
+    CHECK(rows == int(profiler.threadCount()));
+}
@@ -0,0 +1,183 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+
+#include "Test.h"
+#include "Simulation/Parallel.h"
+#include "Simulation/TemporalBlocking.h"
+
+using namespace Simulation;
+
+// The update modes and the parallel settings change how the grid is
+// traversed but not the operations per cell, so they have to produce
+// bitwise identical results.
+
+// a band of the fused sweep is 64 rows and a sparse tile 32x32 cells, the
+// size leaves partial bands, tiles and SIMD tails
+static const uint Width = 161;
+static const uint Height = 139;
+static const int Steps = 30;
+
+/// Runs a fresh simulation of the scene with the given modes.
+struct Run
+{
+    SimulationState state;
+    FluidSimulation simulation;
+
+    Run(void (*scene)(SimulationState&), bool fused, bool sparse, bool staggered=false, bool half=false, bool rain=true)
+        : state(Width,Height),
+          simulation(state)
+    {
+        scene(state);
+        simulation.fused = fused;
+        simulation.sparse = sparse;
+        simulation.staggered = staggered;
+        simulation.halfPrecision = half;
+        Tests::RunSteps(simulation,Steps,rain);
+    }
+};
+
+/// Runs a fresh simulation of the scene in blocks of BlockSteps steps with
+/// TemporalBlocking, the same steps as Run.
+struct BlockedRun
+{
+    static const int BlockSteps = 5;
+
+    SimulationState state;
+    FluidSimulation simulation;
+    TemporalBlocking blocking;
+
+    BlockedRun(void (*scene)(SimulationState&), bool staggered, uint tileSize, float maxDisplacement)
+        : state(32,32),
+          simulation(state),
+          blocking(simulation)
+    {
+        // created at another size, the blocks have to follow the resize
+        state.resize(Width,Height);
+        simulation.resize();
+        scene(state);
+        simulation.staggered = staggered;
+        blocking.tileSize = tileSize;
+        blocking.maxDisplacement = maxDisplacement;
+
+        FluidSimulation::restartRain();
+        const std::vector<bool> rain(BlockSteps,true), flood(BlockSteps,false);
+        for (int i=0; i<Steps; i+=BlockSteps)
+            blocking.advance(Tests::StepDt,rain,flood);
+    }
+};
+
+TEST(FusedMatchesStaged)
+{
+    Run staged(Tests::MakeWetScene,false,false);
+    Run fused(Tests::MakeWetScene,true,false);
+    Tests::CheckIdenticalSimulations(staged.simulation,fused.simulation);
+    CHECK(Tests::MaxMagnitude(staged.simulation.sediment) > 0.0);
+}
+
+TEST(FusedMatchesStagedHalfPrecision)
+{
+    Run staged(Tests::MakeWetScene,false,false,false,true);
+    Run fused(Tests::MakeWetScene,true,false,false,true);
+    Tests::CheckIdenticalSimulations(staged.simulation,fused.simulation);
+}
+
+TEST(TemporalBlockingMatchesStaged)
+{
+    const ParallelSettings defaults = Parallel::Settings();
+    ParallelSettings settings = defaults;
+    settings.backend = ParallelBackend::ThreadPool;
+
+    const bool models[] = { false, true };
+    const uint threads[] = { 1, 3 };
+    for (bool staggered : models)
+    {
+        Parallel::Configure(defaults);
+        Run staged(Tests::MakeWetScene,false,false,staggered);
+        for (uint n : threads)
+        {
+            settings.threads = n;
+            Parallel::Configure(settings);
+            // 64 cell tiles leave partial tiles at the right and bottom
+            BlockedRun blocked(Tests::MakeWetScene,staggered,64,2.0f);
+            Tests::CheckIdenticalSimulations(staged.simulation,blocked.simulation);
+            CHECK(blocked.blocking.fallbacks == 0);
+        }
+    }
+    Parallel::Configure(defaults);
+}
+
+TEST(TemporalBlockingFallsBackToStaged)
+{
+    // every wet block moves sediment further than the bound allows
+    Run staged(Tests::MakeWetScene,false,false);
+    BlockedRun blocked(Tests::MakeWetScene,false,64,1e-6f);
+    Tests::CheckIdenticalSimulations(staged.simulation,blocked.simulation);
+    CHECK(blocked.blocking.fallbacks > 0);
+}
+
+TEST(SparseMatchesDense)
+{
+    // without rain, which would wet every tile
+    Run dense(Tests::MakePartlyWetScene,false,false,false,false,false);
+    Run sparse(Tests::MakePartlyWetScene,false,true,false,false,false);
+    Tests::CheckIdenticalSimulations(dense.simulation,sparse.simulation);
+    CHECK(Tests::MaxMagnitude(sparse.simulation.sediment) > 0.0);
+    // the scene has to leave tiles to skip
+    CHECK(sparse.simulation.activeTiles.count() < sparse.simulation.activeTiles.tiles());
+}
+
+TEST(SparseMatchesDenseWet)
+{
+    Run dense(Tests::MakeWetScene,false,false);
+    Run sparse(Tests::MakeWetScene,false,true);
+    Tests::CheckIdenticalSimulations(dense.simulation,sparse.simulation);
+}
+
+TEST(SparseMatchesDenseStaggered)
+{
+    Run dense(Tests::MakePartlyWetScene,false,false,true,false,false);
+    Run sparse(Tests::MakePartlyWetScene,false,true,true,false,false);
+    Tests::CheckIdenticalSimulations(dense.simulation,sparse.simulation);
+}
+
+TEST(ThreadCountIndependent)
+{
+    const ParallelSettings defaults = Parallel::Settings();
+
+    // one worker as the reference, then several with both schedules and a
+    // grain that splits the rows unevenly
+    ParallelSettings settings = defaults;
+    settings.backend = ParallelBackend::ThreadPool;
+    settings.threads = 1;
+    Parallel::Configure(settings);
+    Run reference(Tests::MakeWetScene,false,true);
+    Run referenceFused(Tests::MakeWetScene,true,false);
+
+    const uint threads[] = { 3, 4 };
+    const Schedule schedules[] = { Schedule::Static, Schedule::Dynamic };
+    for (uint n : threads)
+    {
+        for (Schedule schedule : schedules)
+        {
+            settings.threads = n;
+            settings.schedule = schedule;
+            settings.grain = 5;
+            Parallel::Configure(settings);
+            Run sparse(Tests::MakeWetScene,false,true);
+            Run fused(Tests::MakeWetScene,true,false);
+            Tests::CheckIdenticalSimulations(reference.simulation,sparse.simulation);
+            Tests::CheckIdenticalSimulations(referenceFused.simulation,fused.simulation);
+        }
+    }
+
+    Parallel::Configure(defaults);
+}
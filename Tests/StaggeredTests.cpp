@@ -0,0 +1,108 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+
+#include "Test.h"
+
+using namespace Simulation;
+
+// The staggered flux model (FluidSimulation::staggered) stores the net flow
+// of an edge, the outflow model both outflows. Both evaluate and limit the
+// outflows of an edge with the same operations, so they agree until an edge
+// carries flow in both directions at once, and drift apart afterwards. The
+// bounds are those of the documentation of FluidSimulation::staggered.
+
+static const uint Width = 161;
+static const uint Height = 139;
+
+/// Largest difference after the first two steps from rest, relative to the
+/// largest magnitude of the field. Flows only reverse from the third step.
+static const double FirstStepsTolerance = 1e-6;
+
+/// Relative root mean square differences after ten steps.
+static const int Steps = 10;
+static const double TerrainTolerance = 1e-5;
+static const double WaterTolerance = 1e-3;
+static const double SedimentTolerance = 5e-2;
+
+/// Relative difference of the total water after ten steps, both models
+/// conserve it.
+static const double VolumeTolerance = 1e-6;
+
+/// Runs the scene with both flux models.
+struct Models
+{
+    SimulationState outflowState;
+    SimulationState staggeredState;
+    FluidSimulation outflow;
+    FluidSimulation staggered;
+
+    Models(void (*scene)(SimulationState&), int steps, bool rain)
+        : outflowState(Width,Height),
+          staggeredState(Width,Height),
+          outflow(outflowState),
+          staggered(staggeredState)
+    {
+        scene(outflowState);
+        scene(staggeredState);
+        staggered.staggered = true;
+        Tests::RunSteps(outflow,steps,rain);
+        Tests::RunSteps(staggered,steps,rain);
+    }
+};
+
+template<typename GRID>
+static void CheckMaxDifference(const char* name, const GRID& outflow, const GRID& staggered, double tolerance)
+{
+    const double bound = tolerance*Tests::MaxMagnitude(outflow);
+    const double difference = Tests::MaxDifference(outflow,staggered);
+    CHECK_MESSAGE(difference <= bound, name << " differs by " << difference << ", bound " << bound);
+}
+
+static void CheckFirstSteps(void (*scene)(SimulationState&), bool rain)
+{
+    Models models(scene,2,rain);
+    CheckMaxDifference("terrain",models.outflowState.terrain,models.staggeredState.terrain,FirstStepsTolerance);
+    CheckMaxDifference("water",models.outflowState.water,models.staggeredState.water,FirstStepsTolerance);
+    CheckMaxDifference("sediment",models.outflowState.suspendedSediment,models.staggeredState.suspendedSediment,FirstStepsTolerance);
+    CheckMaxDifference("uVel",models.outflow.uVel,models.staggered.uVel,FirstStepsTolerance);
+    CheckMaxDifference("vVel",models.outflow.vVel,models.staggered.vVel,FirstStepsTolerance);
+}
+
+static void CheckSteps(void (*scene)(SimulationState&), bool rain)
+{
+    Models models(scene,Steps,rain);
+    const SimulationState& a = models.outflowState;
+    const SimulationState& b = models.staggeredState;
+
+    const double terrain = Tests::RelativeRmsDifference(a.terrain,b.terrain);
+    const double water = Tests::RelativeRmsDifference(a.water,b.water);
+    const double sediment = Tests::RelativeRmsDifference(a.suspendedSediment,b.suspendedSediment);
+    CHECK_MESSAGE(terrain <= TerrainTolerance, "terrain differs by " << terrain << ", bound " << TerrainTolerance);
+    CHECK_MESSAGE(water <= WaterTolerance, "water differs by " << water << ", bound " << WaterTolerance);
+    CHECK_MESSAGE(sediment <= SedimentTolerance, "sediment differs by " << sediment << ", bound " << SedimentTolerance);
+
+    const double volume = std::abs(Tests::Total(b.water)/Tests::Total(a.water) - 1.0);
+    CHECK_MESSAGE(volume <= VolumeTolerance, "water volume differs by " << volume << ", bound " << VolumeTolerance);
+    CHECK(Tests::MaxMagnitude(a.suspendedSediment) > 0.0);
+}
+
+TEST(StaggeredMatchesOutflowFirstSteps)
+{
+    CheckFirstSteps(Tests::MakeWetScene,true);
+    CheckFirstSteps(Tests::MakePartlyWetScene,false);
+}
+
+TEST(StaggeredCloseToOutflow)
+{
+    CheckSteps(Tests::MakeWetScene,true);
+    CheckSteps(Tests::MakePartlyWetScene,false);
+}
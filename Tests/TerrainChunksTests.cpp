@@ -0,0 +1,235 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+
+#include "Test.h"
+#include "TerrainChunks.h"
+
+#include <algorithm>
+#include <cmath>
+#include <set>
+
+// Chunk selection and index patterns of the viewer, without a GPU.
+
+/// Orthographic projection like glOrtho, the view looks along -z.
+static glm::mat4 Ortho(float l, float r, float b, float t, float n, float f)
+{
+    glm::mat4 m(1.0f);
+    m[0][0] = 2.0f/(r-l);
+    m[1][1] = 2.0f/(t-b);
+    m[2][2] = -2.0f/(f-n);
+    m[3][0] = -(r+l)/(r-l);
+    m[3][1] = -(t+b)/(t-b);
+    m[3][2] = -(f+n)/(f-n);
+    return m;
+}
+
+/// View matrix of a camera at eye that looks along -z.
+static glm::mat4 ViewFrom(const glm::vec3& eye)
+{
+    glm::mat4 m(1.0f);
+    m[3] = glm::vec4(-eye.x,-eye.y,-eye.z,1.0f);
+    return m;
+}
+
+/// Chunks of 8x8 grids with one world unit per cell, all heights in [0,1].
+struct ChunkScene
+{
+    TerrainChunks chunks;
+    std::vector<glm::vec2> ranges;
+
+    ChunkScene()
+    {
+        chunks.scale = 1.0f;
+        chunks.lodDistance = 20.0f;
+        chunks.resize(8*TerrainChunks::Size+1,8*TerrainChunks::Size+1);
+        ranges.assign(chunks.count(),glm::vec2(0.0f,1.0f));
+    }
+
+    /// Level select() picks for chunk i before neighbours are limited.
+    uint distanceLevel(uint i, const glm::vec3& eye) const
+    {
+        glm::vec3 min, max;
+        chunks.bounds(i,ranges[i],min,max);
+        float dx = std::max(0.0f,std::max(min.x-eye.x,eye.x-max.x));
+        float dy = std::max(0.0f,std::max(min.y-eye.y,eye.y-max.y));
+        float dz = std::max(0.0f,std::max(min.z-eye.z,eye.z-max.z));
+        float distance = std::sqrt(dx*dx+dy*dy+dz*dz);
+        uint level = 0;
+        while (level+1 < TerrainChunks::Levels && distance >= chunks.lodDistance*float(1u << level))
+            level++;
+        return level;
+    }
+};
+
+/// Visible everything around the terrain.
+static const glm::mat4 Everything = Ortho(-1e4f,1e4f,-1e4f,1e4f,-1e4f,1e4f);
+
+TEST(ChunkLevelsDifferByAtMostOne)
+{
+    ChunkScene scene;
+    TerrainChunks& chunks = scene.chunks;
+    const uint nx = chunks.countX();
+    const uint ny = chunks.countY();
+
+    // camera above a corner, the distance levels jump by more than one
+    // between some neighbours
+    const glm::vec3 eye(-250.0f,5.0f,-250.0f);
+    std::vector<TerrainChunks::Draw> draws;
+    chunks.select(Everything,ViewFrom(eye),scene.ranges,draws);
+    CHECK(draws.size() == chunks.count());
+
+    std::vector<uint> levels(chunks.count(),~0u);
+    for (const TerrainChunks::Draw& draw : draws)
+        levels[draw.chunk] = draw.level;
+
+    bool jumps = false;
+    for (uint cy=0; cy<ny; cy++)
+    {
+        for (uint cx=0; cx<nx; cx++)
+        {
+            const uint i = cy*nx+cx;
+            if (cx+1 < nx) jumps |= scene.distanceLevel(i+1,eye) > scene.distanceLevel(i,eye)+1;
+
+            // the coarsest level that is at most the distance level and at
+            // most one above every neighbour
+            uint expected = scene.distanceLevel(i,eye);
+            if (cx > 0)    expected = std::min(expected,levels[i-1]+1);
+            if (cx+1 < nx) expected = std::min(expected,levels[i+1]+1);
+            if (cy > 0)    expected = std::min(expected,levels[i-nx]+1);
+            if (cy+1 < ny) expected = std::min(expected,levels[i+nx]+1);
+            CHECK_MESSAGE(levels[i] == expected, "chunk " << i << " level " << levels[i] << ", expected " << expected);
+
+            if (cx+1 < nx) CHECK(std::abs(int(levels[i])-int(levels[i+1])) <= 1);
+            if (cy+1 < ny) CHECK(std::abs(int(levels[i])-int(levels[i+nx])) <= 1);
+        }
+    }
+    CHECK(jumps);
+    CHECK(levels[0] == 0);
+    CHECK(levels[chunks.count()-1] == TerrainChunks::Levels-1);
+}
+
+TEST(ChunkStitchesTowardsCoarserNeighbours)
+{
+    ChunkScene scene;
+    TerrainChunks& chunks = scene.chunks;
+    const uint nx = chunks.countX();
+    const uint ny = chunks.countY();
+
+    // camera above the middle, the levels grow in all directions
+    std::vector<TerrainChunks::Draw> draws;
+    chunks.select(Everything,ViewFrom(glm::vec3(10.0f,5.0f,-30.0f)),scene.ranges,draws);
+
+    std::vector<TerrainChunks::Draw> byChunk(chunks.count());
+    for (const TerrainChunks::Draw& draw : draws)
+        byChunk[draw.chunk] = draw;
+
+    uint stitched = 0;
+    for (uint cy=0; cy<ny; cy++)
+    {
+        for (uint cx=0; cx<nx; cx++)
+        {
+            const uint i = cy*nx+cx;
+            const uint level = byChunk[i].level;
+            uint expected = 0;
+            if (cx > 0      && byChunk[i-1].level > level)  expected |= TerrainChunks::StitchLeft;
+            if (cx+1 < nx   && byChunk[i+1].level > level)  expected |= TerrainChunks::StitchRight;
+            if (cy > 0      && byChunk[i-nx].level > level) expected |= TerrainChunks::StitchBottom;
+            if (cy+1 < ny   && byChunk[i+nx].level > level) expected |= TerrainChunks::StitchTop;
+            CHECK_MESSAGE(byChunk[i].stitch == expected, "chunk " << i << " stitch " << byChunk[i].stitch << ", expected " << expected);
+            stitched += expected != 0;
+        }
+    }
+    CHECK(stitched > 0);
+}
+
+/// Positions along an edge of the vertices a pattern uses on it.
+static std::set<uint> EdgeVertices(const TerrainChunks& chunks, uint level, uint stitch, uint edge)
+{
+    const uint n = TerrainChunks::Size;
+    const TerrainChunks::Pattern& pattern = chunks.pattern(level,stitch);
+    std::set<uint> result;
+    for (uint k=0; k<pattern.count; k++)
+    {
+        const uint v = chunks.indices()[pattern.first+k];
+        const uint x = v%(n+1);
+        const uint y = v/(n+1);
+        if (edge == TerrainChunks::StitchLeft && x == 0)   result.insert(y);
+        if (edge == TerrainChunks::StitchRight && x == n)  result.insert(y);
+        if (edge == TerrainChunks::StitchBottom && y == 0) result.insert(x);
+        if (edge == TerrainChunks::StitchTop && y == n)    result.insert(x);
+    }
+    return result;
+}
+
+TEST(ChunkStitchedEdgesMatchCoarserLevel)
+{
+    TerrainChunks chunks;
+    const uint n = TerrainChunks::Size;
+
+    // every quad of the finest pattern is two triangles
+    CHECK(chunks.pattern(0,0).count == 6*n*n);
+
+    const uint edges[] = { TerrainChunks::StitchLeft, TerrainChunks::StitchRight,
+                           TerrainChunks::StitchBottom, TerrainChunks::StitchTop };
+    // the coarser neighbour draws the opposite edge
+    const uint opposite[] = { TerrainChunks::StitchRight, TerrainChunks::StitchLeft,
+                              TerrainChunks::StitchTop, TerrainChunks::StitchBottom };
+    for (uint level=0; level+1<TerrainChunks::Levels; level++)
+    {
+        for (uint stitch=0; stitch<TerrainChunks::StitchCount; stitch++)
+        {
+            for (uint e=0; e<4; e++)
+            {
+                std::set<uint> own = EdgeVertices(chunks,level,stitch,edges[e]);
+                // the neighbour's edge vertices, it may be stitched elsewhere
+                std::set<uint> coarse = EdgeVertices(chunks,level+1,opposite[e] ^ (TerrainChunks::StitchCount-1),opposite[e]);
+                std::set<uint> fine = EdgeVertices(chunks,level,0,edges[e]);
+                const std::set<uint>& expected = (stitch & edges[e]) ? coarse : fine;
+                CHECK_MESSAGE(own == expected, "level " << level << " stitch " << stitch << " edge " << edges[e]);
+                CHECK(fine.size() == n/(1u << level)+1);
+            }
+        }
+    }
+}
+
+TEST(ChunkSelectCullsOutsideFrustum)
+{
+    ChunkScene scene;
+    TerrainChunks& chunks = scene.chunks;
+
+    // a box of view space x in [-100,60], z in [-200,-20], camera at the
+    // origin looking along -z
+    const glm::vec3 eye(0.0f,0.0f,0.0f);
+    const glm::mat4 proj = Ortho(-100.0f,60.0f,-1e4f,1e4f,20.0f,200.0f);
+
+    // chunks above the view volume
+    scene.ranges[chunks.count()-1] = glm::vec2(2e4f,3e4f);
+
+    std::vector<TerrainChunks::Draw> draws;
+    chunks.select(proj,ViewFrom(eye),scene.ranges,draws);
+
+    std::set<uint> drawn;
+    for (const TerrainChunks::Draw& draw : draws)
+        drawn.insert(draw.chunk);
+
+    uint expected = 0;
+    for (uint i=0; i<chunks.count(); i++)
+    {
+        glm::vec3 min, max;
+        chunks.bounds(i,scene.ranges[i],min,max);
+        bool visible = max.x >= -100.0f && min.x <= 60.0f && max.z >= -200.0f && min.z <= -20.0f &&
+                       min.y <= 1e4f && max.y >= -1e4f;
+        CHECK_MESSAGE(visible == (drawn.count(i) == 1), "chunk " << i << (visible ? " not drawn" : " drawn"));
+        expected += visible;
+    }
+    CHECK(expected > 0 && expected < chunks.count());
+}
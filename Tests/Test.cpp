@@ -0,0 +1,127 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+
+#include "Test.h"
+#include "Exception.h"
+
+#include <iostream>
+#include <vector>
+
+using namespace Tests;
+
+namespace {
+
+struct Entry
+{
+    const char* name;
+    TestFn fn;
+};
+
+std::vector<Entry>& Registry()
+{
+    static std::vector<Entry> tests;
+    return tests;
+}
+
+int failedChecks = 0;
+
+} // anonymous namespace
+
+Registration::Registration(const char* name, TestFn fn)
+{
+    Entry entry = { name, fn };
+    Registry().push_back(entry);
+}
+
+void Tests::Fail(const char* file, int line, const std::string& message)
+{
+    std::cout << "  " << file << ":" << line << ": " << message << std::endl;
+    failedChecks++;
+}
+
+int Tests::RunAll(const std::string& filter)
+{
+    int failed = 0;
+    int run = 0;
+    for (const Entry& test : Registry())
+    {
+        if (std::string(test.name).find(filter) == std::string::npos)
+            continue;
+
+        std::cout << test.name << std::endl;
+        failedChecks = 0;
+        try
+        {
+            test.fn();
+        }
+        catch (std::exception& e)
+        {
+            Fail(__FILE__,__LINE__,std::string("exception: ") + e.what());
+        }
+        run++;
+        if (failedChecks > 0)
+        {
+            std::cout << "FAILED " << test.name << std::endl;
+            failed++;
+        }
+    }
+    std::cout << run-failed << " of " << run << " tests passed" << std::endl;
+    return failed;
+}
+
+// Scenes
+///////////////////////////////////////////////
+
+void Tests::MakeWetScene(SimulationState& state)
+{
+    state.createPerlinTerrain();
+    for (uint y=0; y<state.water.height(); y++)
+    {
+        for (uint x=0; x<state.water.width(); x++)
+            state.water(y,x) = std::max(0.0f,-state.terrain(y,x)) + 0.01f;
+    }
+}
+
+void Tests::MakePartlyWetScene(SimulationState& state)
+{
+    state.createPerlinTerrain();
+    for (uint y=0; y<state.water.height(); y++)
+    {
+        for (uint x=0; x<state.water.width(); x++)
+            state.water(y,x) = std::max(0.0f,-32.0f-state.terrain(y,x));
+    }
+}
+
+void Tests::RunSteps(Simulation::FluidSimulation& simulation, int steps, bool rain)
+{
+    Simulation::FluidSimulation::restartRain();
+    for (int i=0; i<steps; i++)
+        simulation.update(StepDt,rain);
+}
+
+void Tests::CheckIdenticalSimulations(const Simulation::FluidSimulation& a, const Simulation::FluidSimulation& b)
+{
+    CHECK_IDENTICAL(a.terrain,b.terrain);
+    CHECK_IDENTICAL(a.water,b.water);
+    CHECK_IDENTICAL(a.sediment,b.sediment);
+    CHECK_IDENTICAL(a.lFlux,b.lFlux);
+    CHECK_IDENTICAL(a.rFlux,b.rFlux);
+    CHECK_IDENTICAL(a.tFlux,b.tFlux);
+    CHECK_IDENTICAL(a.bFlux,b.bFlux);
+    CHECK_IDENTICAL(a.xFlux,b.xFlux);
+    CHECK_IDENTICAL(a.yFlux,b.yFlux);
+    CHECK_IDENTICAL(a.uVel,b.uVel);
+    CHECK_IDENTICAL(a.vVel,b.vVel);
+    CHECK_IDENTICAL(a.uVelHalf,b.uVelHalf);
+    CHECK_IDENTICAL(a.vVelHalf,b.vVelHalf);
+    CHECK(a.maxVelocity() == b.maxVelocity());
+}
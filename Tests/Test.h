@@ -0,0 +1,179 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+
+#ifndef TEST_H
+#define TEST_H
+
+#include "platform_includes.h"
+#include "SimulationState.h"
+#include "Simulation/FluidSimulation.h"
+
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include <string>
+
+/// Minimal test registry of TerrainFluidTests.
+///
+/// TEST(Name) defines a test that main.cpp runs, CHECK(condition) records a
+/// failure and lets the test continue. A test that throws fails as well.
+namespace Tests {
+
+typedef void (*TestFn)();
+
+/// Registers a test, used by TEST().
+struct Registration
+{
+    Registration(const char* name, TestFn fn);
+};
+
+/// Records a failed check of the running test.
+void Fail(const char* file, int line, const std::string& message);
+
+/// Runs the tests whose name contains filter (all for an empty filter),
+/// returns the number of failed tests.
+int RunAll(const std::string& filter);
+
+#define TEST(NAME) \
+    static void NAME(); \
+    static Tests::Registration NAME##Registration(#NAME,NAME); \
+    static void NAME()
+
+#define CHECK(CONDITION) \
+    do { if (!(CONDITION)) Tests::Fail(__FILE__,__LINE__,#CONDITION); } while (0)
+
+/// CHECK() with a message that is only built if the check fails.
+#define CHECK_MESSAGE(CONDITION,MESSAGE) \
+    do { if (!(CONDITION)) { std::ostringstream out; out << MESSAGE; Tests::Fail(__FILE__,__LINE__,out.str()); } } while (0)
+
+// Scenes
+///////////////////////////////////////////////
+
+/// Timestep of the scenes, the 60 Hz step of the viewer.
+const double StepDt = 1000.0/60;
+
+/// The perlin terrain of SimulationState with lakes in its valleys and a
+/// thin film of water elsewhere, so every stage has work on every tile.
+void MakeWetScene(SimulationState& state);
+
+/// The perlin terrain with water only in a few lakes, most tiles stay dry.
+void MakePartlyWetScene(SimulationState& state);
+
+/// Restarts the rain and runs steps update() calls, with or without rain.
+void RunSteps(Simulation::FluidSimulation& simulation, int steps, bool rain=true);
+
+// Comparisons
+///////////////////////////////////////////////
+
+/// Index of the first cell whose bits differ, -1 if the grids are bitwise
+/// identical. Grids of different sizes differ at cell 0.
+template<typename GRID>
+long FirstDifference(const GRID& a, const GRID& b)
+{
+    if (a.width() != b.width() || a.height() != b.height())
+        return 0;
+    for (uint y=0; y<a.height(); y++)
+    {
+        for (uint x=0; x<a.width(); x++)
+        {
+            if (memcmp(&a(y,x),&b(y,x),sizeof(a(y,x))) != 0)
+                return long(y)*a.width()+x;
+        }
+    }
+    return -1;
+}
+
+/// Largest |a-b| over all cells of two grids of the same size.
+template<typename GRID>
+double MaxDifference(const GRID& a, const GRID& b)
+{
+    double result = 0.0;
+    for (uint y=0; y<a.height(); y++)
+    {
+        for (uint x=0; x<a.width(); x++)
+            result = std::max(result,std::abs(double(a(y,x))-double(b(y,x))));
+    }
+    return result;
+}
+
+/// Largest |a| over all cells.
+template<typename GRID>
+double MaxMagnitude(const GRID& a)
+{
+    double result = 0.0;
+    for (uint y=0; y<a.height(); y++)
+    {
+        for (uint x=0; x<a.width(); x++)
+            result = std::max(result,std::abs(double(a(y,x))));
+    }
+    return result;
+}
+
+/// Root mean square of a-b relative to the root mean square of a, zero if a
+/// is zero everywhere.
+template<typename GRID>
+double RelativeRmsDifference(const GRID& a, const GRID& b)
+{
+    double squares = 0.0, differences = 0.0;
+    for (uint y=0; y<a.height(); y++)
+    {
+        for (uint x=0; x<a.width(); x++)
+        {
+            const double d = double(a(y,x))-double(b(y,x));
+            squares += double(a(y,x))*double(a(y,x));
+            differences += d*d;
+        }
+    }
+    return squares > 0.0 ? std::sqrt(differences/squares) : 0.0;
+}
+
+/// Sum over all cells.
+template<typename GRID>
+double Total(const GRID& a)
+{
+    double result = 0.0;
+    for (uint y=0; y<a.height(); y++)
+    {
+        for (uint x=0; x<a.width(); x++)
+            result += double(a(y,x));
+    }
+    return result;
+}
+
+/// True if every cell is finite.
+template<typename GRID>
+bool AllFinite(const GRID& a)
+{
+    for (uint y=0; y<a.height(); y++)
+    {
+        for (uint x=0; x<a.width(); x++)
+        {
+            if (!std::isfinite(float(a(y,x))))
+                return false;
+        }
+    }
+    return true;
+}
+
+/// CHECK()s that two grids are bitwise identical, names the first cell that differs.
+#define CHECK_IDENTICAL(A,B) \
+    do { long i_ = Tests::FirstDifference(A,B); \
+         CHECK_MESSAGE(i_ < 0, #A " and " #B " differ at cell " << i_ << " (y " << i_/long((A).width()) \
+                                << ", x " << i_%long((A).width()) << ")"); } while (0)
+
+/// CHECK_IDENTICAL() of terrain, water, sediment, fluxes and velocities of
+/// two simulations with the same flux model.
+void CheckIdenticalSimulations(const Simulation::FluidSimulation& a, const Simulation::FluidSimulation& b);
+
+} // namespace Tests
+
+#endif // TEST_H
@@ -0,0 +1,36 @@
+# Regression tests of the simulation, runs without a window or GL context.
+# Exits with a non-zero status if a test fails.
+
+TEMPLATE = app
+CONFIG += console
+CONFIG -= qt
+CONFIG -= app_bundle
+TARGET = TerrainFluidTests
+
+DEFINES += HEADLESS_BUILD
+QMAKE_CXXFLAGS += -std=c++11
+
+include(../Simulation/Simulation.pri)
+
+SOURCES += \
+    main.cpp \
+    Test.cpp \
+    SimulationTests.cpp \
+    CheckpointTests.cpp \
+    TerrainChunksTests.cpp \
+    GridLayoutTests.cpp \
+    KernelTests.cpp \
+    HalfPrecisionTests.cpp \
+    StaggeredTests.cpp \
+    AdaptiveStepperTests.cpp \
+    ProfilerTests.cpp \
+    ../TerrainChunks.cpp
+
+HEADERS += \
+    Test.h \
+    ../TerrainChunks.h
+
+mac {
+    INCLUDEPATH += /usr/local/include
+    QMAKE_CXXFLAGS += -stdlib=libc++
+}
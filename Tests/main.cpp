@@ -0,0 +1,23 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+
+#include <iostream>
+#include <string>
+
+#include "Test.h"
+
+/// Runs all tests, or those whose name contains the first argument.
+int main(int argc, char** argv)
+{
+    std::string filter = argc > 1 ? argv[1] : "";
+    return Tests::RunAll(filter) == 0 ? 0 : 1;
+}
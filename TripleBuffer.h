@@ -0,0 +1,82 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include "platform_includes.h"
+
+#include <atomic>
+
+/// Hands the latest of a series of values from one producer thread to one
+/// consumer thread, lock-free and without either side waiting.
+///
+/// The producer fills back() and publish() exchanges it with the shared
+/// slot. The consumer's update() exchanges front() with the shared slot if
+/// a value was published since the last update(), front() stays untouched
+/// until the next update(). Values published between two update() calls are
+/// skipped, the consumer always gets the latest one. publish() reports a
+/// skip, e.g. to carry changes of the skipped value over to the next one.
+template<typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer()
+        : _back(0),
+          _shared(1),
+          _front(2)
+    {}
+
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    /// Slot i, to set up all slots before the threads start.
+    T& slot(uint i) { return _slots[i]; }
+
+    // Producer
+    T& back() { return _slots[_back]; }
+
+    /// Returns true if the consumer skipped the value published before,
+    /// back() is that value then.
+    bool publish()
+    {
+        uint old = _shared.exchange(_back | Fresh, std::memory_order_acq_rel);
+        _back = old & Index;
+        return (old & Fresh) != 0;
+    }
+
+    // Consumer
+    const T& front() const { return _slots[_front]; }
+
+    /// Returns true if front() changed.
+    bool update()
+    {
+        if (!(_shared.load(std::memory_order_relaxed) & Fresh))
+            return false;
+        _front = _shared.exchange(_front, std::memory_order_acq_rel) & Index;
+        return true;
+    }
+
+private:
+    static const uint Index = 3;
+    static const uint Fresh = 4;
+
+    T _slots[3];
+
+    // the indices of the two sides on separate cache lines
+    uint _back;
+    char _padding0[64];
+    std::atomic<uint> _shared;
+    char _padding1[64];
+    uint _front;
+};
+
+#endif // TRIPLEBUFFER_H
@@ -0,0 +1,31 @@
+# Compares full and streamed vertex buffer uploads, needs a GL context. Runs
+# offscreen with a software GL, e.g. LIBGL_ALWAYS_SOFTWARE=1 xvfb-run.
+
+TEMPLATE = app
+CONFIG += console
+CONFIG -= qt
+CONFIG -= app_bundle
+TARGET = TerrainFluidUploadBenchmark
+
+INCLUDEPATH += ../ ../external/
+QMAKE_CXXFLAGS += -std=c++11
+
+# Grid2D initializes its rows with the parallel loops
+include(../Simulation/Simulation.pri)
+
+SOURCES += main.cpp \
+    ../Graphics/GLWrapper.cpp
+HEADERS += ../Graphics/VertexBuffer.h \
+    ../Graphics/GLWrapper.h
+
+mac {
+    INCLUDEPATH += /usr/local/include
+    QMAKE_LFLAGS += -lglfw -framework Cocoa -framework OpenGL -framework IOKit
+    LIBS+= -L/usr/local/lib
+    QMAKE_CXXFLAGS += -stdlib=libc++
+} else:unix {
+    CONFIG    += link_pkgconfig
+    PKGCONFIG += libglfw
+    LIBS+=-lGLEW
+    LIBS+=-lGL
+}
@@ -0,0 +1,200 @@
+/****************************************************************************
+    Copyright (C) 2012 Adrian Blumer (blumer.adrian@gmail.com)
+    Copyright (C) 2012 Pascal Spörri (pascal.spoerri@gmail.com)
+    Copyright (C) 2012 Sabina Schellenberg (sabina.schellenberg@gmail.com)
+
+    All Rights Reserved.
+
+    You may use, distribute and modify this code under the terms of the
+    MIT license (http://opensource.org/licenses/MIT).
+*****************************************************************************/
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <chrono>
+#include <vector>
+
+#include "tclap/CmdLine.h"
+#include "platform_includes.h"
+
+#include "Grid2D.h"
+#include "Graphics/VertexBuffer.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Helpers
+////////////////////////////////////////////////////////////////////////////
+
+template<typename T>
+static std::vector<T> ParseList(const std::string& list)
+{
+    std::vector<T> values;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream,item,','))
+    {
+        std::stringstream itemStream(item);
+        T value;
+        if (itemStream >> value)
+            values.push_back(value);
+    }
+    return values;
+}
+
+/// Changes a band of rows that moves by its height every frame, like the
+/// active region of the simulation, and flags them.
+static void ChangeRows(Grid2D<float>& grid, std::vector<uint8_t>& dirty, uint band, uint frame)
+{
+    const uint h = grid.height();
+    std::fill(dirty.begin(),dirty.end(),0);
+    for (uint i=0; i<band; i++)
+    {
+        uint y = (frame*band+i) % h;
+        for (uint x=0; x<grid.width(); x++)
+            grid(y,x) = float((frame*31 + y + x) % 1024);
+        dirty[y] = 1;
+    }
+}
+
+/// Number of cells of the data the buffer draws from that differ from grid.
+static uint CountMismatches(Graphics::VertexBuffer<float>& buffer, const Grid2D<float>& grid)
+{
+    std::vector<float> data(grid.size());
+    buffer.Bind();
+    glGetBufferSubData(GL_ARRAY_BUFFER, 0, data.size()*sizeof(float), &data[0]);
+
+    uint mismatches = 0;
+    for (size_t i=0; i<data.size(); i++)
+        mismatches += data[i] != grid.ptr()[i];
+    return mismatches;
+}
+
+/// Uploads frames times, returns the milliseconds per frame. A fraction
+/// below 0 uploads the whole grid with SetData().
+static double Run(uint dim, double fraction, uint frames, bool& correct)
+{
+    Grid2D<float> grid(dim,dim);
+    std::vector<uint8_t> dirty(dim,1);
+    Graphics::VertexBuffer<float> buffer;
+    const bool full = fraction < 0;
+    const uint band = full ? dim/10 : uint(fraction*dim);
+
+    // first upload, allocates
+    if (full)
+        buffer.SetData(grid);
+    else
+        buffer.SetRows(grid,dirty);
+    glFinish();
+
+    // times the uploads only
+    high_resolution_clock clock;
+    double ms = 0.0;
+    for (uint frame=1; frame<=frames; frame++)
+    {
+        ChangeRows(grid,dirty,band,frame);
+        high_resolution_clock::time_point start = clock.now();
+        if (full)
+            buffer.SetData(grid);
+        else
+            buffer.SetRows(grid,dirty);
+        glFinish();
+        ms += duration_cast<duration<double,std::milli>>(clock.now()-start).count();
+    }
+    ms /= frames;
+
+    correct = CountMismatches(buffer,grid) == 0;
+    return ms;
+}
+
+// Main
+////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+    std::vector<uint> dims;
+    std::vector<double> fractions;
+    uint frames;
+
+    try
+    {
+        TCLAP::CmdLine cmd("Compares full and streamed vertex buffer uploads.", ' ', "0.9");
+        TCLAP::ValueArg<std::string> dimsArg("d","dims","Grid sizes. Default: 512,1024,2048.",false,"512,1024,2048","list");
+        TCLAP::ValueArg<std::string> fractionArg("r","rows","Fractions of rows changed per frame for SetRows(). Default: 0,0.05,0.25,1.",false,"0,0.05,0.25,1","list");
+        TCLAP::ValueArg<uint> framesArg("n","frames","Timed frames per run. Default: 50.",false,50,"uint");
+        cmd.add(dimsArg);
+        cmd.add(fractionArg);
+        cmd.add(framesArg);
+        cmd.parse( argc, argv );
+
+        dims = ParseList<uint>(dimsArg.getValue());
+        fractions = ParseList<double>(fractionArg.getValue());
+        frames = std::max(1u,framesArg.getValue());
+    }
+    catch (TCLAP::ArgException &e)
+    {
+        std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+        return 1;
+    }
+
+    // a small window for the context, nothing is drawn
+    if (!glfwInit())
+    {
+        std::cerr << "[GLFW] Error initialising GLFW" << std::endl;
+        return 1;
+    }
+    glfwOpenWindowHint(GLFW_OPENGL_VERSION_MAJOR, 3);
+    glfwOpenWindowHint(GLFW_OPENGL_VERSION_MINOR, 2);
+    glfwOpenWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwOpenWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    if (!glfwOpenWindow(64,64, 8,8,8,8,8,8, GLFW_WINDOW))
+    {
+        std::cerr << "[GLFW] Error opening window" << std::endl;
+        glfwTerminate();
+        return 1;
+    }
+#if !defined(__APPLE__) && !defined(__MACH__)
+    glewExperimental = GL_TRUE;
+    GLenum err = glewInit();
+    if (GLEW_OK != err)
+    {
+        std::cerr << "[GLEW] Init failed: " << glewGetErrorString(err) << std::endl;
+        glfwTerminate();
+        return 1;
+    }
+#endif
+
+    {
+        Graphics::VertexBuffer<float> probe;
+        Grid2D<float> grid(1,1);
+        probe.SetRows(grid,std::vector<uint8_t>(1,1));
+        cout << "renderer: " << glGetString(GL_RENDERER) << ", streaming: "
+             << (probe.Persistent() ? "persistent mapped staging" : "glBufferSubData") << "\n";
+    }
+
+    bool allCorrect = true;
+    cout << std::left << std::setw(6) << "dim" << std::setw(10) << "upload" << std::setw(8) << "rows"
+         << std::setw(12) << "ms/frame" << "check\n";
+    for (uint dim : dims)
+    {
+        std::vector<double> runs(1,-1.0);
+        runs.insert(runs.end(),fractions.begin(),fractions.end());
+        for (double fraction : runs)
+        {
+            bool correct;
+            double ms = Run(dim,fraction,frames,correct);
+            allCorrect &= correct;
+
+            std::ostringstream rows;
+            rows << (fraction < 0 ? 100.0 : fraction*100) << "%";
+            cout << std::left << std::setw(6) << dim << std::setw(10) << (fraction < 0 ? "SetData" : "SetRows")
+                 << std::setw(8) << rows.str() << std::setw(12) << std::fixed << std::setprecision(3) << ms
+                 << (correct ? "ok" : "MISMATCH") << "\n";
+            cout.unsetf(std::ios::fixed);
+        }
+    }
+
+    glfwTerminate();
+    return allCorrect ? 0 : 1;
+}
@@ -35,6 +35,7 @@ int main(int argc, char** argv)
     int windowWidth = 800;
     int windowHeight = 600;
     uint terrainDim = 300;
+    double timeWarp = 1.0;
 
     // Read Command Line Arguments /////////////////////////////////////////
     ////////////////////////////////////////////////////////////////////////
@@ -42,9 +43,12 @@ int main(int argc, char** argv)
     {
         TCLAP::CmdLine cmd("Terrain Eroision & Fluid Simulation.", ' ', "0.9");
         TCLAP::ValueArg<uint> dimArg("d","dim","Size of the terrain. Default: 300.",false,300,"uint");
+        TCLAP::ValueArg<double> warpArg("w","warp","Simulated time per wall clock time (keys N/M halve/double it). Default: 1.",false,1.0,"double");
         cmd.add(dimArg);
+        cmd.add(warpArg);
         cmd.parse( argc, argv );
         terrainDim = dimArg.getValue();
+        timeWarp = warpArg.getValue();
     }
     catch (TCLAP::ArgException &e)
     {
@@ -64,9 +68,14 @@ int main(int argc, char** argv)
 
 
     glfwOpenWindowHint(GLFW_FSAA_SAMPLES, 4); // 4x antialiasing
-    // Use OpenGL Core v3.2
+    // Use OpenGL Core v3.3 (GLSL 330 for uintBitsToFloat in lambert_v.glsl).
+    // GLFW only requests 3.2 on OS X, which returns the newest core profile.
     glfwOpenWindowHint(GLFW_OPENGL_VERSION_MAJOR, 3);
+#if defined(__APPLE__) || defined(__MACH__)
     glfwOpenWindowHint(GLFW_OPENGL_VERSION_MINOR, 2);
+#else
+    glfwOpenWindowHint(GLFW_OPENGL_VERSION_MINOR, 3);
+#endif
     glfwOpenWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     glfwOpenWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 
@@ -104,6 +113,7 @@ int main(int argc, char** argv)
     glfwSetWindowCloseCallback(onWindowClose);
 
     simulationPtr = new TerrainFluidSimulation(terrainDim);
+    simulationPtr->SetTimeWarp(timeWarp);
     simulationPtr->Run();
 
     delete simulationPtr;
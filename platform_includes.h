@@ -24,7 +24,10 @@
 #include <glm/glm.hpp> // brew install glm
 
 
-#if defined(__APPLE__) || defined(__MACH__)
+#if defined(HEADLESS_BUILD)
+// Simulation only build, no windowing or OpenGL headers
+
+#elif defined(__APPLE__) || defined(__MACH__)
 // for Mac
 //#include <OpenGL/gl3.h>
 //#include <OpenGL/glu.h>